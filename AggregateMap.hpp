@@ -0,0 +1,562 @@
+//An indexable skiplist that also folds a monoid over its values.
+
+#ifndef AGGREGATE_MAP_H
+#define AGGREGATE_MAP_H
+
+#include <utility>
+#include <stdexcept>
+#include <new>
+#include <limits>
+#include <stdint.h>
+#include "Map.hpp"
+
+namespace cs540
+{
+
+//Monoids for AggregateMap. A monoid has a value_type, an identity(),
+//lift() turning a mapped value into a value_type, and combine(a, b),
+//which has to be associative but need not be commutative: a covers the
+//keys before b's.
+template <typename T>
+struct Map_Sum
+{
+	typedef T value_type;
+	value_type identity() const {return T();}
+	value_type lift(const T &v) const {return v;}
+	value_type combine(const value_type &a, const value_type &b) const {return a + b;}
+};
+
+template <typename T>
+struct Map_Min
+{
+	typedef T value_type;
+	value_type identity() const {return std::numeric_limits<T>::max();}
+	value_type lift(const T &v) const {return v;}
+	value_type combine(const value_type &a, const value_type &b) const {return b < a ? b : a;}
+};
+
+template <typename T>
+struct Map_Max
+{
+	typedef T value_type;
+	value_type identity() const {return std::numeric_limits<T>::lowest();}
+	value_type lift(const T &v) const {return v;}
+	value_type combine(const value_type &a, const value_type &b) const {return a < b ? b : a;}
+};
+
+//Number of values pred accepts
+template <typename T, typename Pred_T>
+struct Map_CountIf
+{
+	typedef size_t value_type;
+	Pred_T pred;
+
+	Map_CountIf(Pred_T p = Pred_T()) : pred(p) {}
+	value_type identity() const {return 0;}
+	value_type lift(const T &v) const {return pred(v) ? 1 : 0;}
+	value_type combine(value_type a, value_type b) const {return a + b;}
+};
+
+//Node of an AggregateMap. The tower follows the node inline like in
+//Map_Node: ptrs(), then indexer() with the same spans as Map, then
+//aggs(), where aggs()[x] folds the values this node's level x span
+//covers, the node itself included. Head holds no pair. Aligned so ptrs()
+//can start right after it.
+template <typename Key_T, typename Mapped_T, typename Agg_T>
+class alignas(void *) AggregateMap_Node
+{
+	public:
+		int height;
+		alignas(std::pair<const Key_T, Mapped_T>) unsigned char pairBytes[sizeof(std::pair<const Key_T, Mapped_T>)];
+
+		AggregateMap_Node(int h) : height(h) {}
+		AggregateMap_Node(const AggregateMap_Node &) = delete;
+		AggregateMap_Node &operator=(const AggregateMap_Node &) = delete;
+
+		std::pair<const Key_T, Mapped_T> &pair() {return *(std::pair<const Key_T, Mapped_T> *)pairBytes;}
+		const std::pair<const Key_T, Mapped_T> &pair() const {return *(const std::pair<const Key_T, Mapped_T> *)pairBytes;}
+		AggregateMap_Node **ptrs() {return (AggregateMap_Node **)(this + 1);}
+		AggregateMap_Node * const *ptrs() const {return (AggregateMap_Node * const *)(this + 1);}
+		int *indexer() {return (int *)(ptrs() + height);}
+		const int *indexer() const {return (const int *)(ptrs() + height);}
+		Agg_T *aggs() {return (Agg_T *)((char *)this + aggOffset(height));}
+		const Agg_T *aggs() const {return (const Agg_T *)((const char *)this + aggOffset(height));}
+
+		static size_t alignment() {return alignof(AggregateMap_Node) > alignof(Agg_T) ? alignof(AggregateMap_Node) : alignof(Agg_T);}
+		//Bytes needed for a node and its tower
+		static size_t bytes(int h) {return aggOffset(h) + h * sizeof(Agg_T);}
+
+	private:
+		static size_t aggOffset(int h)
+		{
+			size_t at = sizeof(AggregateMap_Node) + h * (sizeof(AggregateMap_Node *) + sizeof(int));
+			return (at + alignof(Agg_T) - 1) & ~(alignof(Agg_T) - 1);
+		}
+};
+
+//Map's skiplist where every tower level also stores the monoid fold of
+//the values its span skips, the way indexer() stores their count. Range
+//folds by key or by index then take O(log n): the walk climbs and drops
+//through the towers between the two ends, adding whole spans at a time.
+//
+//Every value write has to refold the spans above it, so values are
+//read only through iterators and at(), and change only through
+//insert_or_assign() and modify(). Each of those, insert and erase cost
+//O(log n) monoid combines on top of the usual search.
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+class AggregateMap
+{
+	public:
+		typedef typename Monoid_T::value_type Agg_T;
+
+	private:
+		typedef AggregateMap_Node<Key_T, Mapped_T, Agg_T> Node;
+
+	public:
+
+	class ConstIterator
+	{
+		public:
+			friend class AggregateMap;
+			ConstIterator() = delete;
+			ConstIterator &operator++()
+			{
+				node = node -> ptrs()[0];
+				return *this;
+			}
+			ConstIterator operator++(int)
+			{
+				ConstIterator rv(*this);
+				node = node -> ptrs()[0];
+				return rv;
+			}
+			const std::pair<const Key_T, Mapped_T> &operator*() const {return node -> pair();}
+			const std::pair<const Key_T, Mapped_T> *operator->() const {return &node -> pair();}
+
+			bool operator==(const ConstIterator &it) const{return node == it.node;}
+			bool operator!=(const ConstIterator &it) const{return node != it.node;}
+
+		private:
+			ConstIterator(const Node *n) : node(n) {};
+			//nullptr at the end
+			const Node *node;
+	};
+
+		explicit AggregateMap(const Monoid_T &m = Monoid_T(), const Map_LevelPolicy &pol = Map_LevelPolicy());
+		AggregateMap(const AggregateMap &) = delete;
+		AggregateMap &operator=(const AggregateMap &) = delete;
+		~AggregateMap();
+		size_t size() const {return length;}
+		bool empty() const {return length == 0;}
+		ConstIterator begin() const {return ConstIterator(head -> ptrs()[0]);}
+		ConstIterator end() const {return ConstIterator(nullptr);}
+		ConstIterator find(const Key_T &) const;
+		const Mapped_T &at(const Key_T &) const;
+		//0 based like Map::get
+		const Mapped_T &get(int) const;
+		//Number of keys less than key
+		size_t rank(const Key_T &) const;
+		std::pair<ConstIterator, bool> insert(const std::pair<Key_T, Mapped_T> &);
+		std::pair<ConstIterator, bool> insert_or_assign(const Key_T &, const Mapped_T &);
+		//Calls f(Mapped_T &) on key's value and refolds the spans over
+		//	it, also when f throws. out_of_range if key is missing.
+		template <typename F>
+		void modify(const Key_T &, F f);
+		void erase(const Key_T &);
+		void clear();
+
+		//Fold of the values of keys in [lo, hi), identity if none
+		Agg_T aggregate(const Key_T &lo, const Key_T &hi) const;
+		//Fold of the values at indexes [i, j). out_of_range unless
+		//	0 <= i <= j <= size().
+		Agg_T aggregate_rank(size_t i, size_t j) const;
+		//Fold of every value
+		Agg_T total() const;
+		const Monoid_T &monoid() const {return mon;}
+
+		//Nodes and bytes held, as for Map::arenaStats
+		Map_ArenaStats arenaStats() const {return arena.stats();}
+
+	private:
+		Node *head;
+		size_t length;
+		unsigned int levels;
+		Monoid_T mon;
+		Map_Arena arena;
+		Map_LevelGen levelGen;
+
+		Node *newNode(int);
+		void deleteNode(Node *);
+		void destroyNodes();
+		void initHead();
+		Node *descend(const Key_T &, Node **, size_t *) const;
+		const Node *nodeAt(size_t) const;
+		void refold(Node *, int);
+		template <typename F>
+		void update(Node *, Node **, F);
+		Node *insertAt(const Key_T &, const Mapped_T &, Node **, size_t *);
+		void link(Node *, Node **, size_t *);
+		Agg_T foldRanks(size_t, size_t) const;
+};
+
+//Constructors
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+AggregateMap<Key_T, Mapped_T, Monoid_T>::AggregateMap(const Monoid_T &m, const Map_LevelPolicy &pol) : mon(m), levelGen(pol)
+{
+	initHead();
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+AggregateMap<Key_T, Mapped_T, Monoid_T>::~AggregateMap()
+{
+	destroyNodes();
+}
+
+//Node Allocation
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+typename AggregateMap<Key_T, Mapped_T, Monoid_T>::Node *AggregateMap<Key_T, Mapped_T, Monoid_T>::newNode(int h)
+{
+	void *mem = arena.allocate(Node::bytes(h), Node::alignment(), h);
+	Node *node = new(mem) Node(h);
+	int x = 0;
+	try
+	{
+		for(; x < h; x++)
+		{
+			node -> ptrs()[x] = nullptr;
+			node -> indexer()[x] = 0;
+			new(&node -> aggs()[x]) Agg_T(mon.identity());
+		}
+	}
+	catch(...)
+	{
+		while(x-- > 0)
+			node -> aggs()[x].~Agg_T();
+		arena.deallocate(mem, Node::bytes(h), h);
+		throw;
+	}
+	return node;
+}
+
+//Destroys the tower; the pair must already be gone
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+void AggregateMap<Key_T, Mapped_T, Monoid_T>::deleteNode(Node *node)
+{
+	int h = node -> height;
+	for(int x = 0; x < h; x++)
+		node -> aggs()[x].~Agg_T();
+	node -> ~Node();
+	arena.deallocate(node, Node::bytes(h), h);
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+void AggregateMap<Key_T, Mapped_T, Monoid_T>::destroyNodes()
+{
+	Node *node = head -> ptrs()[0];
+	while(node != nullptr)
+	{
+		Node *next = node -> ptrs()[0];
+		node -> pair().~pair();
+		deleteNode(node);
+		node = next;
+	}
+	deleteNode(head);
+	arena.release();
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+void AggregateMap<Key_T, Mapped_T, Monoid_T>::initHead()
+{
+	head = newNode(MAP_MAX_HEIGHT);
+	length = 0;
+	levels = 1;
+	head -> indexer()[0] = 1;
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+void AggregateMap<Key_T, Mapped_T, Monoid_T>::clear()
+{
+	destroyNodes();
+	initHead();
+}
+
+//Fills updater with the last node before key on every level and pos
+//with its rank (head is 0). Returns the first node not before key, or
+//nullptr.
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+typename AggregateMap<Key_T, Mapped_T, Monoid_T>::Node *AggregateMap<Key_T, Mapped_T, Monoid_T>::descend(const Key_T &key, Node **updater, size_t *pos) const
+{
+	Node *node = head;
+	size_t z = 0;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		while(node -> ptrs()[x] != nullptr && node -> ptrs()[x] -> pair().first < key)
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+		updater[x] = node;
+		pos[x] = z;
+	}
+	return node -> ptrs()[0];
+}
+
+//Node with 1 based rank r, head for 0
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+const typename AggregateMap<Key_T, Mapped_T, Monoid_T>::Node *AggregateMap<Key_T, Mapped_T, Monoid_T>::nodeAt(size_t r) const
+{
+	const Node *node = head;
+	size_t z = 0;
+	for(int x = levels - 1; x >= 0; x--)
+		while(node -> ptrs()[x] != nullptr && z + node -> indexer()[x] <= r)
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+	return node;
+}
+
+//Recomputes node's level x fold from level x - 1, which has to be up
+//to date already. Expected O(1 / (1 - p)) combines.
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+void AggregateMap<Key_T, Mapped_T, Monoid_T>::refold(Node *node, int x)
+{
+	if(x == 0)
+	{
+		node -> aggs()[0] = node == head ? mon.identity() : mon.lift(node -> pair().second);
+		return;
+	}
+	Agg_T acc = node -> aggs()[x - 1];
+	for(Node *n = node -> ptrs()[x - 1]; n != node -> ptrs()[x]; n = n -> ptrs()[x - 1])
+		acc = mon.combine(acc, n -> aggs()[x - 1]);
+	node -> aggs()[x] = std::move(acc);
+}
+
+//Element Access
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+typename AggregateMap<Key_T, Mapped_T, Monoid_T>::ConstIterator AggregateMap<Key_T, Mapped_T, Monoid_T>::find(const Key_T &key) const
+{
+	Node *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	Node *node = descend(key, updater, pos);
+	if(node != nullptr && node -> pair().first == key) return ConstIterator(node);
+	return end();
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+const Mapped_T &AggregateMap<Key_T, Mapped_T, Monoid_T>::at(const Key_T &key) const
+{
+	ConstIterator it = find(key);
+	if(it == end()) throw std::out_of_range ("");
+	return it -> second;
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+const Mapped_T &AggregateMap<Key_T, Mapped_T, Monoid_T>::get(int index) const
+{
+	if(index < 0 || (size_t)index >= length) throw std::out_of_range ("");
+	return nodeAt(index + 1) -> pair().second;
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+size_t AggregateMap<Key_T, Mapped_T, Monoid_T>::rank(const Key_T &key) const
+{
+	Node *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	descend(key, updater, pos);
+	return pos[0];
+}
+
+//Aggregates
+//Fold over the nodes ranked [a, b). From the node at a, each hop takes
+//the tallest level that does not pass b, so the walk climbs the towers
+//and comes back down, O(log(b - a)) hops expected.
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+typename AggregateMap<Key_T, Mapped_T, Monoid_T>::Agg_T AggregateMap<Key_T, Mapped_T, Monoid_T>::foldRanks(size_t a, size_t b) const
+{
+	Agg_T acc = mon.identity();
+	if(a >= b) return acc;
+	const Node *node = nodeAt(a);
+	size_t z = a;
+	while(z < b)
+	{
+		int x = node -> height - 1;
+		while(x > 0 && z + node -> indexer()[x] > b)
+			x--;
+		acc = mon.combine(acc, node -> aggs()[x]);
+		z += node -> indexer()[x];
+		node = node -> ptrs()[x];
+	}
+	return acc;
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+typename AggregateMap<Key_T, Mapped_T, Monoid_T>::Agg_T AggregateMap<Key_T, Mapped_T, Monoid_T>::aggregate(const Key_T &lo, const Key_T &hi) const
+{
+	if(!(lo < hi)) return mon.identity();
+	return foldRanks(rank(lo) + 1, rank(hi) + 1);
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+typename AggregateMap<Key_T, Mapped_T, Monoid_T>::Agg_T AggregateMap<Key_T, Mapped_T, Monoid_T>::aggregate_rank(size_t i, size_t j) const
+{
+	if(i > j || j > length) throw std::out_of_range ("");
+	return foldRanks(i + 1, j + 1);
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+typename AggregateMap<Key_T, Mapped_T, Monoid_T>::Agg_T AggregateMap<Key_T, Mapped_T, Monoid_T>::total() const
+{
+	return foldRanks(1, length + 1);
+}
+
+//Modifiers
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+std::pair<typename AggregateMap<Key_T, Mapped_T, Monoid_T>::ConstIterator, bool> AggregateMap<Key_T, Mapped_T, Monoid_T>::insert(const std::pair<Key_T, Mapped_T> &in)
+{
+	Node *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	Node *node = descend(in.first, updater, pos);
+	if(node != nullptr && node -> pair().first == in.first) return std::make_pair(ConstIterator(node), false);
+	return std::make_pair(ConstIterator(insertAt(in.first, in.second, updater, pos)), true);
+}
+
+//One descent either way: a hit reuses the search path as the covers
+//to refold, a miss links a new node on it
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+std::pair<typename AggregateMap<Key_T, Mapped_T, Monoid_T>::ConstIterator, bool> AggregateMap<Key_T, Mapped_T, Monoid_T>::insert_or_assign(const Key_T &key, const Mapped_T &obj)
+{
+	Node *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	Node *node = descend(key, updater, pos);
+	if(node == nullptr || !(node -> pair().first == key))
+		return std::make_pair(ConstIterator(insertAt(key, obj, updater, pos)), true);
+
+	//Up to its height node's own spans cover it, above that the
+	//	predecessors' do
+	for(int x = 0; x < node -> height; x++)
+		updater[x] = node;
+	update(node, updater, [&obj](Mapped_T &v) {v = obj;});
+	return std::make_pair(ConstIterator(node), false);
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+template <typename F>
+void AggregateMap<Key_T, Mapped_T, Monoid_T>::modify(const Key_T &key, F f)
+{
+	//Every level's last node at or before key covers it
+	Node *cover[MAP_MAX_HEIGHT];
+	Node *node = head;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		while(node -> ptrs()[x] != nullptr && !(key < node -> ptrs()[x] -> pair().first))
+			node = node -> ptrs()[x];
+		cover[x] = node;
+	}
+	if(node == head || !(node -> pair().first == key)) throw std::out_of_range ("");
+	update(node, cover, f);
+}
+
+//Calls f on node's value, then refolds cover[x], the level x span that
+//holds node, on every level
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+template <typename F>
+void AggregateMap<Key_T, Mapped_T, Monoid_T>::update(Node *node, Node **cover, F f)
+{
+	try
+	{
+		f(node -> pair().second);
+	}
+	catch(...)
+	{
+		for(unsigned int x = 0; x < levels; x++)
+			refold(cover[x], x);
+		throw;
+	}
+	for(unsigned int x = 0; x < levels; x++)
+		refold(cover[x], x);
+}
+
+//Makes a node for key and obj and links it in on the search path left
+//by descend
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+typename AggregateMap<Key_T, Mapped_T, Monoid_T>::Node *AggregateMap<Key_T, Mapped_T, Monoid_T>::insertAt(const Key_T &key, const Mapped_T &obj, Node **updater, size_t *pos)
+{
+	Node *ins = newNode(levelGen.next(levels + 1));
+	try
+	{
+		new(&ins -> pair()) std::pair<const Key_T, Mapped_T>(key, obj);
+	}
+	catch(...)
+	{
+		deleteNode(ins);
+		throw;
+	}
+	link(ins, updater, pos);
+	return ins;
+}
+
+//Links ins in after updater[0], whose ranks are in pos, then refolds
+//every span that changed
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+void AggregateMap<Key_T, Mapped_T, Monoid_T>::link(Node *ins, Node **updater, size_t *pos)
+{
+	unsigned int h = ins -> height;
+	//New levels start out as head spanning the whole map
+	for(unsigned int x = levels; x < h; x++)
+	{
+		head -> ptrs()[x] = nullptr;
+		head -> indexer()[x] = length + 1;
+		updater[x] = head;
+		pos[x] = 0;
+	}
+	if(h > levels) levels = h;
+
+	size_t r = pos[0] + 1;
+	for(unsigned int x = 0; x < h; x++)
+	{
+		size_t end = pos[x] + updater[x] -> indexer()[x];
+		ins -> ptrs()[x] = updater[x] -> ptrs()[x];
+		ins -> indexer()[x] = end + 1 - r;
+		updater[x] -> ptrs()[x] = ins;
+		updater[x] -> indexer()[x] = r - pos[x];
+	}
+	for(unsigned int x = h; x < levels; x++)
+		updater[x] -> indexer()[x]++;
+	length++;
+
+	for(unsigned int x = 0; x < levels; x++)
+	{
+		if(x < h) refold(ins, x);
+		refold(updater[x], x);
+	}
+}
+
+template <typename Key_T, typename Mapped_T, typename Monoid_T>
+void AggregateMap<Key_T, Mapped_T, Monoid_T>::erase(const Key_T &key)
+{
+	Node *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	Node *node = descend(key, updater, pos);
+	if(node == nullptr || !(node -> pair().first == key)) throw std::out_of_range ("");
+
+	for(int x = 0; x < node -> height; x++)
+	{
+		updater[x] -> ptrs()[x] = node -> ptrs()[x];
+		updater[x] -> indexer()[x] += node -> indexer()[x] - 1;
+	}
+	for(unsigned int x = node -> height; x < levels; x++)
+		updater[x] -> indexer()[x]--;
+	length--;
+	node -> pair().~pair();
+	deleteNode(node);
+	while(levels > 1 && head -> ptrs()[levels - 1] == nullptr)
+		levels--;
+
+	for(unsigned int x = 0; x < levels; x++)
+		refold(updater[x], x);
+}
+
+}
+
+#endif
@@ -0,0 +1,626 @@
+//An indexable skiplist whose nodes each hold a sorted block of keys.
+
+#ifndef BLOCK_MAP_H
+#define BLOCK_MAP_H
+
+#include <utility>
+#include <stdexcept>
+#include <new>
+#include <type_traits>
+#include <stdint.h>
+#include "Map.hpp"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace cs540
+{
+
+//Number of keys in a sorted block that are less than key, which is
+//also where key belongs. The generic version scans; the integer and
+//floating point versions compare a whole vector of keys at once. Only
+//full vectors below n are loaded, so slots past n are never read.
+template <typename Key_T>
+struct BlockMap_Search
+{
+	static int countLess(const Key_T *keys, int n, const Key_T &key)
+	{
+		int x = 0;
+		while(x < n && keys[x] < key) x++;
+		return x;
+	}
+};
+
+#if defined(__SSE2__)
+template <>
+struct BlockMap_Search<int32_t>
+{
+	static int countLess(const int32_t *keys, int n, const int32_t &key)
+	{
+		__m128i k = _mm_set1_epi32(key);
+		int x = 0, z = 0;
+		for(; x + 4 <= n; x += 4)
+		{
+			__m128i v = _mm_load_si128((const __m128i *)(keys + x));
+			z += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, k))));
+		}
+		for(; x < n; x++) z += keys[x] < key;
+		return z;
+	}
+};
+
+template <>
+struct BlockMap_Search<float>
+{
+	static int countLess(const float *keys, int n, const float &key)
+	{
+		__m128 k = _mm_set1_ps(key);
+		int x = 0, z = 0;
+		for(; x + 4 <= n; x += 4)
+			z += __builtin_popcount(_mm_movemask_ps(_mm_cmplt_ps(_mm_load_ps(keys + x), k)));
+		for(; x < n; x++) z += keys[x] < key;
+		return z;
+	}
+};
+
+template <>
+struct BlockMap_Search<double>
+{
+	static int countLess(const double *keys, int n, const double &key)
+	{
+		__m128d k = _mm_set1_pd(key);
+		int x = 0, z = 0;
+		for(; x + 2 <= n; x += 2)
+			z += __builtin_popcount(_mm_movemask_pd(_mm_cmplt_pd(_mm_load_pd(keys + x), k)));
+		for(; x < n; x++) z += keys[x] < key;
+		return z;
+	}
+};
+#endif
+
+//64 bit compares need SSE4.2
+#if defined(__SSE4_2__)
+template <>
+struct BlockMap_Search<int64_t>
+{
+	static int countLess(const int64_t *keys, int n, const int64_t &key)
+	{
+		__m128i k = _mm_set1_epi64x(key);
+		int x = 0, z = 0;
+		for(; x + 2 <= n; x += 2)
+		{
+			__m128i v = _mm_load_si128((const __m128i *)(keys + x));
+			z += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(k, v))));
+		}
+		for(; x < n; x++) z += keys[x] < key;
+		return z;
+	}
+};
+#endif
+
+//A node holds up to B keys and their values in two arrays, the keys
+//starting on a cache line. The tower follows the node inline like in
+//Map_Node, but a span counts elements, not nodes: indexer()[x] is how
+//many elements lie between the start of this node and the start of
+//ptrs()[x], or the end of the map if this is the last node on level x.
+template <typename Key_T, typename Mapped_T, int B>
+class BlockMap_Node
+{
+	public:
+		int height;
+		//Keys in use, never 0 except in head
+		int count;
+		alignas(64) unsigned char keyBytes[B * sizeof(Key_T)];
+		alignas(Mapped_T) unsigned char valueBytes[B * sizeof(Mapped_T)];
+
+		BlockMap_Node(int h) : height(h), count(0)
+		{
+			for(int x = 0; x < height; x++)
+			{
+				ptrs()[x] = nullptr;
+				indexer()[x] = 0;
+			}
+		}
+		BlockMap_Node(const BlockMap_Node &) = delete;
+		BlockMap_Node &operator=(const BlockMap_Node &) = delete;
+
+		Key_T *keys() {return (Key_T *)keyBytes;}
+		const Key_T *keys() const {return (const Key_T *)keyBytes;}
+		Mapped_T *values() {return (Mapped_T *)valueBytes;}
+		const Mapped_T *values() const {return (const Mapped_T *)valueBytes;}
+		BlockMap_Node **ptrs() {return (BlockMap_Node **)(this + 1);}
+		BlockMap_Node * const *ptrs() const {return (BlockMap_Node * const *)(this + 1);}
+		int *indexer() {return (int *)(ptrs() + height);}
+		const int *indexer() const {return (const int *)(ptrs() + height);}
+
+		//Bytes needed for a node and its tower
+		static size_t bytes(int h) {return sizeof(BlockMap_Node) + h * (sizeof(BlockMap_Node *) + sizeof(int));}
+
+		//Moves the element at from in src to the empty slot to
+		void moveTo(int from, BlockMap_Node *dst, int to)
+		{
+			new(&dst -> keys()[to]) Key_T(std::move(keys()[from]));
+			new(&dst -> values()[to]) Mapped_T(std::move(values()[from]));
+			destroy(from);
+		}
+		void destroy(int x)
+		{
+			keys()[x].~Key_T();
+			values()[x].~Mapped_T();
+		}
+};
+
+//Unrolled skiplist: Map's tower and rank machinery over nodes that each
+//hold a block of B keys, so a lookup walks about n / B nodes' worth of
+//levels and finishes with one vectorised search inside a block. A full
+//block splits in half into a new node; a block that drops below a
+//quarter full takes in its successor if they fit together.
+//
+//Keys and values live in separate arrays, so iterators hand out a pair
+//of references rather than a reference to a pair.
+template <typename Key_T, typename Mapped_T, int B = 16>
+class BlockMap
+{
+	static_assert(B >= 4 && B % 4 == 0, "block size must be a multiple of 4");
+	typedef BlockMap_Node<Key_T, Mapped_T, B> Node;
+
+	public:
+
+	class Iterator
+	{
+		public:
+			friend class BlockMap;
+			Iterator() = delete;
+			Iterator &operator++()
+			{
+				advance();
+				return *this;
+			}
+			Iterator operator++(int)
+			{
+				Iterator rv(*this);
+				advance();
+				return rv;
+			}
+			const Key_T &key() const {return node -> keys()[index];}
+			Mapped_T &value() const {return node -> values()[index];}
+			std::pair<const Key_T &, Mapped_T &> operator*() const {return std::pair<const Key_T &, Mapped_T &>(key(), value());}
+
+			bool operator==(const Iterator &it) const{return node == it.node && index == it.index;}
+			bool operator!=(const Iterator &it) const{return !(*this == it);}
+
+		private:
+			Iterator(Node *n, int i) : node(n), index(i) {};
+			void advance()
+			{
+				if(++index < node -> count) return;
+				node = node -> ptrs()[0];
+				index = 0;
+			}
+			//nullptr at the end
+			Node *node;
+			int index;
+	};
+
+	class ConstIterator
+	{
+		public:
+			friend class BlockMap;
+			ConstIterator() = delete;
+			ConstIterator(const Iterator &it) : node(it.node), index(it.index) {};
+			ConstIterator &operator++()
+			{
+				advance();
+				return *this;
+			}
+			ConstIterator operator++(int)
+			{
+				ConstIterator rv(*this);
+				advance();
+				return rv;
+			}
+			const Key_T &key() const {return node -> keys()[index];}
+			const Mapped_T &value() const {return node -> values()[index];}
+			std::pair<const Key_T &, const Mapped_T &> operator*() const {return std::pair<const Key_T &, const Mapped_T &>(key(), value());}
+
+			bool operator==(const ConstIterator &it) const{return node == it.node && index == it.index;}
+			bool operator!=(const ConstIterator &it) const{return !(*this == it);}
+
+		private:
+			ConstIterator(const Node *n, int i) : node(n), index(i) {};
+			void advance()
+			{
+				if(++index < node -> count) return;
+				node = node -> ptrs()[0];
+				index = 0;
+			}
+			const Node *node;
+			int index;
+	};
+
+		BlockMap();
+		explicit BlockMap(const Map_LevelPolicy &);
+		BlockMap(const BlockMap &) = delete;
+		BlockMap &operator=(const BlockMap &) = delete;
+		~BlockMap();
+		size_t size() const {return length;}
+		bool empty() const {return length == 0;}
+		Iterator begin() {return Iterator(head -> ptrs()[0], 0);}
+		Iterator end() {return Iterator(nullptr, 0);}
+		ConstIterator begin() const {return ConstIterator(head -> ptrs()[0], 0);}
+		ConstIterator end() const {return ConstIterator(nullptr, 0);}
+		Iterator find(const Key_T &);
+		ConstIterator find(const Key_T &) const;
+		Mapped_T &at(const Key_T &);
+		const Mapped_T &at(const Key_T &) const;
+		Mapped_T &operator[](const Key_T &);
+		//0 based like Map::get
+		Mapped_T &get(int);
+		const Mapped_T &get(int) const;
+		//Number of keys less than key
+		size_t rank(const Key_T &) const;
+		std::pair<Iterator, bool> insert(const std::pair<Key_T, Mapped_T> &);
+		void erase(const Key_T &);
+		void clear();
+
+		//Nodes and bytes held, as for Map::arenaStats
+		Map_ArenaStats arenaStats() const {return arena.stats();}
+
+	private:
+		Node *head;
+		size_t length;
+		unsigned int levels;
+		Map_Arena arena;
+		Map_LevelGen levelGen;
+
+		Node *newNode(int);
+		void deleteNode(Node *);
+		void destroyNodes();
+		Node *descend(const Key_T &, Node **, size_t *) const;
+		void strictPreds(const Key_T &, Node **) const;
+		void unlinkNode(Node *, Node **);
+		Node *split(Node *, Node **, size_t *);
+		//Constructs the value from args only if key is not there yet
+		template <typename K_T, typename... Args>
+		std::pair<Iterator, bool> insertPair(K_T &&, Args&&...);
+};
+
+//Constructors
+template <typename Key_T, typename Mapped_T, int B>
+BlockMap<Key_T, Mapped_T, B>::BlockMap() : length(0), levels(1)
+{
+	head = newNode(MAP_MAX_HEIGHT);
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+BlockMap<Key_T, Mapped_T, B>::BlockMap(const Map_LevelPolicy &pol) : length(0), levels(1), levelGen(pol)
+{
+	head = newNode(MAP_MAX_HEIGHT);
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+BlockMap<Key_T, Mapped_T, B>::~BlockMap()
+{
+	destroyNodes();
+}
+
+//Node Allocation
+template <typename Key_T, typename Mapped_T, int B>
+typename BlockMap<Key_T, Mapped_T, B>::Node *BlockMap<Key_T, Mapped_T, B>::newNode(int h)
+{
+	void *mem = arena.allocate(Node::bytes(h), alignof(Node), h);
+	return new(mem) Node(h);
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+void BlockMap<Key_T, Mapped_T, B>::deleteNode(Node *node)
+{
+	int h = node -> height;
+	for(int x = 0; x < node -> count; x++)
+		node -> destroy(x);
+	node -> ~Node();
+	arena.deallocate(node, Node::bytes(h), h);
+}
+
+//Destroys every element, head included, and hands all slabs back
+template <typename Key_T, typename Mapped_T, int B>
+void BlockMap<Key_T, Mapped_T, B>::destroyNodes()
+{
+	if(!std::is_trivially_destructible<Key_T>::value || !std::is_trivially_destructible<Mapped_T>::value)
+		for(Node *node = head -> ptrs()[0]; node != nullptr; node = node -> ptrs()[0])
+			for(int x = 0; x < node -> count; x++)
+				node -> destroy(x);
+	arena.release();
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+void BlockMap<Key_T, Mapped_T, B>::clear()
+{
+	destroyNodes();
+	head = newNode(MAP_MAX_HEIGHT);
+	length = 0;
+	levels = 1;
+}
+
+//Fills updater with the last node on every level whose first key is
+//not greater than key, and pos with that node's position. Returns the
+//level 0 one, which is the node key is in or belongs in, or head if
+//key is smaller than everything.
+template <typename Key_T, typename Mapped_T, int B>
+typename BlockMap<Key_T, Mapped_T, B>::Node *BlockMap<Key_T, Mapped_T, B>::descend(const Key_T &key, Node **updater, size_t *pos) const
+{
+	Node *node = head;
+	size_t z = 0;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		while(node -> ptrs()[x] != nullptr && !(key < node -> ptrs()[x] -> keys()[0]))
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+		updater[x] = node;
+		pos[x] = z;
+	}
+	return node;
+}
+
+//Last node on every level whose first key is less than key
+template <typename Key_T, typename Mapped_T, int B>
+void BlockMap<Key_T, Mapped_T, B>::strictPreds(const Key_T &key, Node **preds) const
+{
+	Node *node = head;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		while(node -> ptrs()[x] != nullptr && node -> ptrs()[x] -> keys()[0] < key)
+			node = node -> ptrs()[x];
+		preds[x] = node;
+	}
+}
+
+//Element Access
+template <typename Key_T, typename Mapped_T, int B>
+typename BlockMap<Key_T, Mapped_T, B>::Iterator BlockMap<Key_T, Mapped_T, B>::find(const Key_T &key)
+{
+	Node *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	Node *node = descend(key, updater, pos);
+	if(node == head) return end();
+	int x = BlockMap_Search<Key_T>::countLess(node -> keys(), node -> count, key);
+	if(x < node -> count && node -> keys()[x] == key) return Iterator(node, x);
+	return end();
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+typename BlockMap<Key_T, Mapped_T, B>::ConstIterator BlockMap<Key_T, Mapped_T, B>::find(const Key_T &key) const
+{
+	Node *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	const Node *node = descend(key, updater, pos);
+	if(node == head) return end();
+	int x = BlockMap_Search<Key_T>::countLess(node -> keys(), node -> count, key);
+	if(x < node -> count && node -> keys()[x] == key) return ConstIterator(node, x);
+	return end();
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+Mapped_T &BlockMap<Key_T, Mapped_T, B>::at(const Key_T &key)
+{
+	Iterator it = find(key);
+	if(it == end()) throw std::out_of_range ("");
+	return it.value();
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+const Mapped_T &BlockMap<Key_T, Mapped_T, B>::at(const Key_T &key) const
+{
+	ConstIterator it = find(key);
+	if(it == end()) throw std::out_of_range ("");
+	return it.value();
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+Mapped_T &BlockMap<Key_T, Mapped_T, B>::operator[](const Key_T &key)
+{
+	return insertPair(key).first.value();
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+Mapped_T &BlockMap<Key_T, Mapped_T, B>::get(int index)
+{
+	return const_cast<Mapped_T &>(static_cast<const BlockMap *>(this) -> get(index));
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+const Mapped_T &BlockMap<Key_T, Mapped_T, B>::get(int index) const
+{
+	if(index < 0 || (size_t)index >= length) throw std::out_of_range ("");
+	const Node *node = head;
+	size_t z = 0;
+	for(int x = levels - 1; x >= 0; x--)
+		while(node -> ptrs()[x] != nullptr && z + node -> indexer()[x] <= (size_t)index)
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+	return node -> values()[index - z];
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+size_t BlockMap<Key_T, Mapped_T, B>::rank(const Key_T &key) const
+{
+	Node *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	Node *node = descend(key, updater, pos);
+	if(node == head) return 0;
+	return pos[0] + BlockMap_Search<Key_T>::countLess(node -> keys(), node -> count, key);
+}
+
+//Modifiers
+template <typename Key_T, typename Mapped_T, int B>
+std::pair<typename BlockMap<Key_T, Mapped_T, B>::Iterator, bool> BlockMap<Key_T, Mapped_T, B>::insert(const std::pair<Key_T, Mapped_T> &in)
+{
+	return insertPair(in.first, in.second);
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+template <typename K_T, typename... Args>
+std::pair<typename BlockMap<Key_T, Mapped_T, B>::Iterator, bool> BlockMap<Key_T, Mapped_T, B>::insertPair(K_T &&key, Args&&... args)
+{
+	Node *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	Node *node = descend(key, updater, pos);
+	int x = 0;
+	if(node != head)
+	{
+		x = BlockMap_Search<Key_T>::countLess(node -> keys(), node -> count, key);
+		if(x < node -> count && node -> keys()[x] == key) return std::make_pair(Iterator(node, x), false);
+	}
+	else if(head -> ptrs()[0] != nullptr)
+		//Smaller than everything, so it becomes the first key of the first block
+		node = head -> ptrs()[0];
+	else
+	{
+		//First element. Its node starts with no keys and every level
+		//	of head points at it with a span of 0.
+		node = newNode(levelGen.next(levels + 1));
+		if((unsigned int)node -> height > levels) levels = node -> height;
+		for(int y = 0; y < node -> height; y++)
+			head -> ptrs()[y] = node;
+		for(unsigned int y = 0; y < levels; y++)
+			head -> indexer()[y] = 0;
+	}
+
+	//From here on updater holds, per level, the node whose span covers
+	//	the slot the key goes in
+	for(int y = 0; y < node -> height; y++)
+	{
+		updater[y] = node;
+		pos[y] = pos[0];
+	}
+	if(node -> count == B)
+	{
+		Node *right = split(node, updater, pos);
+		if(x > B / 2)
+		{
+			x -= B / 2;
+			node = right;
+			for(int y = 0; y < right -> height; y++)
+				updater[y] = right;
+		}
+	}
+
+	for(int y = node -> count; y > x; y--)
+		node -> moveTo(y - 1, node, y);
+	new(&node -> keys()[x]) Key_T(std::forward<K_T>(key));
+	try
+	{
+		new(&node -> values()[x]) Mapped_T(std::forward<Args>(args)...);
+	}
+	catch(...)
+	{
+		node -> keys()[x].~Key_T();
+		for(int y = x; y < node -> count; y++)
+			node -> moveTo(y + 1, node, y);
+		throw;
+	}
+	node -> count++;
+	length++;
+	for(unsigned int y = 0; y < levels; y++)
+		updater[y] -> indexer()[y]++;
+	return std::make_pair(Iterator(node, x), true);
+}
+
+//Moves the upper half of a full node into a new node linked right after
+//it and returns the new node. updater and pos are the node's own
+//predecessors as left by insertPair; updater[x] for levels the new
+//node reaches is not changed, since the new node lies after the key.
+template <typename Key_T, typename Mapped_T, int B>
+typename BlockMap<Key_T, Mapped_T, B>::Node *BlockMap<Key_T, Mapped_T, B>::split(Node *node, Node **updater, size_t *pos)
+{
+	Node *right = newNode(levelGen.next(levels + 1));
+	for(int x = B / 2; x < B; x++)
+		node -> moveTo(x, right, x - B / 2);
+	node -> count = B / 2;
+	right -> count = B - B / 2;
+
+	//New levels start out spanning the whole map from head
+	for(unsigned int x = levels; x < (unsigned int)right -> height; x++)
+	{
+		head -> ptrs()[x] = nullptr;
+		head -> indexer()[x] = length;
+		updater[x] = head;
+		pos[x] = 0;
+	}
+	if((unsigned int)right -> height > levels) levels = right -> height;
+
+	size_t at = pos[0] + B / 2;
+	for(int x = 0; x < right -> height; x++)
+	{
+		size_t end = pos[x] + updater[x] -> indexer()[x];
+		right -> ptrs()[x] = updater[x] -> ptrs()[x];
+		right -> indexer()[x] = end - at;
+		updater[x] -> ptrs()[x] = right;
+		updater[x] -> indexer()[x] = at - pos[x];
+	}
+	return right;
+}
+
+template <typename Key_T, typename Mapped_T, int B>
+void BlockMap<Key_T, Mapped_T, B>::erase(const Key_T &key)
+{
+	Node *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	Node *node = descend(key, updater, pos);
+	if(node == head) throw std::out_of_range ("");
+	int x = BlockMap_Search<Key_T>::countLess(node -> keys(), node -> count, key);
+	if(x == node -> count || !(node -> keys()[x] == key)) throw std::out_of_range ("");
+
+	//Predecessors must be found while the node still has a first key
+	Node *preds[MAP_MAX_HEIGHT];
+	if(node -> count == 1) strictPreds(key, preds);
+
+	node -> destroy(x);
+	for(int y = x + 1; y < node -> count; y++)
+		node -> moveTo(y, node, y - 1);
+	node -> count--;
+	length--;
+	for(unsigned int y = 0; y < levels; y++)
+		updater[y] -> indexer()[y]--;
+
+	if(node -> count == 0)
+	{
+		unlinkNode(node, preds);
+		return;
+	}
+
+	//Take in the next block if both fit in one
+	Node *next = node -> ptrs()[0];
+	if(node -> count < B / 4 && next != nullptr && node -> count + next -> count <= B)
+	{
+		strictPreds(next -> keys()[0], preds);
+		for(int y = 0; y < next -> count; y++)
+			next -> moveTo(y, node, node -> count + y);
+		node -> count += next -> count;
+		next -> count = 0;
+		unlinkNode(next, preds);
+	}
+}
+
+//Unlinks a node holding no elements, whose predecessor on every level
+//is in preds, and frees it
+template <typename Key_T, typename Mapped_T, int B>
+void BlockMap<Key_T, Mapped_T, B>::unlinkNode(Node *node, Node **preds)
+{
+	for(int x = 0; x < node -> height; x++)
+	{
+		preds[x] -> ptrs()[x] = node -> ptrs()[x];
+		preds[x] -> indexer()[x] += node -> indexer()[x];
+	}
+	deleteNode(node);
+	while(levels > 1 && head -> ptrs()[levels - 1] == nullptr)
+		levels--;
+}
+
+}
+
+#endif
@@ -0,0 +1,324 @@
+//A bounded cache on top of Map: LRU eviction and per-entry time to live.
+
+#ifndef CACHE_MAP_H
+#define CACHE_MAP_H
+
+#include <utility>
+#include <chrono>
+#include <stdexcept>
+#include "Map.hpp"
+
+namespace cs540
+{
+
+//Counters since construction or CacheMap::resetStats()
+struct CacheMap_Stats
+{
+	//Lookups that found a live entry
+	size_t hits;
+	//Lookups that found nothing, or an entry that had expired
+	size_t misses;
+	//Entries pushed out to make room
+	size_t evictions;
+	//Expired entries removed, by a lookup or by purge()
+	size_t expirations;
+};
+
+//Keys stay in a Map, so the cache iterates in key order and answers
+//rank queries like any Map. Next to the skiplist, every entry is also
+//linked into a recency list threaded through the mapped values: a hit
+//moves the entry to the front in O(1), and when an insert finds the
+//cache full the victim is simply the back of the list. Only unlinking
+//it from the skiplist costs a search, O(log n) as for any erase.
+//
+//An entry may carry a time to live, from the cache-wide default or its
+//own. Lookups drop entries found expired, and purge() drops all of them
+//in one pass. Iteration, get() and rank() do not look at the clock, so
+//they still see expired entries until one of those removes them.
+//
+//Clock_T is any clock with now(), so tests can step a fake one.
+template <typename Key_T, typename Mapped_T, typename Clock_T = std::chrono::steady_clock>
+class CacheMap
+{
+	public:
+		typedef typename Clock_T::duration Duration_T;
+
+	private:
+		struct Entry;
+		typedef std::pair<Key_T, Entry> Pair_T;
+		struct Entry
+		{
+			Mapped_T value;
+			//time_point::max() for entries that never expire
+			typename Clock_T::time_point expires;
+			//Recency list, newer toward the front
+			Pair_T *newer;
+			Pair_T *older;
+
+			Entry(const Mapped_T &v, typename Clock_T::time_point e) : value(v), expires(e), newer(nullptr), older(nullptr) {}
+		};
+		typedef Map<Key_T, Entry> Map_T;
+
+	public:
+
+	class ConstIterator
+	{
+		public:
+			friend class CacheMap;
+			ConstIterator() = delete;
+			ConstIterator &operator++()
+			{
+				++it;
+				return *this;
+			}
+			ConstIterator operator++(int)
+			{
+				ConstIterator rv(*this);
+				++it;
+				return rv;
+			}
+			const Key_T &key() const {return it -> first;}
+			const Mapped_T &value() const {return it -> second.value;}
+			std::pair<const Key_T &, const Mapped_T &> operator*() const {return std::pair<const Key_T &, const Mapped_T &>(key(), value());}
+
+			bool operator==(const ConstIterator &i) const{return it == i.it;}
+			bool operator!=(const ConstIterator &i) const{return it != i.it;}
+
+		private:
+			ConstIterator(const typename Map_T::ConstIterator &i) : it(i) {};
+			typename Map_T::ConstIterator it;
+	};
+
+		//Holds at most capacity entries; ttl zero means entries never
+		//	expire unless put() says otherwise
+		explicit CacheMap(size_t capacity, Duration_T ttl = Duration_T::zero());
+		//The recency list points into the map's nodes
+		CacheMap(const CacheMap &) = delete;
+		CacheMap &operator=(const CacheMap &) = delete;
+		size_t size() const {return m.size();}
+		bool empty() const {return m.empty();}
+		size_t capacity() const {return cap;}
+		ConstIterator begin() const {return ConstIterator(m.begin());}
+		ConstIterator end() const {return ConstIterator(m.end());}
+
+		//Counts a hit and makes key the most recent entry, or counts a
+		//	miss and returns nullptr. An expired entry is removed and
+		//	counts as a miss.
+		Mapped_T *find(const Key_T &);
+		//Like find, but std::out_of_range on a miss
+		Mapped_T &at(const Key_T &);
+		//Looks without counting, refreshing or expiring anything
+		const Mapped_T *peek(const Key_T &) const;
+		//0 based like Map::get, in key order
+		const Mapped_T &get(int) const;
+		//Number of keys less than key
+		size_t rank(const Key_T &key) const {return m.rank(key);}
+
+		//Inserts or overwrites key as the most recent entry, with the
+		//	default time to live, evicting the least recent entry first
+		//	if the cache is full
+		void put(const Key_T &, const Mapped_T &);
+		//Same with its own time to live, zero for none
+		void put(const Key_T &, const Mapped_T &, Duration_T ttl);
+		//False if key was not there
+		bool erase(const Key_T &);
+		//Removes every expired entry in one O(n) pass and returns how many
+		size_t purge();
+		void clear();
+
+		CacheMap_Stats stats() const {return counters;}
+		void resetStats();
+
+	private:
+		Map_T m;
+		size_t cap;
+		Duration_T ttl;
+		//Most and least recently used entries, nullptr when empty
+		Pair_T *newest;
+		Pair_T *oldest;
+		CacheMap_Stats counters;
+
+		void unlinkRecent(Pair_T *);
+		void pushNewest(Pair_T *);
+		void remove(Pair_T *);
+		bool expired(const Pair_T *p, typename Clock_T::time_point now) const {return now >= p -> second.expires;}
+		typename Clock_T::time_point deadline(Duration_T) const;
+};
+
+//Constructors
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+CacheMap<Key_T, Mapped_T, Clock_T>::CacheMap(size_t capacity, Duration_T t) : cap(capacity), ttl(t), newest(nullptr), oldest(nullptr)
+{
+	if(capacity == 0) throw std::invalid_argument ("cache capacity must be positive");
+	resetStats();
+}
+
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+void CacheMap<Key_T, Mapped_T, Clock_T>::resetStats()
+{
+	counters.hits = 0;
+	counters.misses = 0;
+	counters.evictions = 0;
+	counters.expirations = 0;
+}
+
+//Recency List
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+void CacheMap<Key_T, Mapped_T, Clock_T>::unlinkRecent(Pair_T *p)
+{
+	Entry &e = p -> second;
+	if(e.newer != nullptr) e.newer -> second.older = e.older;
+	else	newest = e.older;
+	if(e.older != nullptr) e.older -> second.newer = e.newer;
+	else	oldest = e.newer;
+	e.newer = e.older = nullptr;
+}
+
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+void CacheMap<Key_T, Mapped_T, Clock_T>::pushNewest(Pair_T *p)
+{
+	p -> second.older = newest;
+	if(newest != nullptr) newest -> second.newer = p;
+	else	oldest = p;
+	newest = p;
+}
+
+//Unlinks p from both the recency list and the map
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+void CacheMap<Key_T, Mapped_T, Clock_T>::remove(Pair_T *p)
+{
+	unlinkRecent(p);
+	m.erase(p -> first);
+}
+
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+typename Clock_T::time_point CacheMap<Key_T, Mapped_T, Clock_T>::deadline(Duration_T t) const
+{
+	if(t <= Duration_T::zero()) return Clock_T::time_point::max();
+	return Clock_T::now() + t;
+}
+
+//Element Access
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+Mapped_T *CacheMap<Key_T, Mapped_T, Clock_T>::find(const Key_T &key)
+{
+	typename Map_T::Iterator it = m.find(key);
+	if(it == m.end())
+	{
+		counters.misses++;
+		return nullptr;
+	}
+	Pair_T *p = &*it;
+	if(p -> second.expires != Clock_T::time_point::max() && expired(p, Clock_T::now()))
+	{
+		remove(p);
+		counters.expirations++;
+		counters.misses++;
+		return nullptr;
+	}
+	counters.hits++;
+	if(p != newest)
+	{
+		unlinkRecent(p);
+		pushNewest(p);
+	}
+	return &p -> second.value;
+}
+
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+Mapped_T &CacheMap<Key_T, Mapped_T, Clock_T>::at(const Key_T &key)
+{
+	Mapped_T *v = find(key);
+	if(v == nullptr) throw std::out_of_range ("");
+	return *v;
+}
+
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+const Mapped_T *CacheMap<Key_T, Mapped_T, Clock_T>::peek(const Key_T &key) const
+{
+	typename Map_T::ConstIterator it = m.find(key);
+	return it == m.end() ? nullptr : &it -> second.value;
+}
+
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+const Mapped_T &CacheMap<Key_T, Mapped_T, Clock_T>::get(int index) const
+{
+	return m.select(index) -> second.value;
+}
+
+//Modifiers
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+void CacheMap<Key_T, Mapped_T, Clock_T>::put(const Key_T &key, const Mapped_T &obj)
+{
+	put(key, obj, ttl);
+}
+
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+void CacheMap<Key_T, Mapped_T, Clock_T>::put(const Key_T &key, const Mapped_T &obj, Duration_T t)
+{
+	typename Clock_T::time_point e = deadline(t);
+	typename Map_T::Iterator it = m.find(key);
+	if(it != m.end())
+	{
+		Pair_T *p = &*it;
+		p -> second.value = obj;
+		p -> second.expires = e;
+		if(p != newest)
+		{
+			unlinkRecent(p);
+			pushNewest(p);
+		}
+		return;
+	}
+	if(m.size() >= cap)
+	{
+		//An expired victim counts as an expiration rather than an eviction
+		Pair_T *victim = oldest;
+		if(expired(victim, Clock_T::now())) counters.expirations++;
+		else	counters.evictions++;
+		remove(victim);
+	}
+	Pair_T *p = &*m.insert(Pair_T(key, Entry(obj, e))).first;
+	pushNewest(p);
+}
+
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+bool CacheMap<Key_T, Mapped_T, Clock_T>::erase(const Key_T &key)
+{
+	typename Map_T::Iterator it = m.find(key);
+	if(it == m.end()) return false;
+	remove(&*it);
+	return true;
+}
+
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+size_t CacheMap<Key_T, Mapped_T, Clock_T>::purge()
+{
+	typename Clock_T::time_point now = Clock_T::now();
+	size_t n = 0;
+	for(typename Map_T::Iterator it = m.begin(); it != m.end(); )
+	{
+		Pair_T *p = &*it;
+		if(!expired(p, now))
+		{
+			++it;
+			continue;
+		}
+		unlinkRecent(p);
+		it = m.erase(it);
+		n++;
+	}
+	counters.expirations += n;
+	return n;
+}
+
+template <typename Key_T, typename Mapped_T, typename Clock_T>
+void CacheMap<Key_T, Mapped_T, Clock_T>::clear()
+{
+	m.clear();
+	newest = oldest = nullptr;
+}
+
+}
+
+#endif
@@ -0,0 +1,525 @@
+//A lock-free skiplist map that can be shared between threads.
+
+#ifndef CONCURRENT_MAP_H
+#define CONCURRENT_MAP_H
+
+#include <utility>
+#include <vector>
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <experimental/optional>
+
+namespace cs540
+{
+
+//Tallest tower any node (including head) can have
+const int CONCURRENT_MAP_MAX_HEIGHT = 32;
+
+//Epoch based reclamation.
+//A thread pins the current epoch before touching shared nodes and
+//unpins when done. Unlinked nodes are retired into a bucket tagged
+//with the epoch they were retired in, and only freed once the global
+//epoch is two ahead of that tag, i.e. once every thread that could
+//still be holding a pointer to them has unpinned.
+class Epoch_Domain
+{
+	public:
+		struct Retired
+		{
+			void *ptr;
+			void (*del)(void *);
+		};
+
+		struct Record
+		{
+			//(epoch << 1) | 1 while pinned, 0 otherwise
+			std::atomic<unsigned long> local;
+			std::atomic<bool> inUse;
+			Record *next;
+			int depth;
+			unsigned int retiredSinceScan;
+			std::vector<Retired> bucket[3];
+			unsigned long tag[3];
+
+			Record() : local(0), inUse(true), next(nullptr), depth(0), retiredSinceScan(0)
+			{
+				for(int x = 0; x < 3; x++) tag[x] = 0;
+			}
+		};
+
+		Epoch_Domain() : epoch(2), records(nullptr) {}
+		Epoch_Domain(const Epoch_Domain &) = delete;
+		Epoch_Domain &operator=(const Epoch_Domain &) = delete;
+		~Epoch_Domain();
+
+		//Shared by every ConcurrentMap in the process
+		static Epoch_Domain &instance()
+		{
+			static Epoch_Domain domain;
+			return domain;
+		}
+
+		void pin();
+		void unpin();
+		void retire(void *ptr, void (*del)(void *));
+
+	private:
+		//Frees the calling thread's record when the thread exits
+		struct Holder
+		{
+			Epoch_Domain *domain;
+			Record *rec;
+			Holder() : domain(nullptr), rec(nullptr) {}
+			~Holder()
+			{
+				if(rec != nullptr) rec -> inUse.store(false, std::memory_order_release);
+			}
+		};
+
+		//Scan for an epoch advance after this many retires
+		static const unsigned int SCAN_EVERY = 64;
+
+		std::atomic<unsigned long> epoch;
+		std::atomic<Record *> records;
+
+		Record *self();
+		void collect(Record *rec, unsigned long e);
+		void tryAdvance(unsigned long e);
+		static void freeBucket(std::vector<Retired> &bucket);
+};
+
+inline Epoch_Domain::~Epoch_Domain()
+{
+	//Only runs at exit, no thread can be pinned anymore
+	Record *rec = records.load();
+	while(rec != nullptr)
+	{
+		Record *del = rec;
+		rec = rec -> next;
+		for(int x = 0; x < 3; x++) freeBucket(del -> bucket[x]);
+		delete del;
+	}
+}
+
+inline Epoch_Domain::Record *Epoch_Domain::self()
+{
+	static thread_local Holder holder;
+	if(holder.rec != nullptr && holder.domain == this) return holder.rec;
+
+	//Reuse the record of a thread that has exited
+	Record *rec = records.load(std::memory_order_acquire);
+	for(; rec != nullptr; rec = rec -> next)
+	{
+		bool expected = false;
+		if(!rec -> inUse.load(std::memory_order_relaxed)
+			&& rec -> inUse.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+			break;
+	}
+	if(rec == nullptr)
+	{
+		rec = new Record();
+		Record *first = records.load(std::memory_order_relaxed);
+		do
+		{
+			rec -> next = first;
+		} while(!records.compare_exchange_weak(first, rec, std::memory_order_acq_rel));
+	}
+	holder.domain = this;
+	holder.rec = rec;
+	return rec;
+}
+
+inline void Epoch_Domain::pin()
+{
+	Record *rec = self();
+	if(rec -> depth++ > 0) return;
+	unsigned long e = epoch.load(std::memory_order_acquire);
+	rec -> local.store((e << 1) | 1, std::memory_order_seq_cst);
+	collect(rec, e);
+}
+
+inline void Epoch_Domain::unpin()
+{
+	Record *rec = self();
+	if(--rec -> depth > 0) return;
+	rec -> local.store(0, std::memory_order_release);
+}
+
+inline void Epoch_Domain::retire(void *ptr, void (*del)(void *))
+{
+	Record *rec = self();
+	unsigned long e = epoch.load(std::memory_order_acquire);
+	collect(rec, e);
+	rec -> bucket[e % 3].push_back(Retired{ptr, del});
+	rec -> tag[e % 3] = e;
+	if(++rec -> retiredSinceScan >= SCAN_EVERY)
+	{
+		rec -> retiredSinceScan = 0;
+		tryAdvance(e);
+	}
+}
+
+//Frees every bucket that is at least two epochs old
+inline void Epoch_Domain::collect(Record *rec, unsigned long e)
+{
+	for(int x = 0; x < 3; x++)
+		if(!rec -> bucket[x].empty() && rec -> tag[x] + 2 <= e)
+			freeBucket(rec -> bucket[x]);
+}
+
+//The epoch can only move on once every pinned thread has seen it
+inline void Epoch_Domain::tryAdvance(unsigned long e)
+{
+	for(Record *rec = records.load(std::memory_order_acquire); rec != nullptr; rec = rec -> next)
+	{
+		unsigned long local = rec -> local.load(std::memory_order_seq_cst);
+		if((local & 1) && (local >> 1) != e) return;
+	}
+	epoch.compare_exchange_strong(e, e + 1, std::memory_order_acq_rel);
+}
+
+inline void Epoch_Domain::freeBucket(std::vector<Retired> &bucket)
+{
+	for(size_t x = 0; x < bucket.size(); x++)
+		bucket[x].del(bucket[x].ptr);
+	bucket.clear();
+}
+
+//Keeps the calling thread pinned for its lifetime
+class Epoch_Guard
+{
+	public:
+		Epoch_Guard() {Epoch_Domain::instance().pin();}
+		~Epoch_Guard() {Epoch_Domain::instance().unpin();}
+		Epoch_Guard(const Epoch_Guard &) = delete;
+		Epoch_Guard &operator=(const Epoch_Guard &) = delete;
+};
+
+//Node of a ConcurrentMap. The tower of next pointers follows the node
+//inline, so the node is aligned for ptrs() to start right after it.
+template <typename Key_T, typename Mapped_T>
+class alignas(std::atomic<uintptr_t>) ConcurrentMap_Node
+{
+	public:
+		//Empty for head only
+		std::experimental::optional<std::pair<Key_T, Mapped_T>> p;
+		int height;
+		//The inserter and the eraser each hold one reference.
+		//Whoever drops the last one retires the node.
+		std::atomic<int> owners;
+
+		ConcurrentMap_Node(int h) : height(h), owners(2) {initTower();}
+		ConcurrentMap_Node(const std::pair<Key_T, Mapped_T> &pair, int h) : p(pair), height(h), owners(2) {initTower();}
+		ConcurrentMap_Node(const ConcurrentMap_Node &) = delete;
+		ConcurrentMap_Node &operator=(const ConcurrentMap_Node &) = delete;
+		~ConcurrentMap_Node()
+		{
+			for(int x = 0; x < height; x++)
+				ptrs()[x].~atomic<uintptr_t>();
+		}
+
+		//Next node per "level". The low bit marks this node as
+		//	logically deleted at that level.
+		std::atomic<uintptr_t> *ptrs() {return (std::atomic<uintptr_t> *)(this + 1);}
+
+		static size_t bytes(int h) {return sizeof(ConcurrentMap_Node) + h * sizeof(std::atomic<uintptr_t>);}
+		static ConcurrentMap_Node *create(const std::pair<Key_T, Mapped_T> &pair, int h)
+		{
+			void *mem = ::operator new(bytes(h));
+			try
+			{
+				return new(mem) ConcurrentMap_Node(pair, h);
+			}
+			catch(...)
+			{
+				::operator delete(mem);
+				throw;
+			}
+		}
+		static ConcurrentMap_Node *createHead(int h)
+		{
+			return new(::operator new(bytes(h))) ConcurrentMap_Node(h);
+		}
+		static void destroy(void *n)
+		{
+			((ConcurrentMap_Node *)n) -> ~ConcurrentMap_Node();
+			::operator delete(n);
+		}
+
+	private:
+		void initTower()
+		{
+			for(int x = 0; x < height; x++)
+				new(&ptrs()[x]) std::atomic<uintptr_t>(0);
+		}
+};
+
+//Lock-free map after Herlihy and Shavit's LockFreeSkipList.
+//Levels are linked with CAS and deletion marks the low bit of a
+//node's next pointers, top level first. The level 0 mark is what
+//removes the key. Unlinked nodes are reclaimed through Epoch_Domain.
+//
+//Values are immutable once inserted, so lookups hand back a copy.
+template <typename Key_T, typename Mapped_T>
+class ConcurrentMap
+{
+	public:
+		ConcurrentMap();
+		ConcurrentMap(const ConcurrentMap &) = delete;
+		ConcurrentMap &operator=(const ConcurrentMap &) = delete;
+		//Not thread safe, no other thread may be using the map
+		~ConcurrentMap();
+
+		//Approximate while other threads are writing
+		size_t size() const {return length.load(std::memory_order_relaxed);}
+		bool empty() const {return size() == 0;}
+		bool contains(const Key_T &) const;
+		//Copies the mapped value into out if key is present
+		bool find(const Key_T &, Mapped_T &out) const;
+		//False if key was already present
+		bool insert(const std::pair<Key_T, Mapped_T> &);
+		//False if key was not present
+		bool erase(const Key_T &);
+		//Calls f on every pair in key order. Weakly consistent: pairs
+		//	inserted or erased during the walk may or may not be seen.
+		template <typename F>
+		void for_each(F f) const;
+
+	private:
+		typedef ConcurrentMap_Node<Key_T, Mapped_T> Node;
+
+		Node *head;
+		std::atomic<size_t> length;
+
+		static Node *unmark(uintptr_t v) {return (Node *)(v & ~(uintptr_t)1);}
+		static bool marked(uintptr_t v) {return v & 1;}
+		Node *locate(const Key_T &) const;
+		bool search(const Key_T &, Node **preds, Node **succs);
+		void release(Node *);
+		static int randomHeight();
+};
+
+//Constructors
+template <typename Key_T, typename Mapped_T>
+ConcurrentMap<Key_T, Mapped_T>::ConcurrentMap() : length(0)
+{
+	head = Node::createHead(CONCURRENT_MAP_MAX_HEIGHT);
+}
+
+template <typename Key_T, typename Mapped_T>
+ConcurrentMap<Key_T, Mapped_T>::~ConcurrentMap()
+{
+	//Nodes still linked at level 0 have not been retired
+	Node *node = unmark(head -> ptrs()[0].load());
+	while(node != nullptr)
+	{
+		Node *del = node;
+		node = unmark(node -> ptrs()[0].load());
+		Node::destroy(del);
+	}
+	Node::destroy(head);
+}
+
+//Element Access
+template <typename Key_T, typename Mapped_T>
+bool ConcurrentMap<Key_T, Mapped_T>::contains(const Key_T &key) const
+{
+	Epoch_Guard guard;
+	return locate(key) != nullptr;
+}
+
+template <typename Key_T, typename Mapped_T>
+bool ConcurrentMap<Key_T, Mapped_T>::find(const Key_T &key, Mapped_T &out) const
+{
+	Epoch_Guard guard;
+	Node *node = locate(key);
+	if(node == nullptr) return false;
+	out = node -> p.value().second;
+	return true;
+}
+
+//Read only walk, marked nodes are skipped rather than unlinked.
+//Caller must be pinned.
+template <typename Key_T, typename Mapped_T>
+typename ConcurrentMap<Key_T, Mapped_T>::Node *ConcurrentMap<Key_T, Mapped_T>::locate(const Key_T &key) const
+{
+	Node *pred = head, *curr = nullptr;
+	for(int x = CONCURRENT_MAP_MAX_HEIGHT - 1; x >= 0; x--)
+	{
+		curr = unmark(pred -> ptrs()[x].load(std::memory_order_acquire));
+		while(curr != nullptr)
+		{
+			uintptr_t succ = curr -> ptrs()[x].load(std::memory_order_acquire);
+			if(marked(succ))
+				curr = unmark(succ);
+			else if(curr -> p.value().first < key)
+			{
+				pred = curr;
+				curr = unmark(succ);
+			}
+			else	break;
+		}
+	}
+	if(curr == nullptr || !(curr -> p.value().first == key)) return nullptr;
+	return curr;
+}
+
+template <typename Key_T, typename Mapped_T>
+template <typename F>
+void ConcurrentMap<Key_T, Mapped_T>::for_each(F f) const
+{
+	Epoch_Guard guard;
+	Node *node = unmark(head -> ptrs()[0].load(std::memory_order_acquire));
+	while(node != nullptr)
+	{
+		uintptr_t succ = node -> ptrs()[0].load(std::memory_order_acquire);
+		if(!marked(succ)) f(node -> p.value());
+		node = unmark(succ);
+	}
+}
+
+//Modifiers
+template <typename Key_T, typename Mapped_T>
+bool ConcurrentMap<Key_T, Mapped_T>::insert(const std::pair<Key_T, Mapped_T> &in)
+{
+	Epoch_Guard guard;
+	Node *preds[CONCURRENT_MAP_MAX_HEIGHT], *succs[CONCURRENT_MAP_MAX_HEIGHT];
+	int h = randomHeight();
+	Node *ins = nullptr;
+
+	//Link level 0, this is where the key becomes visible
+	while(true)
+	{
+		if(search(in.first, preds, succs))
+		{
+			if(ins != nullptr) Node::destroy(ins);
+			return false;
+		}
+		if(ins == nullptr) ins = Node::create(in, h);
+		for(int x = 0; x < h; x++)
+			ins -> ptrs()[x].store((uintptr_t)succs[x], std::memory_order_relaxed);
+		uintptr_t expected = (uintptr_t)succs[0];
+		if(preds[0] -> ptrs()[0].compare_exchange_strong(expected, (uintptr_t)ins, std::memory_order_acq_rel))
+			break;
+	}
+	length.fetch_add(1, std::memory_order_relaxed);
+
+	//Link the upper levels. Stop early if someone is already erasing us.
+	for(int x = 1; x < h; x++)
+	{
+		while(true)
+		{
+			uintptr_t next = ins -> ptrs()[x].load(std::memory_order_acquire);
+			if(marked(next) || marked(ins -> ptrs()[0].load(std::memory_order_acquire)))
+				goto done;
+			//Retarget our own pointer if the successor moved since search
+			if(unmark(next) != succs[x]
+				&& !ins -> ptrs()[x].compare_exchange_strong(next, (uintptr_t)succs[x], std::memory_order_acq_rel))
+				goto done;
+			uintptr_t expected = (uintptr_t)succs[x];
+			if(preds[x] -> ptrs()[x].compare_exchange_strong(expected, (uintptr_t)ins, std::memory_order_acq_rel))
+				break;
+			search(in.first, preds, succs);
+			//Our key is gone from level 0, nothing left to link
+			if(succs[0] != ins) goto done;
+		}
+	}
+done:
+	//An erase may have raced with the linking above and missed a level
+	if(marked(ins -> ptrs()[0].load(std::memory_order_acquire)))
+		search(in.first, preds, succs);
+	release(ins);
+	return true;
+}
+
+template <typename Key_T, typename Mapped_T>
+bool ConcurrentMap<Key_T, Mapped_T>::erase(const Key_T &key)
+{
+	Epoch_Guard guard;
+	Node *preds[CONCURRENT_MAP_MAX_HEIGHT], *succs[CONCURRENT_MAP_MAX_HEIGHT];
+	if(!search(key, preds, succs)) return false;
+	Node *victim = succs[0];
+
+	//Mark the upper levels top down
+	for(int x = victim -> height - 1; x >= 1; x--)
+	{
+		uintptr_t next = victim -> ptrs()[x].load(std::memory_order_acquire);
+		while(!marked(next))
+			victim -> ptrs()[x].compare_exchange_weak(next, next | 1, std::memory_order_acq_rel);
+	}
+
+	//Whoever marks level 0 owns the erase
+	uintptr_t next = victim -> ptrs()[0].load(std::memory_order_acquire);
+	while(true)
+	{
+		if(marked(next)) return false;
+		if(victim -> ptrs()[0].compare_exchange_weak(next, next | 1, std::memory_order_acq_rel))
+			break;
+	}
+	length.fetch_sub(1, std::memory_order_relaxed);
+
+	//Physically unlink
+	search(key, preds, succs);
+	release(victim);
+	return true;
+}
+
+//Fills preds and succs with the nodes on either side of key at every
+//level, unlinking any marked nodes met on the way.
+//Caller must be pinned.
+template <typename Key_T, typename Mapped_T>
+bool ConcurrentMap<Key_T, Mapped_T>::search(const Key_T &key, Node **preds, Node **succs)
+{
+retry:
+	Node *pred = head, *curr = nullptr;
+	for(int x = CONCURRENT_MAP_MAX_HEIGHT - 1; x >= 0; x--)
+	{
+		curr = unmark(pred -> ptrs()[x].load(std::memory_order_acquire));
+		while(curr != nullptr)
+		{
+			uintptr_t succ = curr -> ptrs()[x].load(std::memory_order_acquire);
+			if(marked(succ))
+			{
+				uintptr_t expected = (uintptr_t)curr;
+				if(!pred -> ptrs()[x].compare_exchange_strong(expected, (uintptr_t)unmark(succ), std::memory_order_acq_rel))
+					goto retry;
+				curr = unmark(succ);
+			}
+			else if(curr -> p.value().first < key)
+			{
+				pred = curr;
+				curr = unmark(succ);
+			}
+			else	break;
+		}
+		preds[x] = pred;
+		succs[x] = curr;
+	}
+	return curr != nullptr && curr -> p.value().first == key;
+}
+
+template <typename Key_T, typename Mapped_T>
+void ConcurrentMap<Key_T, Mapped_T>::release(Node *node)
+{
+	if(node -> owners.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		Epoch_Domain::instance().retire(node, &Node::destroy);
+}
+
+//Each level is taken with probability 1/2, from one random word
+template <typename Key_T, typename Mapped_T>
+int ConcurrentMap<Key_T, Mapped_T>::randomHeight()
+{
+	//xorshift64, one state per thread so there is no shared generator
+	static thread_local uint64_t state = 0;
+	if(state == 0) state = (uint64_t)(uintptr_t)&state * 0x9E3779B97F4A7C15ull | 1;
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	uint64_t bits = state | (1ull << (CONCURRENT_MAP_MAX_HEIGHT - 1));
+	return __builtin_ctzll(bits) + 1;
+}
+
+}
+
+#endif
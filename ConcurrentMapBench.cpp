@@ -0,0 +1,259 @@
+//Benchmarks cs540::ConcurrentMap against a cs540::Map behind one mutex,
+//as the number of threads grows.
+//
+//	g++ -std=c++14 -O2 -pthread ConcurrentMapBench.cpp -o ConcurrentMapBench
+//	./ConcurrentMapBench [size=1e6] [threads=1,2,4,...,cores] [reads=50,90,100]
+//		[ops=2e5] [containers=concurrent,mutex_map] [reps=3] [format=json|csv]
+//
+//Every argument is optional and lists take any subset. Every run starts
+//from a map holding size keys, the even numbers below 2 * size, so half
+//of the key range is present. Each thread then makes ops operations on
+//uniformly drawn keys of that range: reads percent of them are finds,
+//and the rest are inserts and erases in equal parts, so the map stays
+//about the same size. Threads start together and the run ends when the
+//last one is done.
+//
+//One result is printed per line with the median of reps runs in
+//operations per second over all threads, and the speedup over the first
+//thread count listed for the same container and mix.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include "Map.hpp"
+#include "ConcurrentMap.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+//Keeps the optimizer from dropping lookups whose results go unused
+static std::atomic<uint64_t> sink(0);
+
+//xorshift64, cheap enough not to show up next to the map
+struct Rng
+{
+	uint64_t state;
+	explicit Rng(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull | 1) {}
+	uint64_t operator()()
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	}
+};
+
+//The lock-free map as it is
+struct Concurrent
+{
+	cs540::ConcurrentMap<uint64_t, uint64_t> m;
+
+	bool find(uint64_t k, uint64_t &out) {return m.find(k, out);}
+	void insert(uint64_t k, uint64_t v) {m.insert(std::make_pair(k, v));}
+	void erase(uint64_t k) {m.erase(k);}
+};
+
+//The baseline: every operation takes the same lock
+struct MutexMap
+{
+	cs540::Map<uint64_t, uint64_t> m;
+	std::mutex lock;
+
+	bool find(uint64_t k, uint64_t &out)
+	{
+		std::lock_guard<std::mutex> g(lock);
+		cs540::Map<uint64_t, uint64_t>::Iterator it = m.find(k);
+		if(it == m.end()) return false;
+		out = (*it).second;
+		return true;
+	}
+	void insert(uint64_t k, uint64_t v)
+	{
+		std::lock_guard<std::mutex> g(lock);
+		m.insert(std::make_pair(k, v));
+	}
+	void erase(uint64_t k)
+	{
+		std::lock_guard<std::mutex> g(lock);
+		cs540::Map<uint64_t, uint64_t>::Iterator it = m.find(k);
+		if(it != m.end()) m.erase(it);
+	}
+};
+
+//Operations per second of one run
+template <typename M_T>
+static double runOnce(size_t n, int threads, int reads, size_t ops, unsigned int seed)
+{
+	M_T m;
+	for(size_t x = 0; x < n; x++)
+		m.insert(2 * x, x);
+
+	std::atomic<int> ready(0);
+	std::atomic<bool> go(false);
+	std::vector<std::thread> pool;
+	for(int t = 0; t < threads; t++)
+		pool.emplace_back([&, t]()
+		{
+			Rng rng(seed * 1000 + t + 1);
+			uint64_t sum = 0;
+			ready.fetch_add(1);
+			while(!go.load(std::memory_order_acquire)) std::this_thread::yield();
+			for(size_t x = 0; x < ops; x++)
+			{
+				uint64_t r = rng();
+				uint64_t k = (r >> 8) % (2 * n);
+				int roll = (int)(r & 0xFF) * 100 / 256;
+				uint64_t v;
+				if(roll < reads)
+				{
+					if(m.find(k, v)) sum += v;
+				}
+				else if(roll & 1) m.insert(k, x);
+				else m.erase(k);
+			}
+			sink.fetch_add(sum, std::memory_order_relaxed);
+		});
+	while(ready.load() < threads) std::this_thread::yield();
+	Clock::time_point start = Clock::now();
+	go.store(true, std::memory_order_release);
+	for(size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+	double s = std::chrono::duration<double>(Clock::now() - start).count();
+	return threads * ops / s;
+}
+
+struct Options
+{
+	size_t size, ops;
+	std::vector<size_t> threads, reads;
+	std::vector<std::string> containers;
+	int reps;
+	bool csv;
+};
+
+static std::vector<size_t> numbers(const char *list, double lo, double hi)
+{
+	std::vector<size_t> rv;
+	const char *c = list;
+	while(*c != '\0')
+	{
+		char *end;
+		double d = strtod(c, &end);
+		if(end == c || d < lo || d > hi) return std::vector<size_t>();
+		rv.push_back((size_t)d);
+		c = *end == ',' ? end + 1 : end;
+	}
+	return rv;
+}
+
+static std::vector<std::string> split(const char *list)
+{
+	std::vector<std::string> rv;
+	std::string cur;
+	for(const char *c = list; ; c++)
+	{
+		if(*c == ',' || *c == '\0')
+		{
+			if(!cur.empty()) rv.push_back(cur);
+			cur.clear();
+			if(*c == '\0') break;
+		}
+		else cur += *c;
+	}
+	return rv;
+}
+
+template <typename M_T>
+static void runContainer(const Options &opt, const char *container)
+{
+	for(size_t r = 0; r < opt.reads.size(); r++)
+	{
+		double base = 0;
+		for(size_t t = 0; t < opt.threads.size(); t++)
+		{
+			std::vector<double> v;
+			for(int rep = 0; rep < opt.reps; rep++)
+				v.push_back(runOnce<M_T>(opt.size, (int)opt.threads[t], (int)opt.reads[r], opt.ops, 12345 + rep));
+			std::sort(v.begin(), v.end());
+			double median = v[v.size() / 2];
+			if(t == 0) base = median;
+			if(opt.csv)
+				printf("%s,%zu,%zu,%zu,%zu,%d,%.0f,%.0f,%.2f\n", container, opt.size, opt.threads[t], opt.reads[r], opt.ops, opt.reps,
+					median, v.back(), median / base);
+			else
+				printf("{\"container\":\"%s\",\"size\":%zu,\"threads\":%zu,\"read_pct\":%zu,\"ops_per_thread\":%zu,\"reps\":%d,\"ops_per_s\":%.0f,\"ops_per_s_max\":%.0f,\"speedup\":%.2f}\n",
+					container, opt.size, opt.threads[t], opt.reads[r], opt.ops, opt.reps, median, v.back(), median / base);
+			fflush(stdout);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	opt.size = 1000000;
+	opt.ops = 200000;
+	unsigned int cores = std::thread::hardware_concurrency();
+	if(cores == 0) cores = 1;
+	for(size_t t = 1; t < cores; t *= 2)
+		opt.threads.push_back(t);
+	opt.threads.push_back(cores);
+	opt.reads = {50, 90, 100};
+	opt.containers = {"concurrent", "mutex_map"};
+	opt.reps = 3;
+	opt.csv = false;
+
+	for(int a = 1; a < argc; a++)
+	{
+		const char *eq = strchr(argv[a], '=');
+		if(eq == nullptr)
+		{
+			fprintf(stderr, "expected name=value, got %s\n", argv[a]);
+			return 2;
+		}
+		std::string name(argv[a], eq - argv[a]);
+		const char *value = eq + 1;
+		if(name == "size" || name == "ops" || name == "threads" || name == "reads")
+		{
+			std::vector<size_t> list = name == "reads" ? numbers(value, 0, 100) : numbers(value, 1, 1e9);
+			if(list.empty())
+			{
+				fprintf(stderr, "bad %s: %s\n", name.c_str(), value);
+				return 2;
+			}
+			if(name == "size") opt.size = list[0];
+			else if(name == "ops") opt.ops = list[0];
+			else if(name == "threads") opt.threads = list;
+			else opt.reads = list;
+		}
+		else if(name == "containers") opt.containers = split(value);
+		else if(name == "reps") opt.reps = atoi(value) < 1 ? 1 : atoi(value);
+		else if(name == "format") opt.csv = strcmp(value, "csv") == 0;
+		else
+		{
+			fprintf(stderr, "unknown option: %s\n", name.c_str());
+			return 2;
+		}
+	}
+
+	for(size_t c = 0; c < opt.containers.size(); c++)
+		if(opt.containers[c] != "concurrent" && opt.containers[c] != "mutex_map")
+		{
+			fprintf(stderr, "unknown container: %s\n", opt.containers[c].c_str());
+			return 2;
+		}
+
+	if(opt.csv) printf("container,size,threads,read_pct,ops_per_thread,reps,ops_per_s,ops_per_s_max,speedup\n");
+	for(size_t c = 0; c < opt.containers.size(); c++)
+	{
+		if(opt.containers[c] == "concurrent") runContainer<Concurrent>(opt, "cs540::ConcurrentMap");
+		else runContainer<MutexMap>(opt, "cs540::Map+mutex");
+	}
+	return 0;
+}
@@ -0,0 +1,605 @@
+//A Map whose mutations survive restarts: a write-ahead log plus
+//incremental checkpoints.
+
+#ifndef DURABLE_MAP_H
+#define DURABLE_MAP_H
+
+#include <utility>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <errno.h>
+#include <dirent.h>
+#include "Map.hpp"
+
+namespace cs540
+{
+
+//Tuning for DurableMap
+struct DurableMap_Options
+{
+	//Mutations buffered into one log write and one fdatasync. The
+	//	default 1 turns group commit off, so every mutation is on disk
+	//	before it returns. Above 1, a mutation that has returned is lost
+	//	by a crash before its batch fills or commit() is called.
+	size_t groupCommit;
+	//Log records between automatic checkpoints, 0 to checkpoint only
+	//	when checkpoint() is called
+	size_t checkpointEvery;
+	//Incremental checkpoints written before the next one rewrites the
+	//	whole map as a new base
+	size_t maxDeltas;
+	//False skips every fsync, leaving durability to the page cache
+	bool sync;
+
+	DurableMap_Options(size_t group = 1, size_t every = 1 << 20, size_t deltas = 8, bool s = true)
+		: groupCommit(group), checkpointEvery(every), maxDeltas(deltas), sync(s) {}
+};
+
+//Header in front of every batch of records, in the log and in delta
+//files. The payload is count records of recordSize bytes each: an op
+//byte, the key, then the value (left out for erases, still counted),
+//all unaligned. A batch only counts once its checksum matches, so a
+//write torn by a crash is dropped as a whole.
+struct DurableMap_BatchHeader
+{
+	uint32_t magic;
+	uint32_t recordSize;
+	uint64_t count;
+	//FNV-1a over the payload
+	uint64_t checksum;
+};
+
+const uint32_t DURABLE_MAP_MAGIC = 0x4C415743;
+const char DURABLE_MAP_PUT = 'P';
+const char DURABLE_MAP_ERASE = 'E';
+
+//File plumbing shared by every DurableMap. Failures throw
+//std::runtime_error naming the file.
+class DurableMap_Files
+{
+	public:
+		static uint64_t checksum(const char *p, size_t n)
+		{
+			uint64_t h = 0xCBF29CE484222325ull;
+			for(size_t x = 0; x < n; x++)
+				h = (h ^ (unsigned char)p[x]) * 0x100000001B3ull;
+			return h;
+		}
+
+		static void writeAll(int fd, const char *p, size_t n, const std::string &path)
+		{
+			while(n > 0)
+			{
+				ssize_t w = write(fd, p, n);
+				if(w < 0 && errno == EINTR) continue;
+				if(w <= 0) throw std::runtime_error ("cannot write " + path);
+				p += w;
+				n -= w;
+			}
+		}
+
+		//Whole file, empty if it does not exist
+		static std::vector<char> readAll(const std::string &path)
+		{
+			std::vector<char> rv;
+			int fd = open(path.c_str(), O_RDONLY);
+			if(fd < 0)
+			{
+				if(errno == ENOENT) return rv;
+				throw std::runtime_error ("cannot open " + path);
+			}
+			struct stat st;
+			if(fstat(fd, &st) == 0) rv.reserve(st.st_size);
+			char chunk[1 << 16];
+			for(;;)
+			{
+				ssize_t r = read(fd, chunk, sizeof(chunk));
+				if(r < 0 && errno == EINTR) continue;
+				if(r < 0)
+				{
+					close(fd);
+					throw std::runtime_error ("cannot read " + path);
+				}
+				if(r == 0) break;
+				rv.insert(rv.end(), chunk, chunk + r);
+			}
+			close(fd);
+			return rv;
+		}
+
+		static void syncFile(const std::string &path)
+		{
+			int fd = open(path.c_str(), O_RDONLY);
+			if(fd < 0 || fsync(fd) != 0)
+			{
+				if(fd >= 0) close(fd);
+				throw std::runtime_error ("cannot sync " + path);
+			}
+			close(fd);
+		}
+
+		//Makes renames and unlinks in dir durable
+		static void syncDir(const std::string &dir)
+		{
+			int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+			if(fd < 0) throw std::runtime_error ("cannot open " + dir);
+			if(fsync(fd) != 0)
+			{
+				close(fd);
+				throw std::runtime_error ("cannot sync " + dir);
+			}
+			close(fd);
+		}
+
+		static std::vector<std::string> list(const std::string &dir)
+		{
+			std::vector<std::string> rv;
+			DIR *d = opendir(dir.c_str());
+			if(d == nullptr) throw std::runtime_error ("cannot list " + dir);
+			while(struct dirent *e = readdir(d))
+				rv.push_back(e -> d_name);
+			closedir(d);
+			return rv;
+		}
+
+		//Sequence number of a file called prefix followed by digits only
+		static bool seqOf(const std::string &name, const char *prefix, uint64_t &seq)
+		{
+			size_t n = strlen(prefix);
+			if(name.compare(0, n, prefix) != 0 || name.size() == n) return false;
+			seq = 0;
+			for(size_t x = n; x < name.size(); x++)
+			{
+				if(name[x] < '0' || name[x] > '9') return false;
+				seq = seq * 10 + (name[x] - '0');
+			}
+			return true;
+		}
+};
+
+//Wraps a Map and logs every insert, insert_or_assign, operator[] that
+//adds a key, and erase, so the map can be rebuilt after a restart.
+//Only for trivially copyable keys and values, as for Map::save.
+//
+//dir holds three kinds of files:
+//	log		batches of mutations since the last checkpoint
+//	delta.N	a checkpoint of just the keys changed since checkpoint N - 1,
+//			sorted, with erased keys as tombstones
+//	base.N	a full checkpoint in Map::save's format, replacing every
+//			file numbered N or less
+//Each mutation is written and synced before it returns. With
+//groupCommit above 1 mutations are instead buffered and written
+//groupCommit at a time with one write and one fdatasync, and commit()
+//flushes early. There is no time limit on the buffer: until its batch
+//is written, a mutation that has already returned is lost if the
+//process dies, so callers that group commit must call commit() before
+//acknowledging anything that has to survive a crash.
+//
+//A checkpoint writes a delta, or a new base once maxDeltas deltas have
+//piled up or the delta would not be smaller than the map, then empties
+//the log. Checkpoint
+//files are written under a temporary name and renamed into place.
+//
+//Recovery reads the newest base, merges the later deltas over it in
+//order, applies the log's complete batches (last write wins) and loads
+//the result with one Map::assign_sorted, so a restart costs O(n + log)
+//rather than a search per logged record. A torn batch at the end of
+//the log is cut off. Replaying a log a checkpoint already covers gives
+//the same map, so a crash between a checkpoint and the truncation of
+//the log loses nothing.
+//
+//A mutation that reaches the map but whose batch fails to reach the
+//log throws std::runtime_error. The log is cut back to the end of its
+//last complete batch and the batch stays buffered, so the next commit
+//retries it. Should the log not be cut back, a torn batch would hide
+//every later one from recovery, so instead every further mutation
+//throws std::runtime_error until a checkpoint() succeeds.
+template <typename Key_T, typename Mapped_T>
+class DurableMap
+{
+	public:
+		//Recovers whatever dir holds, creating dir if it is missing
+		explicit DurableMap(const std::string &dir, const DurableMap_Options &opt = DurableMap_Options());
+		DurableMap(const DurableMap &) = delete;
+		DurableMap &operator=(const DurableMap &) = delete;
+		//Commits whatever is still buffered
+		~DurableMap();
+
+		//Reads go straight to the map
+		const Map<Key_T, Mapped_T> &map() const {return m;}
+		size_t size() const {return m.size();}
+		bool empty() const {return m.empty();}
+		const Mapped_T &at(const Key_T &key) const {return m.at(key);}
+		//False if key was already there, in which case nothing is logged
+		bool insert(const std::pair<Key_T, Mapped_T> &);
+		void insert_or_assign(const Key_T &, const Mapped_T &);
+		//Adds a default value if key is missing. The reference is const
+		//	since a write through it would bypass the log.
+		const Mapped_T &operator[](const Key_T &);
+		//std::out_of_range if key is missing
+		void erase(const Key_T &);
+		//Writes and syncs the buffered mutations
+		void commit();
+		//Commits, writes a delta or base for everything logged so far,
+		//	then empties the log
+		void checkpoint();
+
+		//Records logged since the last checkpoint, committed or not
+		size_t logRecords() const {return logCount;}
+		//Number of the newest checkpoint file, 0 if none
+		uint64_t checkpointSeq() const {return seq;}
+
+	private:
+		static const size_t RECORD = 1 + sizeof(Key_T) + sizeof(Mapped_T);
+		//A key and its value, or a tombstone. Read straight out of a log
+		//	record, so it is trivially copyable like the two of them.
+		struct Change_T
+		{
+			Key_T first;
+			Mapped_T second;
+			bool put;
+		};
+
+		std::string dir;
+		DurableMap_Options opt;
+		Map<Key_T, Mapped_T> m;
+		int logFd;
+		//Batch being built, header space first
+		std::vector<char> buf;
+		size_t pending;
+		//End of the last complete batch in the log
+		off_t logSize;
+		//Set when a failed commit left a torn batch in the log
+		bool broken;
+		size_t logCount;
+		uint64_t seq;
+		//Deltas written since the newest base
+		size_t deltas;
+		//Keys logged since the last checkpoint, with repeats
+		std::vector<Key_T> changed;
+
+		std::string file(const char *name, uint64_t n) const {return dir + "/" + name + std::to_string(n);}
+		std::string logPath() const {return dir + "/log";}
+		void writable() const;
+		void append(char, const Key_T &, const Mapped_T *);
+		static void encode(std::vector<char> &, char, const Key_T &, const Mapped_T *);
+		static void seal(std::vector<char> &, size_t);
+		static size_t decode(const std::vector<char> &, size_t, std::vector<Change_T> &);
+		static void applyLast(std::vector<Change_T> &);
+		static std::vector<std::pair<Key_T, Mapped_T>> mergeChanges(std::vector<std::pair<Key_T, Mapped_T>> &, const std::vector<Change_T> &);
+		void recover();
+		void publish(const std::string &tmp, const std::string &path);
+		void removeUpTo(uint64_t);
+};
+
+//Constructors
+template <typename Key_T, typename Mapped_T>
+DurableMap<Key_T, Mapped_T>::DurableMap(const std::string &d, const DurableMap_Options &o)
+	: dir(d), opt(o), logFd(-1), pending(0), logSize(0), broken(false), logCount(0), seq(0), deltas(0)
+{
+	static_assert(std::is_trivially_copyable<Key_T>::value && std::is_trivially_copyable<Mapped_T>::value,
+		"DurableMap needs trivially copyable keys and values");
+	if(opt.groupCommit < 1) throw std::invalid_argument ("groupCommit must be at least 1");
+	if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) throw std::runtime_error ("cannot create " + dir);
+	recover();
+	logFd = open(logPath().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if(logFd < 0) throw std::runtime_error ("cannot open " + logPath());
+	//The log may have just been created
+	if(opt.sync) DurableMap_Files::syncDir(dir);
+}
+
+template <typename Key_T, typename Mapped_T>
+DurableMap<Key_T, Mapped_T>::~DurableMap()
+{
+	try
+	{
+		commit();
+	}
+	catch(...) {}
+	close(logFd);
+}
+
+//Records
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::encode(std::vector<char> &out, char op, const Key_T &key, const Mapped_T *value)
+{
+	size_t at = out.size();
+	out.resize(at + RECORD, 0);
+	out[at] = op;
+	memcpy(&out[at + 1], &key, sizeof(Key_T));
+	if(value != nullptr) memcpy(&out[at + 1 + sizeof(Key_T)], value, sizeof(Mapped_T));
+}
+
+//Fills in the header at the front of b for the count records after it
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::seal(std::vector<char> &b, size_t count)
+{
+	DurableMap_BatchHeader h;
+	h.magic = DURABLE_MAP_MAGIC;
+	h.recordSize = RECORD;
+	h.count = count;
+	h.checksum = DurableMap_Files::checksum(b.data() + sizeof(h), b.size() - sizeof(h));
+	memcpy(b.data(), &h, sizeof(h));
+}
+
+//Appends the records of every complete batch in b from offset at on to
+//out, and returns where the last complete batch ends
+template <typename Key_T, typename Mapped_T>
+size_t DurableMap<Key_T, Mapped_T>::decode(const std::vector<char> &b, size_t at, std::vector<Change_T> &out)
+{
+	while(b.size() - at >= sizeof(DurableMap_BatchHeader))
+	{
+		DurableMap_BatchHeader h;
+		memcpy(&h, &b[at], sizeof(h));
+		size_t body = at + sizeof(h);
+		if(h.magic != DURABLE_MAP_MAGIC || h.recordSize != RECORD || h.count > (b.size() - body) / RECORD
+			|| DurableMap_Files::checksum(&b[body], h.count * RECORD) != h.checksum)
+			break;
+		for(size_t x = 0; x < h.count; x++)
+		{
+			const char *r = &b[body + x * RECORD];
+			typename std::aligned_storage<sizeof(Change_T), alignof(Change_T)>::type c;
+			Change_T *ch = (Change_T *)&c;
+			memcpy(&ch -> first, r + 1, sizeof(Key_T));
+			//All zeroes for a tombstone, see encode
+			memcpy(&ch -> second, r + 1 + sizeof(Key_T), sizeof(Mapped_T));
+			ch -> put = r[0] == DURABLE_MAP_PUT;
+			out.push_back(*ch);
+		}
+		at = body + h.count * RECORD;
+	}
+	return at;
+}
+
+//Sorts changes by key, keeping only the last change to each key
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::applyLast(std::vector<Change_T> &changes)
+{
+	std::stable_sort(changes.begin(), changes.end(), [](const Change_T &a, const Change_T &b) {return a.first < b.first;});
+	size_t out = 0;
+	for(size_t x = 0; x < changes.size(); x++)
+	{
+		if(x + 1 < changes.size() && !(changes[x].first < changes[x + 1].first)) continue;
+		changes[out++] = changes[x];
+	}
+	changes.resize(out);
+}
+
+//Linear merge of sorted changes over sorted pairs
+template <typename Key_T, typename Mapped_T>
+std::vector<std::pair<Key_T, Mapped_T>> DurableMap<Key_T, Mapped_T>::mergeChanges(std::vector<std::pair<Key_T, Mapped_T>> &cur, const std::vector<Change_T> &changes)
+{
+	std::vector<std::pair<Key_T, Mapped_T>> rv;
+	rv.reserve(cur.size() + changes.size());
+	size_t i = 0, j = 0;
+	while(i < cur.size() || j < changes.size())
+	{
+		if(j == changes.size() || (i < cur.size() && cur[i].first < changes[j].first))
+		{
+			rv.push_back(cur[i++]);
+			continue;
+		}
+		if(i < cur.size() && !(changes[j].first < cur[i].first)) i++;
+		if(changes[j].put) rv.push_back(std::make_pair(changes[j].first, changes[j].second));
+		j++;
+	}
+	return rv;
+}
+
+//Recovery
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::recover()
+{
+	std::vector<std::string> names = DurableMap_Files::list(dir);
+	uint64_t base = 0;
+	std::vector<uint64_t> found;
+	for(size_t x = 0; x < names.size(); x++)
+	{
+		uint64_t n;
+		if(DurableMap_Files::seqOf(names[x], "base.", n) && n > base) base = n;
+		else if(DurableMap_Files::seqOf(names[x], "delta.", n)) found.push_back(n);
+		else if(names[x].size() > 4 && names[x].compare(names[x].size() - 4, 4, ".tmp") == 0) unlink((dir + "/" + names[x]).c_str());
+	}
+	std::sort(found.begin(), found.end());
+	seq = base;
+
+	std::vector<std::pair<Key_T, Mapped_T>> cur;
+	if(base > 0)
+	{
+		Map_Image<Key_T, Mapped_T> img(file("base.", base).c_str());
+		cur.reserve(img.size());
+		for(auto it = img.begin(); it != img.end(); ++it)
+			cur.push_back(*it);
+	}
+	for(size_t x = 0; x < found.size(); x++)
+	{
+		if(found[x] <= base) continue;
+		std::vector<char> b = DurableMap_Files::readAll(file("delta.", found[x]));
+		std::vector<Change_T> changes;
+		if(decode(b, 0, changes) != b.size()) throw std::runtime_error ("corrupt " + file("delta.", found[x]));
+		cur = mergeChanges(cur, changes);
+		seq = found[x];
+		deltas++;
+	}
+
+	std::vector<char> b = DurableMap_Files::readAll(logPath());
+	std::vector<Change_T> changes;
+	size_t good = decode(b, 0, changes);
+	if(good < b.size() && truncate(logPath().c_str(), good) != 0) throw std::runtime_error ("cannot truncate " + logPath());
+	logSize = good;
+	logCount = changes.size();
+	for(size_t x = 0; x < changes.size(); x++)
+		changed.push_back(changes[x].first);
+	applyLast(changes);
+	cur = mergeChanges(cur, changes);
+
+	m.assign_sorted(cur.begin(), cur.end());
+	removeUpTo(base);
+}
+
+//Deletes every checkpoint file older than base.n
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::removeUpTo(uint64_t n)
+{
+	std::vector<std::string> names = DurableMap_Files::list(dir);
+	for(size_t x = 0; x < names.size(); x++)
+	{
+		uint64_t k;
+		if((DurableMap_Files::seqOf(names[x], "base.", k) && k < n) || (DurableMap_Files::seqOf(names[x], "delta.", k) && k <= n))
+			unlink((dir + "/" + names[x]).c_str());
+	}
+}
+
+//Modifiers
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::writable() const
+{
+	if(broken) throw std::runtime_error ("torn batch in " + logPath() + ", checkpoint() before writing again");
+}
+
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::append(char op, const Key_T &key, const Mapped_T *value)
+{
+	if(pending == 0) buf.assign(sizeof(DurableMap_BatchHeader), 0);
+	encode(buf, op, key, value);
+	pending++;
+	logCount++;
+	changed.push_back(key);
+	if(pending >= opt.groupCommit) commit();
+	if(opt.checkpointEvery > 0 && logCount >= opt.checkpointEvery) checkpoint();
+}
+
+template <typename Key_T, typename Mapped_T>
+bool DurableMap<Key_T, Mapped_T>::insert(const std::pair<Key_T, Mapped_T> &in)
+{
+	writable();
+	if(!m.insert(in).second) return false;
+	append(DURABLE_MAP_PUT, in.first, &in.second);
+	return true;
+}
+
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::insert_or_assign(const Key_T &key, const Mapped_T &obj)
+{
+	writable();
+	m.insert_or_assign(key, obj);
+	append(DURABLE_MAP_PUT, key, &obj);
+}
+
+template <typename Key_T, typename Mapped_T>
+const Mapped_T &DurableMap<Key_T, Mapped_T>::operator[](const Key_T &key)
+{
+	auto it = m.find(key);
+	if(it != m.end()) return it -> second;
+	writable();
+	it = m.insert(std::make_pair(key, Mapped_T())).first;
+	append(DURABLE_MAP_PUT, key, &it -> second);
+	return it -> second;
+}
+
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::erase(const Key_T &key)
+{
+	writable();
+	m.erase(key);
+	append(DURABLE_MAP_ERASE, key, nullptr);
+}
+
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::commit()
+{
+	writable();
+	if(pending == 0) return;
+	seal(buf, pending);
+	try
+	{
+		DurableMap_Files::writeAll(logFd, buf.data(), buf.size(), logPath());
+		if(opt.sync && fdatasync(logFd) != 0) throw std::runtime_error ("cannot sync " + logPath());
+	}
+	catch(...)
+	{
+		//Keep the batch for the next try, and cut off whatever part of
+		//	it was written so later batches follow a complete one
+		if(ftruncate(logFd, logSize) != 0) broken = true;
+		throw;
+	}
+	logSize += buf.size();
+	pending = 0;
+}
+
+//Syncs tmp and renames it to path
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::publish(const std::string &tmp, const std::string &path)
+{
+	if(opt.sync) DurableMap_Files::syncFile(tmp);
+	if(rename(tmp.c_str(), path.c_str()) != 0) throw std::runtime_error ("cannot rename " + tmp);
+	if(opt.sync) DurableMap_Files::syncDir(dir);
+}
+
+template <typename Key_T, typename Mapped_T>
+void DurableMap<Key_T, Mapped_T>::checkpoint()
+{
+	//With a torn log the buffered batch is not written on its own: the
+	//	checkpoint covers it, and emptying the log removes the tear
+	if(broken) pending = 0;
+	else	commit();
+	if(logCount == 0 && !broken) return;
+
+	std::sort(changed.begin(), changed.end());
+	changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+	uint64_t n = seq + 1;
+	if(deltas >= opt.maxDeltas || changed.size() >= m.size())
+	{
+		std::string path = file("base.", n);
+		m.save((path + ".tmp").c_str());
+		publish(path + ".tmp", path);
+		deltas = 0;
+	}
+	else
+	{
+		std::vector<char> b(sizeof(DurableMap_BatchHeader), 0);
+		b.reserve(b.size() + changed.size() * RECORD);
+		typename Map<Key_T, Mapped_T>::ConstIterator end = ((const Map<Key_T, Mapped_T> &)m).end();
+		for(size_t x = 0; x < changed.size(); x++)
+		{
+			typename Map<Key_T, Mapped_T>::ConstIterator it = ((const Map<Key_T, Mapped_T> &)m).find(changed[x]);
+			if(it == end) encode(b, DURABLE_MAP_ERASE, changed[x], nullptr);
+			else	encode(b, DURABLE_MAP_PUT, changed[x], &it -> second);
+		}
+		seal(b, changed.size());
+		std::string path = file("delta.", n);
+		std::string tmp = path + ".tmp";
+		int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0) throw std::runtime_error ("cannot open " + tmp);
+		try
+		{
+			DurableMap_Files::writeAll(fd, b.data(), b.size(), tmp);
+		}
+		catch(...)
+		{
+			close(fd);
+			throw;
+		}
+		close(fd);
+		publish(tmp, path);
+		deltas++;
+	}
+	seq = n;
+
+	if(ftruncate(logFd, 0) != 0) throw std::runtime_error ("cannot truncate " + logPath());
+	logSize = 0;
+	broken = false;
+	logCount = 0;
+	std::vector<Key_T>().swap(changed);
+	if(deltas == 0) removeUpTo(n);
+	//The checkpoint is already durable, so a log whose truncation did
+	//	not reach the disk only replays what it covers
+	if(opt.sync && fdatasync(logFd) != 0) throw std::runtime_error ("cannot sync " + logPath());
+}
+
+}
+
+#endif
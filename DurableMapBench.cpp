@@ -0,0 +1,183 @@
+//Benchmarks cs540::DurableMap: write throughput by group commit size,
+//and recovery time by log length.
+//
+//	g++ -std=c++14 -O2 DurableMapBench.cpp -o DurableMapBench
+//	./DurableMapBench [dir=/tmp] [writes=2e4]
+//		[groups=1,16,256,4096] [logs=1e4,1e5,1e6] [sync=1] [format=json|csv]
+//
+//Every argument is optional. The bench makes a fresh directory inside
+//dir with mkdtemp and keeps its files there, so point dir at the disk
+//you want measured. Only that directory is emptied between runs, and it
+//is removed at the end. One result is printed per line.
+//
+//write makes writes insert_or_assign calls on uint64_t keys drawn
+//uniformly from [0, writes) with automatic checkpoints off, once per
+//group size, and reports nanoseconds and operations per second counting
+//the final commit. groups=1 is group commit off: an fdatasync per write.
+//
+//recover logs each number of records the same way (with sync off, this
+//part is only setup), then times reopening the map, which replays the
+//whole log on top of no checkpoint and bulk loads the result.
+
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include "DurableMap.hpp"
+
+typedef std::chrono::steady_clock Clock;
+typedef cs540::DurableMap<uint64_t, uint64_t> Durable_T;
+
+static double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+//Empties a directory made by makeDir
+static void wipe(const std::string &dir)
+{
+	std::vector<std::string> names;
+	try
+	{
+		names = cs540::DurableMap_Files::list(dir);
+	}
+	catch(std::runtime_error &)
+	{
+		return;
+	}
+	for(size_t x = 0; x < names.size(); x++)
+		if(names[x] != "." && names[x] != "..") unlink((dir + "/" + names[x]).c_str());
+}
+
+//A new empty directory inside parent, or "" if it cannot be made
+static std::string makeDir(const std::string &parent)
+{
+	std::string path = parent + "/durable-map-bench.XXXXXX";
+	std::vector<char> buf(path.begin(), path.end());
+	buf.push_back('\0');
+	if(mkdtemp(&buf[0]) == nullptr) return std::string();
+	return std::string(&buf[0]);
+}
+
+//Writes n records with group commits of the given size, returns seconds
+static double fill(const std::string &dir, size_t n, size_t group, bool sync)
+{
+	std::mt19937_64 rng(12345);
+	Clock::time_point start = Clock::now();
+	Durable_T m(dir, cs540::DurableMap_Options(group, 0, 8, sync));
+	for(size_t x = 0; x < n; x++)
+		m.insert_or_assign(rng() % n, x);
+	m.commit();
+	return secondsSince(start);
+}
+
+struct Options
+{
+	std::string dir;
+	size_t writes;
+	std::vector<size_t> groups, logs;
+	bool sync, csv;
+};
+
+static std::vector<size_t> sizes(const char *list)
+{
+	std::vector<size_t> rv;
+	const char *c = list;
+	while(*c != '\0')
+	{
+		char *end;
+		double d = strtod(c, &end);
+		if(end == c || d < 1 || d > 1e9) return std::vector<size_t>();
+		rv.push_back((size_t)d);
+		c = *end == ',' ? end + 1 : end;
+	}
+	return rv;
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	opt.dir = "/tmp";
+	opt.writes = 20000;
+	opt.groups = {1, 16, 256, 4096};
+	opt.logs = {10000, 100000, 1000000};
+	opt.sync = true;
+	opt.csv = false;
+
+	for(int a = 1; a < argc; a++)
+	{
+		const char *eq = strchr(argv[a], '=');
+		if(eq == nullptr)
+		{
+			fprintf(stderr, "expected name=value, got %s\n", argv[a]);
+			return 2;
+		}
+		std::string name(argv[a], eq - argv[a]);
+		const char *value = eq + 1;
+		if(name == "dir") opt.dir = value;
+		else if(name == "writes" || name == "groups" || name == "logs")
+		{
+			std::vector<size_t> list = sizes(value);
+			if(list.empty())
+			{
+				fprintf(stderr, "bad %s: %s\n", name.c_str(), value);
+				return 2;
+			}
+			if(name == "writes") opt.writes = list[0];
+			else if(name == "groups") opt.groups = list;
+			else opt.logs = list;
+		}
+		else if(name == "sync") opt.sync = atoi(value) != 0;
+		else if(name == "format") opt.csv = strcmp(value, "csv") == 0;
+		else
+		{
+			fprintf(stderr, "unknown option: %s\n", name.c_str());
+			return 2;
+		}
+	}
+
+	std::string dir = makeDir(opt.dir);
+	if(dir.empty())
+	{
+		fprintf(stderr, "cannot make a directory in %s: %s\n", opt.dir.c_str(), strerror(errno));
+		return 2;
+	}
+
+	if(opt.csv) printf("test,group,records,sync,seconds,ns_per_op,ops_per_s\n");
+	for(size_t g = 0; g < opt.groups.size(); g++)
+	{
+		wipe(dir);
+		double s = fill(dir, opt.writes, opt.groups[g], opt.sync);
+		if(opt.csv)
+			printf("write,%zu,%zu,%d,%.6f,%.1f,%.0f\n", opt.groups[g], opt.writes, opt.sync, s, s * 1e9 / opt.writes, opt.writes / s);
+		else
+			printf("{\"test\":\"write\",\"group\":%zu,\"records\":%zu,\"sync\":%d,\"seconds\":%.6f,\"ns_per_op\":%.1f,\"ops_per_s\":%.0f}\n",
+				opt.groups[g], opt.writes, opt.sync, s, s * 1e9 / opt.writes, opt.writes / s);
+		fflush(stdout);
+	}
+	for(size_t l = 0; l < opt.logs.size(); l++)
+	{
+		size_t n = opt.logs[l];
+		wipe(dir);
+		fill(dir, n, 4096, false);
+		Clock::time_point start = Clock::now();
+		size_t keys;
+		{
+			Durable_T m(dir, cs540::DurableMap_Options(64, 0));
+			keys = m.size();
+			double s = secondsSince(start);
+			if(opt.csv)
+				printf("recover,,%zu,,%.6f,%.1f,%.0f\n", n, s, s * 1e9 / n, n / s);
+			else
+				printf("{\"test\":\"recover\",\"records\":%zu,\"keys\":%zu,\"seconds\":%.6f,\"ns_per_record\":%.1f}\n", n, keys, s, s * 1e9 / n);
+		}
+		fflush(stdout);
+	}
+	wipe(dir);
+	rmdir(dir.c_str());
+	return 0;
+}
@@ -0,0 +1,181 @@
+//Benchmarks Map::find_many against a loop of find over the same keys.
+//
+//	g++ -std=c++14 -O2 FindManyBench.cpp -o FindManyBench
+//	./FindManyBench [sizes=1e3,1e5,1e6,1e7] [order=seq,shuffled] [reps=3] [format=json|csv]
+//
+//Every argument is optional and lists take any subset. For each size a
+//Map<uint64_t, uint64_t> gets size keys inserted in key order (seq) or
+//in shuffled order, which scatters neighbouring nodes over the slabs.
+//Then size keys drawn uniformly from those present are looked up, once
+//by find and once by one find_many call. The draws are made before
+//either clock starts.
+//
+//The prefetching only pays once the nodes no longer fit in the last
+//level cache; below that find_many is expected to lose to find. One
+//result is printed per line with the median of reps runs in ns per key.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include "Map.hpp"
+
+typedef std::chrono::steady_clock Clock;
+typedef cs540::Map<uint64_t, uint64_t> Map_T;
+
+//Keeps the optimizer from dropping lookups whose results go unused
+static volatile uint64_t sink;
+
+struct Options
+{
+	std::vector<size_t> sizes;
+	std::vector<std::string> orders;
+	int reps;
+	bool csv;
+};
+
+static double nsPer(Clock::time_point start, size_t n)
+{
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / n;
+}
+
+static double median(std::vector<double> v)
+{
+	std::sort(v.begin(), v.end());
+	return v[v.size() / 2];
+}
+
+static void run(const Options &opt, size_t n, const std::string &order)
+{
+	std::mt19937_64 rng(12345);
+	std::vector<uint64_t> keys(n);
+	for(size_t x = 0; x < n; x++)
+		keys[x] = 2 * (uint64_t)x * 0x10001;
+	std::vector<uint64_t> fill(keys);
+	if(order == "shuffled") std::shuffle(fill.begin(), fill.end(), rng);
+	std::vector<uint64_t> probe(n);
+	std::uniform_int_distribution<size_t> pick(0, n - 1);
+	for(size_t x = 0; x < n; x++)
+		probe[x] = keys[pick(rng)];
+
+	Map_T m;
+	for(size_t x = 0; x < n; x++)
+		m.insert(std::make_pair(fill[x], (uint64_t)x));
+
+	std::vector<double> one, many;
+	std::vector<Map_T::Iterator> found(n, m.end());
+	for(int rep = 0; rep < opt.reps; rep++)
+	{
+		uint64_t sum = 0;
+		Clock::time_point start = Clock::now();
+		for(size_t x = 0; x < n; x++)
+		{
+			Map_T::Iterator it = m.find(probe[x]);
+			if(it != m.end()) sum += (*it).second;
+		}
+		one.push_back(nsPer(start, n));
+
+		start = Clock::now();
+		m.find_many(probe.begin(), probe.end(), found.begin());
+		for(size_t x = 0; x < n; x++)
+			if(found[x] != m.end()) sum -= (*found[x]).second;
+		many.push_back(nsPer(start, n));
+		sink = sink + sum;
+	}
+
+	double f = median(one), fm = median(many);
+	if(opt.csv)
+		printf("%zu,%s,%d,%.1f,%.1f,%.2f\n", n, order.c_str(), opt.reps, f, fm, f / fm);
+	else
+		printf("{\"size\":%zu,\"order\":\"%s\",\"reps\":%d,\"find_ns\":%.1f,\"find_many_ns\":%.1f,\"speedup\":%.2f}\n",
+			n, order.c_str(), opt.reps, f, fm, f / fm);
+	fflush(stdout);
+}
+
+//Comma separated numbers in [lo, hi], empty if any is not
+static std::vector<size_t> numbers(const char *list, double lo, double hi)
+{
+	std::vector<size_t> rv;
+	const char *c = list;
+	while(*c != '\0')
+	{
+		char *end;
+		double d = strtod(c, &end);
+		if(end == c || d < lo || d > hi) return std::vector<size_t>();
+		rv.push_back((size_t)d);
+		c = *end == ',' ? end + 1 : end;
+	}
+	return rv;
+}
+
+static std::vector<std::string> split(const char *list)
+{
+	std::vector<std::string> rv;
+	std::string cur;
+	for(const char *c = list; ; c++)
+	{
+		if(*c == ',' || *c == '\0')
+		{
+			if(!cur.empty()) rv.push_back(cur);
+			cur.clear();
+			if(*c == '\0') break;
+		}
+		else cur += *c;
+	}
+	return rv;
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	opt.sizes = {1000, 100000, 1000000, 10000000};
+	opt.orders = {"seq", "shuffled"};
+	opt.reps = 3;
+	opt.csv = false;
+
+	for(int a = 1; a < argc; a++)
+	{
+		const char *eq = strchr(argv[a], '=');
+		if(eq == nullptr)
+		{
+			fprintf(stderr, "expected name=value, got %s\n", argv[a]);
+			return 2;
+		}
+		std::string name(argv[a], eq - argv[a]);
+		const char *value = eq + 1;
+		if(name == "sizes")
+		{
+			opt.sizes = numbers(value, 1, 1e9);
+			if(opt.sizes.empty())
+			{
+				fprintf(stderr, "bad sizes: %s\n", value);
+				return 2;
+			}
+		}
+		else if(name == "order") opt.orders = split(value);
+		else if(name == "reps") opt.reps = atoi(value) < 1 ? 1 : atoi(value);
+		else if(name == "format") opt.csv = strcmp(value, "csv") == 0;
+		else
+		{
+			fprintf(stderr, "unknown option: %s\n", name.c_str());
+			return 2;
+		}
+	}
+
+	for(size_t o = 0; o < opt.orders.size(); o++)
+		if(opt.orders[o] != "seq" && opt.orders[o] != "shuffled")
+		{
+			fprintf(stderr, "unknown order: %s\n", opt.orders[o].c_str());
+			return 2;
+		}
+
+	if(opt.csv) printf("size,order,reps,find_ns,find_many_ns,speedup\n");
+	for(size_t s = 0; s < opt.sizes.size(); s++)
+		for(size_t o = 0; o < opt.orders.size(); o++)
+			run(opt, opt.sizes[s], opt.orders[o]);
+	return 0;
+}
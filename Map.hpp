@@ -7,6 +7,24 @@
 #include <vector>
 #include <stdexcept>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+#include <type_traits>
+#include <tuple>
+#include <cmath>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <experimental/optional>
 
 namespace cs540
@@ -19,6 +37,716 @@ class ConstIterator;
 template <typename Key_T, typename Mapped_T> 
 class ReverseIterator;
 	
+//Tallest tower any node (including head) can have
+const int MAP_MAX_HEIGHT = 32;
+
+//Memory counters reported by Map::arenaStats()
+struct Map_ArenaStats
+{
+	//Live nodes handed out by the arena
+	size_t nodes;
+	//Slabs obtained from the system
+	size_t slabs;
+	//Bytes held in slabs
+	size_t bytesReserved;
+	//Bytes occupied by live nodes
+	size_t bytesInUse;
+	//Estimated heap footprint of the same nodes if each one allocated
+	//	its own node, pointer vector and index vector
+	size_t bytesVectorLayout;
+	
+	long bytesSaved() const {return (long)bytesVectorLayout - (long)bytesReserved;}
+};
+
+//Search counters are only compiled in with MAP_STATS defined. Without
+//it MAP_STAT(...) expands to nothing and Map has no extra members.
+#ifdef MAP_STATS
+#define MAP_STAT(stmt) stmt
+#else
+#define MAP_STAT(stmt)
+#endif
+
+//Search cost of one kind of operation, see Map_Stats
+struct Map_OpStats
+{
+	uint64_t ops;
+	//Path length: one step per level searched plus one per node passed
+	uint64_t steps;
+	uint64_t maxSteps;
+	//Key comparisons
+	uint64_t compares;
+	uint64_t maxCompares;
+
+	double avgSteps() const {return ops == 0 ? 0 : (double)steps / ops;}
+	double avgCompares() const {return ops == 0 ? 0 : (double)compares / ops;}
+};
+
+//Snapshot of a Map's shape, reported by Map::stats()
+struct Map_Stats
+{
+	size_t length;
+	//Levels in use, i.e. the height head currently searches from
+	unsigned int levels;
+	//Nodes of each tower height, index 0 unused
+	size_t heights[MAP_MAX_HEIGHT + 1];
+	//Chi-squared distance of heights from what the level policy
+	//	should produce, over the heights expected at least 5 times.
+	//	Healthy towers land near heightDegrees; many times that
+	//	means the distribution has degenerated.
+	double heightChiSquare;
+	unsigned int heightDegrees;
+	//Bytes of ptrs() and indexer() over every node, head included
+	size_t ptrBytes;
+	size_t indexerBytes;
+	Map_ArenaStats arena;
+	//False unless built with MAP_STATS, in which case the counters
+	//	cover every operation since construction or resetStats().
+	//	find includes at(), insert includes emplace, try_emplace,
+	//	insert_or_assign, the hinted and node handle inserts and merge,
+	//	erase includes extract, and a range erase or a merge counts as
+	//	one operation.
+	bool searchCounted;
+	Map_OpStats find;
+	Map_OpStats insert;
+	Map_OpStats erase;
+};
+
+//Steps and comparisons made by the calling thread, see Map_StatScope
+struct Map_Probe
+{
+	uint64_t steps;
+	uint64_t compares;
+	int depth;
+};
+
+inline Map_Probe &Map_probe()
+{
+	static thread_local Map_Probe probe = {0, 0, 0};
+	return probe;
+}
+
+//Running totals behind one Map_OpStats. Relaxed atomics, since const
+//lookups on the same map may run on several threads.
+class Map_OpCounters
+{
+	public:
+		Map_OpCounters() : ops(0), steps(0), maxSteps(0), compares(0), maxCompares(0) {}
+
+		void record(uint64_t s, uint64_t c)
+		{
+			ops.fetch_add(1, std::memory_order_relaxed);
+			steps.fetch_add(s, std::memory_order_relaxed);
+			compares.fetch_add(c, std::memory_order_relaxed);
+			raise(maxSteps, s);
+			raise(maxCompares, c);
+		}
+		Map_OpStats read() const
+		{
+			Map_OpStats s;
+			s.ops = ops.load(std::memory_order_relaxed);
+			s.steps = steps.load(std::memory_order_relaxed);
+			s.maxSteps = maxSteps.load(std::memory_order_relaxed);
+			s.compares = compares.load(std::memory_order_relaxed);
+			s.maxCompares = maxCompares.load(std::memory_order_relaxed);
+			return s;
+		}
+		void reset()
+		{
+			ops = 0;
+			steps = 0;
+			maxSteps = 0;
+			compares = 0;
+			maxCompares = 0;
+		}
+
+	private:
+		std::atomic<uint64_t> ops, steps, maxSteps, compares, maxCompares;
+
+		static void raise(std::atomic<uint64_t> &most, uint64_t v)
+		{
+			uint64_t cur = most.load(std::memory_order_relaxed);
+			while(cur < v && !most.compare_exchange_weak(cur, v, std::memory_order_relaxed));
+		}
+};
+
+//Charges the steps and comparisons made while it is alive to one
+//operation. Scopes opened inside another (a find inside an insert)
+//add theirs to the outermost one instead of counting separately.
+class Map_StatScope
+{
+	public:
+		Map_StatScope(Map_OpCounters &c) : counters(c), steps(Map_probe().steps), compares(Map_probe().compares)
+		{
+			Map_probe().depth++;
+		}
+		Map_StatScope(const Map_StatScope &) = delete;
+		Map_StatScope &operator=(const Map_StatScope &) = delete;
+		~Map_StatScope()
+		{
+			Map_Probe &probe = Map_probe();
+			if(--probe.depth == 0)
+				counters.record(probe.steps - steps, probe.compares - compares);
+		}
+
+	private:
+		Map_OpCounters &counters;
+		uint64_t steps;
+		uint64_t compares;
+};
+
+//Slab allocator for skiplist nodes. Nodes of the same height are the
+//same size, so freed nodes go on a per-height free list and are handed
+//back out before more space is carved from the current slab. The free
+//lists are only allocated by the first free. Everything is returned to
+//the system at once by release().
+//
+//Slabs belong to a reference counted pool. share() lets one arena keep
+//another's pools alive, so nodes can move between maps (Map::split_at_rank,
+//Map::join) without being copied; a pool is freed once every arena
+//holding it has released it. The counters of arenas that shared are no
+//longer per map, see mixed().
+class Map_Arena
+{
+	public:
+		Map_Arena() : pool(nullptr), keep(nullptr), adopted(nullptr), cur(nullptr), end(nullptr), nextSlab(0), slabCount(0), reserved(0),
+			liveNodes(0), liveBytes(0), freeList(nullptr), isMixed(false) {}
+		Map_Arena(const Map_Arena &) = delete;
+		Map_Arena &operator=(const Map_Arena &) = delete;
+		~Map_Arena() {release();}
+		
+		void *allocate(size_t bytes, size_t align, int sizeClass);
+		void deallocate(void *mem, size_t bytes, int sizeClass);
+		void release();
+		void swap(Map_Arena &) noexcept;
+		//Keeps every pool a holds alive as long as this arena too, and
+		//	marks both arenas mixed
+		void share(Map_Arena &a);
+		//Nodes may have moved in or out since share(), so the live
+		//	counters only add up over all the arenas involved
+		bool mixed() const {return isMixed;}
+		
+		//A reference on every pool this arena can reach, for a node
+		//	leaving it on its own (see Map::NodeHandle). Only allocates
+		//	when the pools changed since the last call. Marks the arena
+		//	mixed.
+		struct Keep;
+		Keep *hold();
+		//Keeps the pools behind k alive as long as this arena too, for a
+		//	node taken from k's arena. Marks the arena mixed.
+		void adopt(Keep *k);
+		static void drop(Keep *k);
+		//Hands back a block from one of k's pools that no map owns any
+		//	more. Any thread may call it. The next arena holding k to
+		//	run out of blocks of that size class takes it over.
+		static void giveBack(Keep *k, void *mem, int sizeClass);
+		
+		Map_ArenaStats stats() const;
+		
+	private:
+		//The first slab holds this many blocks of the first size asked
+		//	for, and every slab after it twice the one before, up to
+		//	MAX_SLAB
+		static const size_t FIRST_SLAB_BLOCKS = 4;
+		static const size_t MAX_SLAB = 1 << 20;
+		struct Slab {Slab *next;};
+		struct FreeBlock {FreeBlock *next;};
+		struct Pool
+		{
+			std::atomic<size_t> refs;
+			Slab *slabs;
+			
+			Pool() : refs(1), slabs(nullptr) {}
+		};
+		
+		//Where this arena's own slabs go, nullptr until the first one
+		Pool *pool;
+		//Pools of other arenas kept alive by share() and adopt()
+		std::vector<Pool *> shared;
+		//What hold() hands out until the pools change, and the last Keep
+		//	adopt() took pools from; this arena holds a reference on each
+		Keep *keep;
+		Keep *adopted;
+		char *cur;
+		char *end;
+		//0 until the first slab
+		size_t nextSlab;
+		size_t slabCount;
+		size_t reserved;
+		size_t liveNodes;
+		size_t liveBytes;
+		//One list per size class, nullptr until something is freed
+		FreeBlock **freeList;
+		bool isMixed;
+		
+		bool makeFreeList();
+		static void unref(Pool *);
+		void addShared(Pool *);
+		void reclaim(Keep *k);
+		void dropKeep();
+};
+
+struct Map_Arena::Keep
+{
+	std::atomic<size_t> refs;
+	std::vector<Pool *> pools;
+	//Blocks given back per size class, and whether there are any
+	std::atomic<FreeBlock *> returned[MAP_MAX_HEIGHT + 1];
+	std::atomic<bool> anyReturned;
+	
+	Keep() : refs(1), anyReturned(false)
+	{
+		for(int x = 0; x <= MAP_MAX_HEIGHT; x++)
+			returned[x].store(nullptr, std::memory_order_relaxed);
+	}
+};
+
+inline void *Map_Arena::allocate(size_t bytes, size_t align, int sizeClass)
+{
+	liveNodes++;
+	liveBytes += bytes;
+	if(freeList == nullptr || freeList[sizeClass] == nullptr)
+	{
+		reclaim(keep);
+		reclaim(adopted);
+	}
+	if(freeList != nullptr && freeList[sizeClass] != nullptr)
+	{
+		FreeBlock *block = freeList[sizeClass];
+		freeList[sizeClass] = block -> next;
+		return block;
+	}
+	
+	uintptr_t at = ((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1);
+	if(cur == nullptr || at + bytes > (uintptr_t)end)
+	{
+		size_t size = nextSlab != 0 ? nextSlab : sizeof(Slab) + FIRST_SLAB_BLOCKS * (bytes + align);
+		if(size < sizeof(Slab) + bytes + align) size = sizeof(Slab) + bytes + align;
+		if(pool == nullptr)
+		{
+			pool = new Pool();
+			dropKeep();
+		}
+		Slab *slab = (Slab *)::operator new(size);
+		slab -> next = pool -> slabs;
+		pool -> slabs = slab;
+		cur = (char *)(slab + 1);
+		end = (char *)slab + size;
+		slabCount++;
+		reserved += size;
+		nextSlab = size < MAX_SLAB / 2 ? size * 2 : MAX_SLAB;
+		at = ((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1);
+	}
+	cur = (char *)(at + bytes);
+	return (void *)at;
+}
+
+//Without free lists the block just sits unused until release()
+inline void Map_Arena::deallocate(void *mem, size_t bytes, int sizeClass)
+{
+	liveNodes--;
+	liveBytes -= bytes;
+	if(freeList == nullptr && !makeFreeList()) return;
+	FreeBlock *block = (FreeBlock *)mem;
+	block -> next = freeList[sizeClass];
+	freeList[sizeClass] = block;
+}
+
+//Never throws, so that freeing a node cannot fail
+inline bool Map_Arena::makeFreeList()
+{
+	freeList = new(std::nothrow) FreeBlock *[MAP_MAX_HEIGHT + 1]();
+	return freeList != nullptr;
+}
+
+inline void Map_Arena::unref(Pool *p)
+{
+	if(p -> refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+	while(p -> slabs != nullptr)
+	{
+		Slab *del = p -> slabs;
+		p -> slabs = p -> slabs -> next;
+		::operator delete(del);
+	}
+	delete p;
+}
+
+inline void Map_Arena::release()
+{
+	drop(keep);
+	drop(adopted);
+	keep = adopted = nullptr;
+	if(pool != nullptr) unref(pool);
+	pool = nullptr;
+	for(size_t x = 0; x < shared.size(); x++)
+		unref(shared[x]);
+	shared.clear();
+	isMixed = false;
+	cur = end = nullptr;
+	nextSlab = 0;
+	slabCount = 0;
+	reserved = 0;
+	liveNodes = 0;
+	liveBytes = 0;
+	delete[] freeList;
+	freeList = nullptr;
+}
+
+inline void Map_Arena::swap(Map_Arena &a) noexcept
+{
+	std::swap(pool, a.pool);
+	shared.swap(a.shared);
+	std::swap(keep, a.keep);
+	std::swap(adopted, a.adopted);
+	std::swap(isMixed, a.isMixed);
+	std::swap(cur, a.cur);
+	std::swap(end, a.end);
+	std::swap(nextSlab, a.nextSlab);
+	std::swap(slabCount, a.slabCount);
+	std::swap(reserved, a.reserved);
+	std::swap(liveNodes, a.liveNodes);
+	std::swap(liveBytes, a.liveBytes);
+	std::swap(freeList, a.freeList);
+}
+
+inline void Map_Arena::addShared(Pool *p)
+{
+	if(p == pool || std::find(shared.begin(), shared.end(), p) != shared.end()) return;
+	p -> refs.fetch_add(1, std::memory_order_relaxed);
+	shared.push_back(p);
+	dropKeep();
+}
+
+inline void Map_Arena::share(Map_Arena &a)
+{
+	isMixed = a.isMixed = true;
+	std::vector<Pool *> add(a.shared);
+	if(a.pool != nullptr) add.push_back(a.pool);
+	for(size_t x = 0; x < add.size(); x++)
+		addShared(add[x]);
+}
+
+inline Map_Arena::Keep *Map_Arena::hold()
+{
+	isMixed = true;
+	if(keep == nullptr)
+	{
+		keep = new Keep();
+		keep -> pools = shared;
+		if(pool != nullptr) keep -> pools.push_back(pool);
+		for(size_t x = 0; x < keep -> pools.size(); x++)
+			keep -> pools[x] -> refs.fetch_add(1, std::memory_order_relaxed);
+	}
+	keep -> refs.fetch_add(1, std::memory_order_relaxed);
+	return keep;
+}
+
+inline void Map_Arena::adopt(Keep *k)
+{
+	isMixed = true;
+	//Nodes from one extract spree mostly share a Keep, so remembering
+	//	the last one saves looking through shared every time
+	if(k == adopted) return;
+	for(size_t x = 0; x < k -> pools.size(); x++)
+		addShared(k -> pools[x]);
+	k -> refs.fetch_add(1, std::memory_order_relaxed);
+	reclaim(adopted);
+	drop(adopted);
+	adopted = k;
+}
+
+inline void Map_Arena::drop(Keep *k)
+{
+	if(k == nullptr || k -> refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+	for(size_t x = 0; x < k -> pools.size(); x++)
+		unref(k -> pools[x]);
+	delete k;
+}
+
+//The keep hold() hands out is about to change, so take over what was
+//given back to the old one first
+inline void Map_Arena::dropKeep()
+{
+	reclaim(keep);
+	drop(keep);
+	keep = nullptr;
+}
+
+//Pushes are lock free, and taking a whole list at once cannot suffer
+//from ABA, so handles may give blocks back from any thread
+inline void Map_Arena::giveBack(Keep *k, void *mem, int sizeClass)
+{
+	FreeBlock *block = (FreeBlock *)mem;
+	block -> next = k -> returned[sizeClass].load(std::memory_order_relaxed);
+	while(!k -> returned[sizeClass].compare_exchange_weak(block -> next, block, std::memory_order_release, std::memory_order_relaxed));
+	k -> anyReturned.store(true, std::memory_order_release);
+}
+
+//Moves every block given back to k onto our free lists. We hold a
+//reference on each of k's pools, so the blocks stay good. If the lists
+//cannot be allocated the blocks wait in k for the next try.
+inline void Map_Arena::reclaim(Keep *k)
+{
+	if(k == nullptr || !k -> anyReturned.load(std::memory_order_relaxed)) return;
+	if(freeList == nullptr && !makeFreeList()) return;
+	if(!k -> anyReturned.exchange(false, std::memory_order_acquire)) return;
+	for(int x = 0; x <= MAP_MAX_HEIGHT; x++)
+	{
+		FreeBlock *block = k -> returned[x].exchange(nullptr, std::memory_order_acquire);
+		while(block != nullptr)
+		{
+			FreeBlock *next = block -> next;
+			block -> next = freeList[x];
+			freeList[x] = block;
+			block = next;
+		}
+	}
+}
+
+inline Map_ArenaStats Map_Arena::stats() const
+{
+	Map_ArenaStats s;
+	s.nodes = liveNodes;
+	s.bytesInUse = liveBytes;
+	s.slabs = slabCount;
+	s.bytesReserved = reserved;
+	s.bytesVectorLayout = 0;
+	return s;
+}
+
+//Tower height settings for a Map
+struct Map_LevelPolicy
+{
+	//Chance that a node also reaches the next level up, e.g. 1/2, 1/4
+	//	or 1/e. Lower means shorter towers but longer searches.
+	double p;
+	//Tallest tower a node may get, at most MAP_MAX_HEIGHT
+	unsigned int maxHeight;
+	//The same seed always gives the same towers
+	uint64_t seed;
+	
+	Map_LevelPolicy(double prob = 0.5, unsigned int cap = MAP_MAX_HEIGHT, uint64_t s = 0x9E3779B97F4A7C15ull)
+		: p(prob), maxHeight(cap), seed(s) {}
+};
+
+//Per map tower height generator. Each height costs one random word:
+//for p = 1/2^k it is the trailing zero count divided by k, otherwise
+//it is read off the logarithm of the word.
+class Map_LevelGen
+{
+	public:
+		Map_LevelGen(const Map_LevelPolicy &lp = Map_LevelPolicy()) : pol(lp), state(lp.seed), bits(0), invLogP(0)
+		{
+			if(!(lp.p > 0 && lp.p < 1)) throw std::invalid_argument ("level probability must be in (0, 1)");
+			if(lp.maxHeight < 1 || lp.maxHeight > (unsigned int)MAP_MAX_HEIGHT) throw std::invalid_argument ("bad maximum height");
+			int e;
+			if(std::frexp(lp.p, &e) == 0.5) bits = 1 - e;
+			else	invLogP = 1 / std::log(lp.p);
+		}
+		
+		//Random height, at most cap
+		unsigned int next(unsigned int cap)
+		{
+			if(cap > pol.maxHeight) cap = pol.maxHeight;
+			uint64_t r = nextWord();
+			unsigned int h;
+			if(bits > 0)
+				h = 1 + (r == 0 ? 64 : __builtin_ctzll(r)) / bits;
+			else
+			{
+				//Uniform in (0, 1]
+				double u = ((r >> 11) + 1) * (1.0 / 9007199254740992.0);
+				h = 1 + (unsigned int)(std::log(u) * invLogP);
+			}
+			return h > cap ? cap : h;
+		}
+		
+		//Height for the element at a 1 based rank that spaces the towers
+		//	evenly, as if every coin had come up exactly as likely
+		unsigned int balanced(size_t rank) const
+		{
+			unsigned int h = 1;
+			size_t step = bits > 0 ? (size_t)1 << bits : (size_t)std::lround(1 / pol.p);
+			while(rank % step == 0 && h < pol.maxHeight)
+			{
+				rank /= step;
+				h++;
+			}
+			return h;
+		}
+		
+		const Map_LevelPolicy &policy() const {return pol;}
+		
+	private:
+		Map_LevelPolicy pol;
+		uint64_t state;
+		//log2(1/p) when p is a power of two, otherwise 0
+		int bits;
+		double invLogP;
+		
+		//splitmix64
+		uint64_t nextWord()
+		{
+			uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		}
+};
+
+//Layout of a file written by Map::save(). The header is followed by
+//count keys starting at keysOffset and count mapped values starting at
+//mappedOffset, both arrays in key order and 64 byte aligned.
+struct Map_FileHeader
+{
+	char magic[8];
+	uint32_t version;
+	//Written as 1, reads back differently on the other byte order
+	uint32_t byteOrder;
+	uint32_t keySize;
+	uint32_t mappedSize;
+	uint64_t count;
+	uint64_t keysOffset;
+	uint64_t mappedOffset;
+};
+
+const char MAP_FILE_MAGIC[8] = {'C', 'S', '5', '4', '0', 'M', 'A', 'P'};
+const uint32_t MAP_FILE_VERSION = 1;
+
+//Read only view of a file written by Map::save(), memory mapped so
+//opening it costs nothing per element. Lookups binary search the key
+//array in place.
+template <typename Key_T, typename Mapped_T>
+class Map_Image
+{
+	public:
+		explicit Map_Image(const char *path);
+		Map_Image(const Map_Image &) = delete;
+		Map_Image &operator=(const Map_Image &) = delete;
+		~Map_Image();
+		
+		size_t size() const {return count;}
+		bool empty() const {return count == 0;}
+		const Key_T &key(size_t index) const {return keys[index];}
+		const Mapped_T &get(int) const;
+		const Mapped_T &at(const Key_T &) const;
+		//nullptr if key is missing
+		const Mapped_T *find(const Key_T &) const;
+		//Number of keys less than key
+		size_t rank(const Key_T &) const;
+		
+		//Yields the pairs in order, for building a Map
+		class PairIterator
+		{
+			public:
+				PairIterator(const Map_Image *i, size_t x) : img(i), index(x) {}
+				std::pair<Key_T, Mapped_T> operator*() const {return std::make_pair(img -> keys[index], img -> mapped[index]);}
+				PairIterator &operator++()
+				{
+					index++;
+					return *this;
+				}
+				bool operator==(const PairIterator &it) const {return index == it.index;}
+				bool operator!=(const PairIterator &it) const {return index != it.index;}
+			private:
+				const Map_Image *img;
+				size_t index;
+		};
+		PairIterator begin() const {return PairIterator(this, 0);}
+		PairIterator end() const {return PairIterator(this, count);}
+		
+	private:
+		void *base;
+		size_t bytes;
+		size_t count;
+		const Key_T *keys;
+		const Mapped_T *mapped;
+};
+
+template <typename Key_T, typename Mapped_T>
+Map_Image<Key_T, Mapped_T>::Map_Image(const char *path) : base(nullptr), bytes(0), count(0), keys(nullptr), mapped(nullptr)
+{
+	static_assert(std::is_trivially_copyable<Key_T>::value && std::is_trivially_copyable<Mapped_T>::value,
+		"Map images need trivially copyable keys and values");
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) throw std::runtime_error (std::string("cannot open ") + path);
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Map_FileHeader))
+	{
+		close(fd);
+		throw std::runtime_error (std::string("not a map file: ") + path);
+	}
+	bytes = st.st_size;
+	base = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED)
+	{
+		base = nullptr;
+		throw std::runtime_error (std::string("cannot map ") + path);
+	}
+	
+	const Map_FileHeader *h = (const Map_FileHeader *)base;
+	if(memcmp(h -> magic, MAP_FILE_MAGIC, 8) != 0 || h -> version != MAP_FILE_VERSION || h -> byteOrder != 1
+		|| h -> keySize != sizeof(Key_T) || h -> mappedSize != sizeof(Mapped_T)
+		|| h -> keysOffset % alignof(Key_T) != 0 || h -> mappedOffset % alignof(Mapped_T) != 0
+		//Checked by division so a hostile count or offset cannot wrap around
+		|| h -> keysOffset > bytes || h -> count > (bytes - h -> keysOffset) / sizeof(Key_T)
+		|| h -> mappedOffset > bytes || h -> count > (bytes - h -> mappedOffset) / sizeof(Mapped_T))
+	{
+		munmap(base, bytes);
+		base = nullptr;
+		throw std::runtime_error (std::string("not a map file for these types: ") + path);
+	}
+	count = h -> count;
+	keys = (const Key_T *)((const char *)base + h -> keysOffset);
+	mapped = (const Mapped_T *)((const char *)base + h -> mappedOffset);
+	madvise(base, bytes, MADV_SEQUENTIAL);
+}
+
+template <typename Key_T, typename Mapped_T>
+Map_Image<Key_T, Mapped_T>::~Map_Image()
+{
+	if(base != nullptr) munmap(base, bytes);
+}
+
+template <typename Key_T, typename Mapped_T>
+const Mapped_T &Map_Image<Key_T, Mapped_T>::get(int index) const
+{
+	if(index < 0 || (size_t)index >= count) throw std::out_of_range ("");
+	return mapped[index];
+}
+
+template <typename Key_T, typename Mapped_T>
+const Mapped_T &Map_Image<Key_T, Mapped_T>::at(const Key_T &key) const
+{
+	const Mapped_T *m = find(key);
+	if(m == nullptr) throw std::out_of_range ("");
+	return *m;
+}
+
+template <typename Key_T, typename Mapped_T>
+const Mapped_T *Map_Image<Key_T, Mapped_T>::find(const Key_T &key) const
+{
+	size_t x = rank(key);
+	if(x < count && keys[x] == key) return &mapped[x];
+	return nullptr;
+}
+
+template <typename Key_T, typename Mapped_T>
+size_t Map_Image<Key_T, Mapped_T>::rank(const Key_T &key) const
+{
+	size_t lo = 0, hi = count;
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if(keys[mid] < key) lo = mid + 1;
+		else	hi = mid;
+	}
+	return lo;
+}
+
+template <typename Key_T, typename Mapped_T>
+struct Map_History;
+
 template <typename Key_T, typename Mapped_T> 
 class Map_Node
 {
@@ -28,76 +756,526 @@ class Map_Node
 		//are constructed.
 		std::experimental::optional<std::pair<Key_T, Mapped_T>> p;
 		Map_Node *next;
-		Map_Node *prev;		
-		//Holds the next node in the "levels" of list
-		std::vector<Map_Node *> ptrs;
-		//Holds the distance to the next node per "level"
-		std::vector<int> indexer;
+		Map_Node *prev;
+		//Number of levels in this node. The tower itself is stored
+		//	inline after the node: height next-node pointers per
+		//	"level" followed by height distances to those nodes.
+		int height;
+		//This node's records in Map_Versions, nullptr if it has none.
+		//	Snapshot readers load it while the map is being written.
+		std::atomic<Map_History<Key_T, Mapped_T> *> hist;
 		
 		Map_Node() : Map_Node(1) {}
-		Map_Node(int h) 
+		Map_Node(int h) : height(h)
 		{
-			ptrs = std::vector<Map_Node *>(h); 
-			indexer = std::vector<int>(h); 
-			for(int x = 0; x < h; x++) indexer[x] = 1;
-			next = nullptr; 
-			prev = nullptr;
+			initTower();
 		}
 		Map_Node(const std::pair<Key_T, Mapped_T> &pair) : Map_Node(pair, 1) {} 
-		Map_Node(const std::pair<Key_T, Mapped_T> &pair, int h) : p(pair) 
+		Map_Node(const std::pair<Key_T, Mapped_T> &pair, int h) : p(pair), height(h)
+		{
+			initTower();
+		}
+		//Builds the pair in place from args
+		template <typename... Args>
+		Map_Node(int h, std::experimental::in_place_t, Args&&... args) : p(std::experimental::in_place, std::forward<Args>(args)...), height(h)
+		{
+			initTower();
+		}
+		Map_Node(const Map_Node &) = delete;
+		Map_Node &operator=(const Map_Node &) = delete;
+		
+		//Holds the next node in the "levels" of list
+		Map_Node **ptrs() {return (Map_Node **)(this + 1);}
+		Map_Node * const *ptrs() const {return (Map_Node * const *)(this + 1);}
+		//Holds the distance to the next node per "level"
+		int *indexer() {return (int *)(ptrs() + height);}
+		const int *indexer() const {return (const int *)(ptrs() + height);}
+		size_t getHeight() const {return height;}
+		
+		//Bytes needed for a node and its tower
+		static size_t bytes(int h) {return sizeof(Map_Node) + h * (sizeof(Map_Node *) + sizeof(int));}
+		
+	private:
+		void initTower()
 		{
-			ptrs = std::vector<Map_Node *>(h); 
-			indexer = std::vector<int>(h); 
-			for(int x = 0; x < h; x++) indexer[x] = 1;
 			next = nullptr; 
 			prev = nullptr;
+			hist.store(nullptr, std::memory_order_relaxed);
+			for(int x = 0; x < height; x++)
+			{
+				ptrs()[x] = nullptr;
+				indexer()[x] = 1;
+			}
 		}
-		size_t getHeight() {return ptrs.size();}
 };
 
-template <typename Key_T, typename Mapped_T> 
-class Map
+//Records what one node had before it was overwritten, see Map_Versions.
+//Both lists are newest first and a record never changes once it is on
+//one, except that the writer may cut off its older records. A reader
+//only follows older while olderStamp is after its own version, which
+//keeps it off everything that can be cut.
+template <typename Key_T, typename Mapped_T>
+struct Map_History
 {
-	public:
-	
-	class Iterator
+	//One tower level as it was before version stamp
+	struct Level
 	{
-		public:
-			friend class Map;
-			Iterator() = delete;
-			Iterator &operator++()
-			{
-				ptr = ptr -> next;
-				return *this;
-			}
-			Iterator operator++(int)
-			{
-				Iterator rv(*this);
-				ptr = ptr -> next;
-				return rv;
-			}
-			Iterator &operator--()
-			{
-				ptr = ptr -> prev;
-				return *this;
-			}
-			Iterator operator--(int)
-			{
-				Iterator rv(*this);
-				ptr = ptr -> prev;
-				return rv;
-			}
-			std::pair<Key_T, Mapped_T> &operator*() const{return ptr -> p.value();}
-			std::pair<Key_T, Mapped_T> *operator->() const{return &(ptr -> p.value());}
-			
-			//Equality
-			//ConstIterator comparisons are declared as free functions
-			bool operator==(const Iterator &it) const{return ptr == it.ptr;}
-			bool operator!=(const Iterator &it) const{return ptr != it.ptr;}
+		uint64_t stamp;
+		int x;
+		Map_Node<Key_T, Mapped_T> *next;
+		int span;
+		std::atomic<Level *> older;
+		uint64_t olderStamp;
 		
-		private:
-			Iterator(Map_Node<Key_T, Mapped_T> *p) : ptr(p) {};
+		Level(uint64_t s, int lx, Map_Node<Key_T, Mapped_T> *n, int sp, Level *o)
+			: stamp(s), x(lx), next(n), span(sp), older(o), olderStamp(o == nullptr ? 0 : o -> stamp) {}
+	};
+	//The mapped value as it was before version stamp
+	struct Value
+	{
+		uint64_t stamp;
+		Mapped_T value;
+		std::atomic<Value *> older;
+		uint64_t olderStamp;
+		
+		Value(uint64_t s, const Mapped_T &val, Value *o)
+			: stamp(s), value(val), older(o), olderStamp(o == nullptr ? 0 : o -> stamp) {}
+	};
+	
+	std::atomic<Level *> levels;
+	std::atomic<Value *> values;
+	Map_Node<Key_T, Mapped_T> *owner;
+	//Index in Map_Versions::histories
+	size_t slot;
+	
+	Map_History(Map_Node<Key_T, Mapped_T> *n, size_t sl) : levels(nullptr), values(nullptr), owner(n), slot(sl) {}
+	Map_History(const Map_History &) = delete;
+	Map_History &operator=(const Map_History &) = delete;
+	~Map_History()
+	{
+		freeAfter(levels.load(std::memory_order_relaxed));
+		delete levels.load(std::memory_order_relaxed);
+		freeAfter(values.load(std::memory_order_relaxed));
+		delete values.load(std::memory_order_relaxed);
+	}
+	
+	//Deletes every record older than r and cuts them off
+	template <typename R_T>
+	static void freeAfter(R_T *r)
+	{
+		if(r == nullptr) return;
+		R_T *del = r -> older.load(std::memory_order_relaxed);
+		r -> older.store(nullptr, std::memory_order_release);
+		while(del != nullptr)
+		{
+			R_T *o = del -> older.load(std::memory_order_relaxed);
+			delete del;
+			del = o;
+		}
+	}
+	
+	//Drops the records no reader of a version from min on can reach:
+	//	everything past the first one whose older is not after min
+	template <typename R_T>
+	static void prune(R_T *r, uint64_t min)
+	{
+		while(r != nullptr && r -> olderStamp > min)
+			r = r -> older.load(std::memory_order_relaxed);
+		freeAfter(r);
+	}
+};
+
+//Copies of live values being taken by snapshot readers are counted in
+//one of these, picked by node
+const int MAP_READ_STRIPES = 16;
+
+//Bookkeeping behind Map::snapshot(). Each snapshot sees one version of
+//the map; taking a snapshot starts the next one. While any snapshot is
+//open, the first write in a version to a node's tower level or mapped
+//value saves what was there in a record stamped with that version. A
+//snapshot of version v reads a slot from the oldest record stamped after
+//v, or from the node itself if there is none. Unlinked nodes are parked
+//in retired until no open snapshot can still reach them.
+//
+//Snapshots are read on other threads while the map is written, so
+//records are published with a release store of their list's head, and
+//tower slots are stored with release and loaded with acquire while
+//snapshots are open. A reader loads the slot before looking for a
+//record, so whenever it sees a new slot it also sees the record of the
+//old one. Mapped values are written in place through references the
+//map hands out, which no record can cover. So a reader copies a live
+//value only while counted in readers, and after publishing a value
+//record the writer waits for that count to drain before handing the
+//value out. Everything else here is the writer's, apart from refs, live
+//and dirty, which closing a snapshot changes under lock.
+//
+//The map keeps its arena and finger here as well, so they go wherever
+//its elements do and a Map that has none allocates nothing.
+template <typename Key_T, typename Mapped_T>
+class Map_Versions
+{
+	public:
+		typedef Map_History<Key_T, Mapped_T> History;
+		
+		//Version writes are currently stamped with
+		uint64_t version;
+		std::mutex lock;
+		//The map plus every open snapshot
+		size_t refs;
+		//Open snapshots per version
+		std::map<uint64_t, size_t> live;
+		//A snapshot was dropped since the last collect
+		std::atomic<bool> dirty;
+		//Number of open snapshots, read without the lock
+		std::atomic<size_t> openCount;
+		//Every node with records
+		std::vector<History *> histories;
+		//Unlinked nodes and the version that unlinked them
+		std::vector<std::pair<uint64_t, Map_Node<Key_T, Mapped_T> *>> retired;
+		//Set when the map was destroyed or assigned to with snapshots
+		//	still open: its list, which we destroy last
+		Map_Node<Key_T, Mapped_T> *orphanHead;
+		Map_Node<Key_T, Mapped_T> *orphanTail;
+		//Every node other than head and tail lives here
+		Map_Arena arena;
+		//Search path of the last insert or erase: on every level the
+		//	last node at or before the key it touched
+		Map_Node<Key_T, Mapped_T> *finger[MAP_MAX_HEIGHT];
+		
+		Map_Versions() : version(1), refs(1), dirty(false), openCount(0), orphanHead(nullptr), orphanTail(nullptr), readers(nullptr) {}
+		Map_Versions(const Map_Versions &) = delete;
+		Map_Versions &operator=(const Map_Versions &) = delete;
+		~Map_Versions();
+		
+		bool active() const {return openCount.load(std::memory_order_acquire) != 0;}
+		//Snapshot bookkeeping. open() returns the new snapshot's version.
+		//	hold() and drop() may be called on any thread.
+		uint64_t open();
+		void hold(uint64_t);
+		void drop(uint64_t);
+		void unref();
+		
+		//Save a slot before it is overwritten. recordLevel is only
+		//	needed while active(); recordValue checks for itself.
+		void recordLevel(Map_Node<Key_T, Mapped_T> *, int);
+		void recordValue(Map_Node<Key_T, Mapped_T> *node)
+		{
+			if(active()) saveValue(node, std::is_copy_constructible<Mapped_T>());
+		}
+		//A slot as seen by the snapshot of version v. Safe to call while
+		//	the map is being written.
+		Map_Node<Key_T, Mapped_T> *readPtr(const Map_Node<Key_T, Mapped_T> *, int, uint64_t) const;
+		int readIndex(const Map_Node<Key_T, Mapped_T> *, int, uint64_t) const;
+		Mapped_T readValue(const Map_Node<Key_T, Mapped_T> *, uint64_t) const;
+		
+		//Drops records no snapshot of version min or later can read
+		void prune(uint64_t min);
+		void freeHistory(Map_Node<Key_T, Mapped_T> *);
+		//Forgets every history, leaving retired alone. Only while no
+		//	snapshot is open.
+		void reset();
+		//Oldest version an open snapshot sees, or UINT64_MAX if none
+		uint64_t oldest();
+		
+	private:
+		//Padded to a cache line so stripes don't share one
+		struct Readers
+		{
+			std::atomic<unsigned int> n;
+			char pad[64 - sizeof(std::atomic<unsigned int>)];
+			
+			Readers() : n(0) {}
+		};
+		//MAP_READ_STRIPES of them, allocated by the first open()
+		Readers *readers;
+		
+		History *historyOf(Map_Node<Key_T, Mapped_T> *);
+		const typename History::Level *levelFor(const Map_Node<Key_T, Mapped_T> *, int, uint64_t) const;
+		const typename History::Value *valueFor(const Map_Node<Key_T, Mapped_T> *, uint64_t) const;
+		Readers &readersOf(const Map_Node<Key_T, Mapped_T> *node) const {return readers[((uintptr_t)node >> 6) % MAP_READ_STRIPES];}
+		void saveValue(Map_Node<Key_T, Mapped_T> *, std::true_type);
+		//Snapshots are refused for these, so there is never anything to save
+		void saveValue(Map_Node<Key_T, Mapped_T> *, std::false_type) {}
+};
+
+template <typename Key_T, typename Mapped_T>
+Map_Versions<Key_T, Mapped_T>::~Map_Versions()
+{
+	reset();
+	delete[] readers;
+	if(orphanHead == nullptr) return;
+	for(Map_Node<Key_T, Mapped_T> *node = orphanHead -> next; node != orphanTail; )
+	{
+		Map_Node<Key_T, Mapped_T> *del = node;
+		node = node -> next;
+		del -> ~Map_Node<Key_T, Mapped_T>();
+	}
+	for(size_t x = 0; x < retired.size(); x++)
+		retired[x].second -> ~Map_Node<Key_T, Mapped_T>();
+	orphanHead -> ~Map_Node<Key_T, Mapped_T>();
+	orphanTail -> ~Map_Node<Key_T, Mapped_T>();
+	::operator delete(orphanHead);
+	::operator delete(orphanTail);
+}
+
+template <typename Key_T, typename Mapped_T>
+uint64_t Map_Versions<Key_T, Mapped_T>::open()
+{
+	std::lock_guard<std::mutex> g(lock);
+	if(readers == nullptr) readers = new Readers[MAP_READ_STRIPES];
+	uint64_t v = version++;
+	live[v]++;
+	refs++;
+	openCount.fetch_add(1, std::memory_order_relaxed);
+	return v;
+}
+
+template <typename Key_T, typename Mapped_T>
+void Map_Versions<Key_T, Mapped_T>::hold(uint64_t v)
+{
+	std::lock_guard<std::mutex> g(lock);
+	live[v]++;
+	refs++;
+	openCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+//Everything the snapshot read happens before the writer sees it gone
+template <typename Key_T, typename Mapped_T>
+void Map_Versions<Key_T, Mapped_T>::drop(uint64_t v)
+{
+	bool last;
+	{
+		std::lock_guard<std::mutex> g(lock);
+		auto it = live.find(v);
+		if(--(it -> second) == 0)
+		{
+			live.erase(it);
+			dirty.store(true, std::memory_order_release);
+		}
+		openCount.fetch_sub(1, std::memory_order_release);
+		last = --refs == 0;
+	}
+	if(last) delete this;
+}
+
+template <typename Key_T, typename Mapped_T>
+void Map_Versions<Key_T, Mapped_T>::unref()
+{
+	bool last;
+	{
+		std::lock_guard<std::mutex> g(lock);
+		last = --refs == 0;
+	}
+	if(last) delete this;
+}
+
+template <typename Key_T, typename Mapped_T>
+uint64_t Map_Versions<Key_T, Mapped_T>::oldest()
+{
+	std::lock_guard<std::mutex> g(lock);
+	return live.empty() ? UINT64_MAX : live.begin() -> first;
+}
+
+template <typename Key_T, typename Mapped_T>
+typename Map_Versions<Key_T, Mapped_T>::History *Map_Versions<Key_T, Mapped_T>::historyOf(Map_Node<Key_T, Mapped_T> *node)
+{
+	History *h = node -> hist.load(std::memory_order_relaxed);
+	if(h == nullptr)
+	{
+		histories.push_back(nullptr);
+		h = histories.back() = new History(node, histories.size() - 1);
+		node -> hist.store(h, std::memory_order_seq_cst);
+	}
+	return h;
+}
+
+template <typename Key_T, typename Mapped_T>
+void Map_Versions<Key_T, Mapped_T>::recordLevel(Map_Node<Key_T, Mapped_T> *node, int x)
+{
+	History *h = historyOf(node);
+	typename History::Level *top = h -> levels.load(std::memory_order_relaxed);
+	//Only the first write in a version matters
+	for(typename History::Level *l = top; l != nullptr && l -> stamp == version; l = l -> older.load(std::memory_order_relaxed))
+		if(l -> x == x) return;
+	h -> levels.store(new typename History::Level(version, x, node -> ptrs()[x], node -> indexer()[x], top), std::memory_order_release);
+}
+
+template <typename Key_T, typename Mapped_T>
+void Map_Versions<Key_T, Mapped_T>::saveValue(Map_Node<Key_T, Mapped_T> *node, std::true_type)
+{
+	History *h = historyOf(node);
+	typename History::Value *top = h -> values.load(std::memory_order_relaxed);
+	if(top != nullptr && top -> stamp == version) return;
+	h -> values.store(new typename History::Value(version, node -> p.value().second, top), std::memory_order_seq_cst);
+	//Readers that got in before the record went up may still be copying
+	//	the live value; later ones copy the record instead
+	Readers &r = readersOf(node);
+	while(r.n.load(std::memory_order_seq_cst) != 0)
+		std::this_thread::yield();
+}
+
+template <typename Key_T, typename Mapped_T>
+const typename Map_Versions<Key_T, Mapped_T>::History::Level *Map_Versions<Key_T, Mapped_T>::levelFor(const Map_Node<Key_T, Mapped_T> *node, int x, uint64_t v) const
+{
+	const History *h = node -> hist.load(std::memory_order_acquire);
+	if(h == nullptr) return nullptr;
+	//The oldest record for x stamped after v
+	const typename History::Level *found = nullptr;
+	const typename History::Level *l = h -> levels.load(std::memory_order_acquire);
+	while(l != nullptr && l -> stamp > v)
+	{
+		if(l -> x == x) found = l;
+		if(l -> olderStamp <= v) break;
+		l = l -> older.load(std::memory_order_acquire);
+	}
+	return found;
+}
+
+template <typename Key_T, typename Mapped_T>
+const typename Map_Versions<Key_T, Mapped_T>::History::Value *Map_Versions<Key_T, Mapped_T>::valueFor(const Map_Node<Key_T, Mapped_T> *node, uint64_t v) const
+{
+	//seq_cst, to pair with the writer's wait in saveValue
+	const History *h = node -> hist.load(std::memory_order_seq_cst);
+	if(h == nullptr) return nullptr;
+	const typename History::Value *found = nullptr;
+	const typename History::Value *l = h -> values.load(std::memory_order_seq_cst);
+	while(l != nullptr && l -> stamp > v)
+	{
+		found = l;
+		if(l -> olderStamp <= v) break;
+		l = l -> older.load(std::memory_order_acquire);
+	}
+	return found;
+}
+
+template <typename Key_T, typename Mapped_T>
+Map_Node<Key_T, Mapped_T> *Map_Versions<Key_T, Mapped_T>::readPtr(const Map_Node<Key_T, Mapped_T> *node, int x, uint64_t v) const
+{
+	//The slot first, see above
+	Map_Node<Key_T, Mapped_T> *next = __atomic_load_n(&node -> ptrs()[x], __ATOMIC_ACQUIRE);
+	const typename History::Level *l = levelFor(node, x, v);
+	return l == nullptr ? next : l -> next;
+}
+
+template <typename Key_T, typename Mapped_T>
+int Map_Versions<Key_T, Mapped_T>::readIndex(const Map_Node<Key_T, Mapped_T> *node, int x, uint64_t v) const
+{
+	int span = __atomic_load_n(&node -> indexer()[x], __ATOMIC_ACQUIRE);
+	const typename History::Level *l = levelFor(node, x, v);
+	return l == nullptr ? span : l -> span;
+}
+
+template <typename Key_T, typename Mapped_T>
+Mapped_T Map_Versions<Key_T, Mapped_T>::readValue(const Map_Node<Key_T, Mapped_T> *node, uint64_t v) const
+{
+	struct Count
+	{
+		std::atomic<unsigned int> &n;
+		
+		Count(std::atomic<unsigned int> &c) : n(c) {n.fetch_add(1, std::memory_order_seq_cst);}
+		~Count() {n.fetch_sub(1, std::memory_order_release);}
+	} count(readersOf(node).n);
+	const typename History::Value *val = valueFor(node, v);
+	return val == nullptr ? node -> p.value().second : val -> value;
+}
+
+template <typename Key_T, typename Mapped_T>
+void Map_Versions<Key_T, Mapped_T>::prune(uint64_t min)
+{
+	for(size_t x = 0; x < histories.size(); x++)
+	{
+		History::prune(histories[x] -> levels.load(std::memory_order_relaxed), min);
+		History::prune(histories[x] -> values.load(std::memory_order_relaxed), min);
+	}
+}
+
+template <typename Key_T, typename Mapped_T>
+void Map_Versions<Key_T, Mapped_T>::freeHistory(Map_Node<Key_T, Mapped_T> *node)
+{
+	History *h = node -> hist.load(std::memory_order_relaxed);
+	if(h == nullptr) return;
+	histories[h -> slot] = histories.back();
+	histories[h -> slot] -> slot = h -> slot;
+	histories.pop_back();
+	node -> hist.store(nullptr, std::memory_order_relaxed);
+	delete h;
+}
+
+template <typename Key_T, typename Mapped_T>
+void Map_Versions<Key_T, Mapped_T>::reset()
+{
+	for(size_t x = 0; x < histories.size(); x++)
+	{
+		histories[x] -> owner -> hist.store(nullptr, std::memory_order_relaxed);
+		delete histories[x];
+	}
+	histories.clear();
+}
+
+//Wraps Map and needs iterators that point nowhere, see Map::Iterator
+template <typename Key_T, typename Mapped_T, int N>
+class SmallMap;
+
+template <typename Key_T, typename Mapped_T> 
+class Map
+{
+	public:
+	
+	class Iterator
+	{
+		public:
+			friend class Map;
+			Iterator() = delete;
+			Iterator &operator++()
+			{
+				ptr = ptr -> next;
+				return *this;
+			}
+			Iterator operator++(int)
+			{
+				Iterator rv(*this);
+				ptr = ptr -> next;
+				return rv;
+			}
+			Iterator &operator--()
+			{
+				ptr = ptr -> prev;
+				return *this;
+			}
+			Iterator operator--(int)
+			{
+				Iterator rv(*this);
+				ptr = ptr -> prev;
+				return rv;
+			}
+			//The value may be written through these, so open snapshots
+			//	keep a copy of it first. The versions go wherever the
+			//	elements do, so this holds across swaps and moves.
+			std::pair<Key_T, Mapped_T> &operator*() const
+			{
+				versions -> recordValue(ptr);
+				return ptr -> p.value();
+			}
+			std::pair<Key_T, Mapped_T> *operator->() const
+			{
+				versions -> recordValue(ptr);
+				return &(ptr -> p.value());
+			}
+			
+			//Equality
+			//ConstIterator comparisons are declared as free functions
+			bool operator==(const Iterator &it) const{return ptr == it.ptr;}
+			bool operator!=(const Iterator &it) const{return ptr != it.ptr;}
+		
+		private:
+			template <typename, typename, int>
+			friend class SmallMap;
+			Iterator(Map_Node<Key_T, Mapped_T> *p, Map_Versions<Key_T, Mapped_T> *v) : ptr(p), versions(v) {};
+			//Points nowhere; only compared and assigned over
+			explicit Iterator(std::nullptr_t) : ptr(nullptr), versions(nullptr) {};
 			Map_Node<Key_T, Mapped_T> *ptr;
+			//Those of the map holding ptr's element
+			Map_Versions<Key_T, Mapped_T> *versions;
 	};
 
 	class ConstIterator
@@ -137,6 +1315,8 @@ class Map
 			bool operator!=(const Iterator &it) const{return ptr != it.ptr;}
 		
 		private:
+			template <typename, typename, int>
+			friend class SmallMap;
 			ConstIterator(Map_Node<Key_T, Mapped_T> *p) : ptr(p) {};
 			Map_Node<Key_T, Mapped_T> *ptr;
 	};
@@ -168,21 +1348,174 @@ class Map
 				ptr = ptr -> next;
 				return rv;
 			}
-			std::pair<Key_T, Mapped_T> &operator*() const{return ptr -> p.value();}
-			std::pair<Key_T, Mapped_T> *operator->() const{return &(ptr -> p.value());}
+			std::pair<Key_T, Mapped_T> &operator*() const
+			{
+				versions -> recordValue(ptr);
+				return ptr -> p.value();
+			}
+			std::pair<Key_T, Mapped_T> *operator->() const
+			{
+				versions -> recordValue(ptr);
+				return &(ptr -> p.value());
+			}
 			
 			//Equality
 			bool operator==(const ReverseIterator &it) const{return ptr == it.ptr;}
 			bool operator!=(const ReverseIterator &it) const{return ptr != it.ptr;}
 		
 		private:
-			ReverseIterator(Map_Node<Key_T, Mapped_T> *p) : ptr(p) {};
+			ReverseIterator(Map_Node<Key_T, Mapped_T> *p, Map_Versions<Key_T, Mapped_T> *v) : ptr(p), versions(v) {};
 			Map_Node<Key_T, Mapped_T> *ptr;
+			Map_Versions<Key_T, Mapped_T> *versions;
+	};
+	
+	//Read only view of the map as it was when snapshot() was called.
+	//	Later writes to the map don't show through. Taking one is O(1);
+	//	after that every tower level or mapped value the map overwrites
+	//	is copied once per snapshot version, and erased nodes are kept
+	//	until no snapshot can reach them, so the extra memory follows
+	//	the number of writes. A mapped value is saved as soon as it is
+	//	handed out for writing, by at(), operator[], get(),
+	//	insert_or_assign or dereferencing an Iterator, so a reference
+	//	kept from before snapshot() must not be written through after
+	//	it. A snapshot holds a reference on the map's versions, which
+	//	move and swap along with the elements, and which take the
+	//	elements over if the map is destroyed or assigned to while
+	//	snapshots are open. So a snapshot stays valid until it is
+	//	closed, whatever happens to its map.
+	//Snapshots are for readers on other threads. snapshot() is called
+	//	wherever the map is written; after that any number of threads
+	//	may read, copy and close snapshots, without a lock, while one
+	//	thread keeps writing the map. Values are returned by copy,
+	//	since the map writes its own in place. A write that saves a
+	//	value some reader is copying out at that moment waits for the
+	//	copy to finish.
+	class Snapshot
+	{
+		public:
+			class Iterator
+			{
+				public:
+					friend class Snapshot;
+					Iterator() = delete;
+					Iterator &operator++()
+					{
+						ptr = snap -> next(ptr, 0);
+						return *this;
+					}
+					Iterator operator++(int)
+					{
+						Iterator rv(*this);
+						ptr = snap -> next(ptr, 0);
+						return rv;
+					}
+					const Key_T &key() const {return ptr -> p.value().first;}
+					Mapped_T value() const {return snap -> ver -> readValue(ptr, snap -> v);}
+					std::pair<const Key_T &, Mapped_T> operator*() const {return std::pair<const Key_T &, Mapped_T>(key(), value());}
+					
+					bool operator==(const Iterator &it) const{return ptr == it.ptr;}
+					bool operator!=(const Iterator &it) const{return ptr != it.ptr;}
+					
+				private:
+					Iterator(const Snapshot *s, Map_Node<Key_T, Mapped_T> *p) : snap(s), ptr(p) {};
+					const Snapshot *snap;
+					//nullptr at the end
+					Map_Node<Key_T, Mapped_T> *ptr;
+			};
+			
+			Snapshot(const Snapshot &);
+			Snapshot &operator=(const Snapshot &);
+			~Snapshot();
+			size_t size() const {return length;}
+			bool empty() const {return length == 0;}
+			Iterator begin() const {return Iterator(this, next(head, 0));}
+			Iterator end() const {return Iterator(this, nullptr);}
+			Iterator find(const Key_T &) const;
+			Mapped_T at(const Key_T &) const;
+			Mapped_T get(int) const;
+			//Number of keys less than key
+			size_t rank(const Key_T &) const;
+			
+		private:
+			friend class Map;
+			Snapshot(Map_Versions<Key_T, Mapped_T> *vs, Map_Node<Key_T, Mapped_T> *h, uint64_t version, size_t len, unsigned int lv)
+				: ver(vs), head(h), v(version), length(len), levels(lv) {}
+			Map_Versions<Key_T, Mapped_T> *ver;
+			Map_Node<Key_T, Mapped_T> *head;
+			uint64_t v;
+			size_t length;
+			unsigned int levels;
+			
+			Map_Node<Key_T, Mapped_T> *next(const Map_Node<Key_T, Mapped_T> *node, int x) const {return ver -> readPtr(node, x, v);}
+			int span(const Map_Node<Key_T, Mapped_T> *node, int x) const {return ver -> readIndex(node, x, v);}
+			//Last node before key
+			Map_Node<Key_T, Mapped_T> *before(const Key_T &) const;
+	};
+	
+	//Owns a node taken out of a map by extract(), pair and tower
+	//	included, until insert() links it into a map again. Neither step
+	//	allocates or copies the pair. The handle keeps the node's slab
+	//	alive, so it may outlive the map it came from. Dropping a full
+	//	handle destroys the pair and gives the node's slot back, for the
+	//	next map sharing that slab to reuse.
+	class NodeHandle
+	{
+		public:
+			friend class Map;
+			NodeHandle() : node(nullptr), keep(nullptr) {}
+			NodeHandle(NodeHandle &&h) : node(h.node), keep(h.keep)
+			{
+				h.node = nullptr;
+				h.keep = nullptr;
+			}
+			NodeHandle &operator=(NodeHandle &&h)
+			{
+				if(this == &h) return *this;
+				reset();
+				std::swap(node, h.node);
+				std::swap(keep, h.keep);
+				return *this;
+			}
+			NodeHandle(const NodeHandle &) = delete;
+			NodeHandle &operator=(const NodeHandle &) = delete;
+			~NodeHandle() {reset();}
+			
+			bool empty() const {return node == nullptr;}
+			explicit operator bool() const {return node != nullptr;}
+			//The key may be changed before the node is inserted again
+			Key_T &key() const {return node -> p.value().first;}
+			Mapped_T &mapped() const {return node -> p.value().second;}
+		
+		private:
+			NodeHandle(Map_Node<Key_T, Mapped_T> *n, Map_Arena::Keep *k) : node(n), keep(k) {}
+			void reset()
+			{
+				if(node != nullptr)
+				{
+					//Nodes are sized by height, which is their size class
+					int h = node -> height;
+					node -> ~Map_Node<Key_T, Mapped_T>();
+					Map_Arena::giveBack(keep, node, h);
+				}
+				Map_Arena::drop(keep);
+				node = nullptr;
+				keep = nullptr;
+			}
+			Map_Node<Key_T, Mapped_T> *node;
+			Map_Arena::Keep *keep;
 	};
 
+		//An empty map allocates nothing: it shares a read-only pair of
+		//	sentinels with every other empty map until its first insert
 		Map();
+		explicit Map(const Map_LevelPolicy &);
 		Map(const Map &);
 		Map &operator=(const Map &);
+		//Steal the other map's nodes, leaving it empty. Open snapshots
+		//	of either map stay valid, see Snapshot. Neither allocates,
+		//	the emptied map going back to the shared sentinels.
+		Map(Map &&) noexcept;
+		Map &operator=(Map &&) noexcept;
 		Map(std::initializer_list<std::pair<const Key_T, Mapped_T>>);
 		~Map();
 		size_t size() const;
@@ -195,25 +1528,221 @@ class Map
 		ReverseIterator rend();
 		Iterator find(const Key_T &);
 		ConstIterator find(const Key_T &) const;
+		//First element not less than key
+		Iterator lower_bound(const Key_T &);
+		ConstIterator lower_bound(const Key_T &) const;
+		//First element greater than key
+		Iterator upper_bound(const Key_T &);
+		ConstIterator upper_bound(const Key_T &) const;
+		std::pair<Iterator, Iterator> equal_range(const Key_T &);
+		std::pair<ConstIterator, ConstIterator> equal_range(const Key_T &) const;
+		//Looks up every key in [keys_beg, keys_end) and writes an
+		//	Iterator (end() if missing) per key to out, in order. Lookups
+		//	are advanced a level hop at a time in groups, prefetching each
+		//	one's next node, so their cache misses overlap. A group holds
+		//	on to its keys in place, so IT_T must be a forward iterator.
+		template<typename IT_T, typename OUT_T>
+		void find_many(IT_T keys_beg, IT_T keys_end, OUT_T out);
+		template<typename IT_T, typename OUT_T>
+		void find_many(IT_T keys_beg, IT_T keys_end, OUT_T out) const;
+		//Like find_many, for keys in ascending order. See insert_sorted_batch.
+		template<typename IT_T, typename OUT_T>
+		void find_sorted_batch(IT_T keys_beg, IT_T keys_end, OUT_T out);
+		template<typename IT_T, typename OUT_T>
+		void find_sorted_batch(IT_T keys_beg, IT_T keys_end, OUT_T out) const;
 		Mapped_T &at(const Key_T &key);
 		const Mapped_T &at(const Key_T &) const;
 		Mapped_T &operator[](const Key_T &);
+		Mapped_T &operator[](Key_T &&);
 		Mapped_T &get(int);
+		//Order statistics, all O(log n) off the indexer spans.
+		//	Indexes are 0 based like get().
+		//Number of keys less than key, i.e. the index key has or would have
+		size_t rank(const Key_T &) const;
+		Iterator select(int);
+		ConstIterator select(int) const;
+		//Index counted from the largest key
+		ReverseIterator rselect(int);
+		//Number of keys in [lo, hi)
+		size_t count_range(const Key_T &lo, const Key_T &hi) const;
 		std::pair<Iterator, bool> insert(const std::pair<Key_T, Mapped_T> &);
+		std::pair<Iterator, bool> insert(std::pair<Key_T, Mapped_T> &&);
+		//Builds the pair in place. The node is made before the search
+		//	since the key is only known once the pair exists.
+		template<typename... Args>
+		std::pair<Iterator, bool> emplace(Args&&...);
+		//Only builds the mapped value if key is missing
+		template<typename... Args>
+		std::pair<Iterator, bool> try_emplace(const Key_T &, Args&&...);
+		template<typename... Args>
+		std::pair<Iterator, bool> try_emplace(Key_T &&, Args&&...);
+		template<typename M_T>
+		std::pair<Iterator, bool> insert_or_assign(const Key_T &, M_T &&);
+		template<typename M_T>
+		std::pair<Iterator, bool> insert_or_assign(Key_T &&, M_T &&);
+		//Searches from where the last insert or erase left off instead
+		//	of from head, so mostly ascending keys insert in O(1) amortized.
+		Iterator insert(Iterator hint, const std::pair<Key_T, Mapped_T> &);
+		Iterator insert(Iterator hint, std::pair<Key_T, Mapped_T> &&);
+		template<typename... Args>
+		Iterator emplace_hint(Iterator hint, Args&&...);
+		//Batches in ascending key order. Each key's search carries on from
+		//	the previous key's path rather than from head, so k keys cost
+		//	about O(k log(n/k)). Unsorted input still works, just slower.
+		template<typename IT_T>
+		void insert_sorted_batch(IT_T range_beg, IT_T range_end);
 		template<typename IT_T>
 		void insert(IT_T range_beg, IT_T range_end);
+		//Replaces the contents with a sorted range in O(n), using
+		//	evenly spaced tower heights instead of random ones.
+		//	Out of order elements are still accepted, just slower.
+		template<typename IT_T>
+		void assign_sorted(IT_T range_beg, IT_T range_end);
 		void erase(const Key_T &);
-		void erase(Iterator pos);
+		//Returns the element after pos. Searches from the finger, and
+		//	when the finger already sits right before pos, as it does
+		//	after erasing pos's predecessor or inserting right before it,
+		//	nothing is searched at all. Erasing while walking forward is
+		//	therefore linear overall.
+		Iterator erase(Iterator pos);
+		//Unlinks [first, last) in one pass, fixing each level's spans
+		//	once. O(log n + k) for k erased elements.
+		Iterator erase(Iterator first, Iterator last);
+		void erase_at(int);
 		void clear();
+		void swap(Map &) noexcept;
+		//Splitting and joining only relink the head towers, the spans
+		//	at the cut and the ends of the next/prev chain: O(log n) and
+		//	nothing is copied. The maps then share slabs, which are freed
+		//	once the last of them is gone. While either map has open
+		//	snapshots the elements are copied instead, in O(n).
+		//	Iterators to elements that change maps are invalidated,
+		//	since they carry the versions of the map they came from.
+		//Removes the elements from index i on (0 based) and returns them
+		//	as a map with the same level policy
+		Map split_at_rank(size_t i);
+		//Removes the keys not less than key and returns them
+		Map split_at_key(const Key_T &);
+		//Moves every element of m into this map and leaves m empty. All
+		//	of m's keys must be greater than all of this map's, or all
+		//	less; std::invalid_argument otherwise.
+		void join(Map &m);
+		//Unlinks key's node and hands it over, or an empty handle if
+		//	key is missing. O(log n) like erase, and while snapshots are
+		//	open the pair is copied into a new node instead, since they
+		//	may still reach the old one.
+		NodeHandle extract(const Key_T &);
+		//Search-free after the finger like erase(Iterator)
+		NodeHandle extract(Iterator pos);
+		//Links the handle's node in, leaving the handle empty. If the key
+		//	is already there nothing happens and the handle keeps its
+		//	node. The node keeps its tower height. An empty handle
+		//	returns (end(), false).
+		std::pair<Iterator, bool> insert(NodeHandle &&);
+		//Moves every node of m whose key is missing here into this map,
+		//	leaving the rest in m. Each node is relinked, not copied or
+		//	reallocated, unless m has open snapshots. m is walked in
+		//	order and both ends search from their fingers, so close keys
+		//	cost little more than the relinking. Iterators to the nodes
+		//	moved are invalidated, as for join.
+		void merge(Map &m);
+		//Binary snapshot, see Map_FileHeader. Only for trivially
+		//	copyable keys and values. load() maps the file and rebuilds
+		//	the list in one linear pass; Map_Image can also serve reads
+		//	straight from the file without building anything.
+		void save(const char *path) const;
+		void load(const char *path);
+		//See Snapshot. Needs a copyable Mapped_T, since overwritten
+		//	values are copied.
+		Snapshot snapshot() const;
 		
 		//Extra Functions
 		inline int getLength() const{return length;}
+		//O(n), as nodes are counted per height
+		Map_ArenaStats arenaStats() const;
+		const Map_LevelPolicy &levelPolicy() const {return levelGen.policy();}
+		//O(n) walk of the towers plus the MAP_STATS search counters
+		Map_Stats stats() const;
+		//Zeroes the search counters, a no-op without MAP_STATS
+		void resetStats();
+		//Checks the structure in O(n log n): keys strictly ascending,
+		//	next and prev agreeing, no tower above levels, and every
+		//	level's indexer spans matching the ranks they skip and
+		//	adding up to length + 1. False if anything is off.
+		bool consistent() const;
 		
 	private:
 		Map_Node<Key_T, Mapped_T> *head;
 		//Tail is used for iterators only - ptrs[x] never points to tail
 		Map_Node<Key_T, Mapped_T> *tail;		
 		size_t length;
+		//Number of levels in use. Head is allocated at MAP_MAX_HEIGHT
+		//	so it can grow without being reallocated.
+		unsigned int levels;
+		//Whether versions -> finger is a search path of this map
+		bool fingerValid;
+		//Shared with open snapshots and with iterators, and holding the
+		//	arena and finger, so it is there whenever the map has
+		//	elements. nullptr only while the sentinels are shared and no
+		//	snapshot() was taken.
+		mutable Map_Versions<Key_T, Mapped_T> *versions;
+#ifdef MAP_STATS
+		mutable Map_OpCounters findCounters;
+		Map_OpCounters insertCounters;
+		Map_OpCounters eraseCounters;
+#endif
+		
+		//The sentinels empty maps share until their first write. Only
+		//	ever read.
+		static Map_Node<Key_T, Mapped_T> *sharedHead();
+		void shareSentinels();
+		//Everything that may write to head or tail calls this first
+		void ownSentinels();
+		template<typename... Args>
+		Map_Node<Key_T, Mapped_T> *newNode(int, Args&&...);
+		template<typename P_T>
+		std::pair<Iterator, bool> insertPair(P_T &&);
+		template<typename P_T>
+		Iterator insertHinted(P_T &&);
+		template<typename K_T, typename... Args>
+		std::pair<Iterator, bool> tryEmplace(K_T &&, Args&&...);
+		template<typename K_T, typename M_T>
+		std::pair<Iterator, bool> insertOrAssign(K_T &&, M_T &&);
+		void deleteNode(Map_Node<Key_T, Mapped_T> *);
+		void retireNode(Map_Node<Key_T, Mapped_T> *);
+		void collectVersions();
+		bool snapshotsOpen() const {return versions != nullptr && versions -> active();}
+		void recordValue(Map_Node<Key_T, Mapped_T> *);
+		void handOff();
+		void setPtr(Map_Node<Key_T, Mapped_T> *, int, Map_Node<Key_T, Mapped_T> *);
+		void setIndex(Map_Node<Key_T, Mapped_T> *, int, int);
+		void destroyNodes();
+		static Map_Node<Key_T, Mapped_T> *newSentinel(int);
+		static void deleteSentinel(Map_Node<Key_T, Mapped_T> *);
+		unsigned int randomHeight(unsigned int);
+		Map_LevelGen levelGen;
+		//Search comparisons, the only ones MAP_STATS counts
+		static bool keyBefore(const Map_Node<Key_T, Mapped_T> *, const Key_T &);
+		static bool keyIs(const Map_Node<Key_T, Mapped_T> *, const Key_T &);
+		Map_Node<Key_T, Mapped_T> *descend(const Key_T &, Map_Node<Key_T, Mapped_T> **) const;
+		Map_Node<Key_T, Mapped_T> *fingerSearch(const Key_T &, Map_Node<Key_T, Mapped_T> * const *, Map_Node<Key_T, Mapped_T> **) const;
+		void setFinger(Map_Node<Key_T, Mapped_T> **);
+		void link(Map_Node<Key_T, Mapped_T> *, Map_Node<Key_T, Mapped_T> **);
+		void unlink(Map_Node<Key_T, Mapped_T> *, Map_Node<Key_T, Mapped_T> **);
+		void detach(Map_Node<Key_T, Mapped_T> *, Map_Node<Key_T, Mapped_T> **);
+		void pathTo(Map_Node<Key_T, Mapped_T> *, Map_Node<Key_T, Mapped_T> **);
+		NodeHandle extractNode(Map_Node<Key_T, Mapped_T> *, Map_Node<Key_T, Mapped_T> **);
+		void raiseLevels(unsigned int);
+		Map_Node<Key_T, Mapped_T> *linkNode(Map_Node<Key_T, Mapped_T> *);
+		Map_Node<Key_T, Mapped_T> *nodeAt(int) const;
+		Map_Node<Key_T, Mapped_T> *boundNode(const Key_T &, bool) const;
+		//Lookups in flight at once in find_many
+		static const int FIND_GROUP = 16;
+		void findGroup(const Key_T **, int, Map_Node<Key_T, Mapped_T> **) const;
+		template<typename IT_T, typename H_T>
+		void appendRun(IT_T &, IT_T, H_T);
+		void dropEmptyLevels();
+		void append(Map &);
 		friend class Iterator;
 		friend class ConstIterator;
 		friend class ReverseIterator;
@@ -223,420 +1752,1963 @@ class Map
 
 
 
-//Constructors
+//Constructors
+template <typename Key_T, typename Mapped_T> 
+Map<Key_T, Mapped_T>::Map()
+{
+	shareSentinels();
+}
+
+template <typename Key_T, typename Mapped_T> 
+Map<Key_T, Mapped_T>::Map(const Map_LevelPolicy &pol) : levelGen(pol)
+{
+	shareSentinels();
+}
+
+template <typename Key_T, typename Mapped_T> 
+Map<Key_T, Mapped_T>::Map(const Map &m) : levelGen(m.levelGen.policy())
+{
+	shareSentinels();
+	if(m.length == 0) return;
+	ownSentinels();
+	levels = m.levels;
+	
+	//m is already sorted, so rebuild it in one pass with the same towers
+	ConstIterator mIt = m.begin();
+	appendRun(mIt, m.end(), [](const ConstIterator &it, size_t) -> unsigned int {return it.ptr -> height;});
+}
+
+template <typename Key_T, typename Mapped_T> 
+Map<Key_T, Mapped_T> &Map<Key_T, Mapped_T>::operator=(const Map &m)
+{
+	if(this == &m) return *this;
+	clear();
+	levelGen = Map_LevelGen(m.levelGen.policy());
+	levels = m.levels;
+	
+	ConstIterator mIt = m.begin();
+	appendRun(mIt, m.end(), [](const ConstIterator &it, size_t) -> unsigned int {return it.ptr -> height;});
+	return *this;
+}
+
+template <typename Key_T, typename Mapped_T> 
+Map<Key_T, Mapped_T>::Map(Map &&m) noexcept : levelGen(m.levelGen)
+{
+	shareSentinels();
+	swap(m);
+}
+
+template <typename Key_T, typename Mapped_T> 
+Map<Key_T, Mapped_T> &Map<Key_T, Mapped_T>::operator=(Map &&m) noexcept
+{
+	if(this == &m) return *this;
+	//Our elements go the way of a destroyed map's
+	Map old(std::move(*this));
+	swap(m);
+	return *this;
+}
+
+template <typename Key_T, typename Mapped_T>
+Map<Key_T, Mapped_T>::Map(std::initializer_list<std::pair<const Key_T, Mapped_T>> list)
+{
+	shareSentinels();
+	insert(list.begin(), list.end());
+}
+
+template <typename Key_T, typename Mapped_T> 
+Map<Key_T, Mapped_T>::~Map()
+{
+	//Shared sentinels mean there is nothing to free
+	if(head != sharedHead())
+	{
+		if(snapshotsOpen()) handOff();
+		else
+		{
+			destroyNodes();
+			deleteSentinel(head);
+			deleteSentinel(tail);
+		}
+	}
+	if(versions != nullptr) versions -> unref();
+}
+
+//Node Allocation
+//Built in static storage on first use and never destroyed, so taking
+//them cannot fail and maps destroyed at exit can still compare against
+//them
+template <typename Key_T, typename Mapped_T> 
+Map_Node<Key_T, Mapped_T> *Map<Key_T, Mapped_T>::sharedHead()
+{
+	struct Empty
+	{
+		alignas(Map_Node<Key_T, Mapped_T>) unsigned char headMem[sizeof(Map_Node<Key_T, Mapped_T>) + MAP_MAX_HEIGHT * (sizeof(Map_Node<Key_T, Mapped_T> *) + sizeof(int))];
+		alignas(Map_Node<Key_T, Mapped_T>) unsigned char tailMem[sizeof(Map_Node<Key_T, Mapped_T>) + sizeof(Map_Node<Key_T, Mapped_T> *) + sizeof(int)];
+		Map_Node<Key_T, Mapped_T> *head;
+		
+		Empty()
+		{
+			head = new(headMem) Map_Node<Key_T, Mapped_T>(MAP_MAX_HEIGHT);
+			Map_Node<Key_T, Mapped_T> *tail = new(tailMem) Map_Node<Key_T, Mapped_T>(1);
+			head -> next = tail;
+			tail -> prev = head;
+		}
+	};
+	static Empty e;
+	return e.head;
+}
+
+//The state new and moved-from maps start in, allocating nothing
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::shareSentinels()
+{
+	head = sharedHead();
+	tail = head -> next;
+	length = 0;
+	levels = 1;
+	fingerValid = false;
+	versions = nullptr;
+}
+
+//Snapshots taken while the sentinels were shared keep reading those,
+//which stay empty, so versions carries on as it is
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::ownSentinels()
+{
+	if(length != 0 || head != sharedHead()) return;
+	Map_Node<Key_T, Mapped_T> *h = newSentinel(MAP_MAX_HEIGHT);
+	Map_Node<Key_T, Mapped_T> *t = nullptr;
+	try
+	{
+		t = newSentinel(1);
+		if(versions == nullptr) versions = new Map_Versions<Key_T, Mapped_T>();
+	}
+	catch(...)
+	{
+		if(t != nullptr) deleteSentinel(t);
+		deleteSentinel(h);
+		throw;
+	}
+	head = h;
+	tail = t;
+	head -> next = tail;
+	tail -> prev = head;
+	levels = 1;
+	fingerValid = false;
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename... Args>
+Map_Node<Key_T, Mapped_T> *Map<Key_T, Mapped_T>::newNode(int h, Args&&... args)
+{
+	void *mem = versions -> arena.allocate(Map_Node<Key_T, Mapped_T>::bytes(h), alignof(Map_Node<Key_T, Mapped_T>), h);
+	try
+	{
+		return new(mem) Map_Node<Key_T, Mapped_T>(h, std::experimental::in_place, std::forward<Args>(args)...);
+	}
+	catch(...)
+	{
+		versions -> arena.deallocate(mem, Map_Node<Key_T, Mapped_T>::bytes(h), h);
+		throw;
+	}
+}
+
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::deleteNode(Map_Node<Key_T, Mapped_T> *node)
+{
+	int h = node -> height;
+	if(node -> hist.load(std::memory_order_relaxed) != nullptr) versions -> freeHistory(node);
+	node -> ~Map_Node<Key_T, Mapped_T>();
+	versions -> arena.deallocate(node, Map_Node<Key_T, Mapped_T>::bytes(h), h);
+}
+
+//Frees an unlinked node, or parks it if an open snapshot may reach it
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::retireNode(Map_Node<Key_T, Mapped_T> *node)
+{
+	if(snapshotsOpen()) versions -> retired.push_back(std::make_pair(versions -> version, node));
+	else	deleteNode(node);
+}
+
+//Frees whatever the snapshots closed since last time were holding on to
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::collectVersions()
+{
+	if(versions == nullptr || !versions -> dirty.exchange(false, std::memory_order_acquire)) return;
+	//A node unlinked in version r can only be reached from snapshots older than r
+	uint64_t min = versions -> oldest();
+	size_t x = 0;
+	for(; x < versions -> retired.size() && versions -> retired[x].first <= min; x++)
+		deleteNode(versions -> retired[x].second);
+	versions -> retired.erase(versions -> retired.begin(), versions -> retired.begin() + x);
+	//With nothing open there is no reader left to keep records for
+	if(min == UINT64_MAX) versions -> reset();
+	else	versions -> prune(min);
+}
+
+//Leaves every node and the sentinels to versions, which already holds
+//the slabs and destroys them once the last snapshot is closed
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::handOff()
+{
+	versions -> orphanHead = head;
+	versions -> orphanTail = tail;
+}
+
+//Tower writes to nodes that open snapshots may see go through these.
+//Snapshot readers on other threads load the slot, see Map_Versions.
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::setPtr(Map_Node<Key_T, Mapped_T> *node, int x, Map_Node<Key_T, Mapped_T> *to)
+{
+	if(snapshotsOpen())
+	{
+		versions -> recordLevel(node, x);
+		__atomic_store_n(&node -> ptrs()[x], to, __ATOMIC_RELEASE);
+	}
+	else	node -> ptrs()[x] = to;
+}
+
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::setIndex(Map_Node<Key_T, Mapped_T> *node, int x, int z)
+{
+	if(snapshotsOpen())
+	{
+		versions -> recordLevel(node, x);
+		__atomic_store_n(&node -> indexer()[x], z, __ATOMIC_RELEASE);
+	}
+	else	node -> indexer()[x] = z;
+}
+
+//Mapped value writes go through this
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::recordValue(Map_Node<Key_T, Mapped_T> *node)
+{
+	if(versions != nullptr) versions -> recordValue(node);
+}
+
+//Destroys every element, retired ones included, and hands all slabs
+//back in one go. Does not touch head or tail, which must be our own.
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::destroyNodes()
+{
+	versions -> reset();
+	//Nothing to run per node if the pair has a trivial destructor
+	if(!std::is_trivially_destructible<std::pair<Key_T, Mapped_T>>::value)
+	{
+		Map_Node<Key_T, Mapped_T> *node = head -> next;
+		while(node != tail)
+		{
+			Map_Node<Key_T, Mapped_T> *del = node;
+			node = node -> next;
+			del -> ~Map_Node<Key_T, Mapped_T>();
+		}
+		for(size_t x = 0; x < versions -> retired.size(); x++)
+			versions -> retired[x].second -> ~Map_Node<Key_T, Mapped_T>();
+	}
+	versions -> retired.clear();
+	versions -> arena.release();
+}
+
+template <typename Key_T, typename Mapped_T> 
+Map_Node<Key_T, Mapped_T> *Map<Key_T, Mapped_T>::newSentinel(int h)
+{
+	void *mem = ::operator new(Map_Node<Key_T, Mapped_T>::bytes(h));
+	return new(mem) Map_Node<Key_T, Mapped_T>(h);
+}
+
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::deleteSentinel(Map_Node<Key_T, Mapped_T> *node)
+{
+	node -> ~Map_Node<Key_T, Mapped_T>();
+	::operator delete(node);
+}
+
+template <typename Key_T, typename Mapped_T> 
+Map_ArenaStats Map<Key_T, Mapped_T>::arenaStats() const
+{
+	//Rough glibc malloc footprint: 8 byte header, 16 byte granularity,
+	//	32 byte minimum chunk
+	auto chunk = [](size_t n) -> size_t
+	{
+		size_t c = (n + 8 + 15) & ~(size_t)15;
+		return c < 32 ? 32 : c;
+	};
+	Map_ArenaStats s = versions != nullptr ? versions -> arena.stats() : Map_ArenaStats();
+	//Per height, which the arena does not keep. Counting also stays
+	//	right after a split or join, when the arena's counters say what
+	//	it allocated rather than what this map holds.
+	size_t live[MAP_MAX_HEIGHT + 1];
+	for(int x = 0; x <= MAP_MAX_HEIGHT; x++)
+		live[x] = 0;
+	for(Map_Node<Key_T, Mapped_T> *node = head -> next; node != tail; node = node -> next)
+		live[node -> height]++;
+	if(versions != nullptr)
+		for(size_t x = 0; x < versions -> retired.size(); x++)
+			live[versions -> retired[x].second -> height]++;
+	s.nodes = s.bytesInUse = 0;
+	for(int x = 1; x <= MAP_MAX_HEIGHT; x++)
+	{
+		s.nodes += live[x];
+		s.bytesInUse += live[x] * Map_Node<Key_T, Mapped_T>::bytes(x);
+	}
+	size_t vectorNode = sizeof(std::experimental::optional<std::pair<Key_T, Mapped_T>>)
+		+ 2 * sizeof(Map_Node<Key_T, Mapped_T> *) + sizeof(std::vector<Map_Node<Key_T, Mapped_T> *>) + sizeof(std::vector<int>);
+	for(int x = 1; x <= MAP_MAX_HEIGHT; x++)
+		s.bytesVectorLayout += live[x] * (chunk(vectorNode)
+			+ chunk(x * sizeof(Map_Node<Key_T, Mapped_T> *)) + chunk(x * sizeof(int)));
+	return s;
+}
+
+template <typename Key_T, typename Mapped_T>
+Map_Stats Map<Key_T, Mapped_T>::stats() const
+{
+	Map_Stats s;
+	s.length = length;
+	s.levels = levels;
+	for(int x = 0; x <= MAP_MAX_HEIGHT; x++)
+		s.heights[x] = 0;
+	//Sentinels included
+	size_t slots = MAP_MAX_HEIGHT + 1;
+	for(Map_Node<Key_T, Mapped_T> *node = head -> next; node != tail; node = node -> next)
+	{
+		s.heights[node -> height]++;
+		slots += node -> height;
+	}
+	s.ptrBytes = slots * sizeof(Map_Node<Key_T, Mapped_T> *);
+	s.indexerBytes = slots * sizeof(int);
+	s.arena = arenaStats();
+
+	//Height h < maxHeight comes up with chance (1 - p) p^(h - 1), and
+	//	maxHeight takes the rest
+	const Map_LevelPolicy &pol = levelGen.policy();
+	s.heightChiSquare = 0;
+	s.heightDegrees = 0;
+	double reach = 1;
+	for(unsigned int h = 1; h <= pol.maxHeight; h++)
+	{
+		double expected = length * (h == pol.maxHeight ? reach : reach * (1 - pol.p));
+		reach *= pol.p;
+		if(expected < 5) continue;
+		double d = s.heights[h] - expected;
+		s.heightChiSquare += d * d / expected;
+		s.heightDegrees++;
+	}
+	if(s.heightDegrees > 0) s.heightDegrees--;
+
+#ifdef MAP_STATS
+	s.searchCounted = true;
+	s.find = findCounters.read();
+	s.insert = insertCounters.read();
+	s.erase = eraseCounters.read();
+#else
+	s.searchCounted = false;
+	s.find = s.insert = s.erase = Map_OpStats();
+#endif
+	return s;
+}
+
+template <typename Key_T, typename Mapped_T>
+void Map<Key_T, Mapped_T>::resetStats()
+{
+#ifdef MAP_STATS
+	findCounters.reset();
+	insertCounters.reset();
+	eraseCounters.reset();
+#endif
+}
+
+template <typename Key_T, typename Mapped_T>
+bool Map<Key_T, Mapped_T>::consistent() const
+{
+	if(levels < 1 || levels > (unsigned int)MAP_MAX_HEIGHT) return false;
+	for(int x = levels; x < MAP_MAX_HEIGHT; x++)
+		if(head -> ptrs()[x] != nullptr) return false;
+
+	//Bottom list: links, order and length
+	size_t n = 0;
+	for(Map_Node<Key_T, Mapped_T> *node = head; node != tail; node = node -> next)
+	{
+		if(node -> next == nullptr || node -> next -> prev != node) return false;
+		if(node == head) continue;
+		n++;
+		if(n > length || node -> height < 1 || (int)levels < node -> height) return false;
+		if(node -> prev != head && !(node -> prev -> p.value().first < node -> p.value().first)) return false;
+	}
+	if(n != length) return false;
+
+	//Each level must visit its nodes in list order, skipping exactly
+	//	as many ranks as its spans say
+	for(unsigned int x = 0; x < levels; x++)
+	{
+		Map_Node<Key_T, Mapped_T> *bottom = head;
+		size_t rank = 0, total = 0;
+		for(Map_Node<Key_T, Mapped_T> *node = head; node != nullptr; node = node -> ptrs()[x])
+		{
+			if(node != head && node -> height <= (int)x) return false;
+			if(node -> indexer()[x] < 1) return false;
+			total += node -> indexer()[x];
+			Map_Node<Key_T, Mapped_T> *next = node -> ptrs()[x];
+			if(next == nullptr) break;
+			//Walk the bottom list up to next, counting ranks
+			while(bottom != next && bottom != tail)
+			{
+				bottom = bottom -> next;
+				rank++;
+			}
+			if(bottom != next || rank != total) return false;
+		}
+		if(total != length + 1) return false;
+	}
+	return true;
+}
+
+//Size
+template <typename Key_T, typename Mapped_T>
+size_t Map<Key_T, Mapped_T>::size() const {return length;}
+
+template <typename Key_T, typename Mapped_T>
+bool Map<Key_T, Mapped_T>::empty () const
+{
+	if(length <= 0) return true;
+	return false;
+}
+
+//Iterators
+template <typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::begin()
+{
+	return Map<Key_T, Mapped_T>::Iterator(head -> next, versions);
+}
+
+template <typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::end()
+{
+	return Map<Key_T, Mapped_T>::Iterator(tail, versions);
+}
+
+template <typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::begin() const
+{
+	return Map<Key_T, Mapped_T>::ConstIterator(head -> next);
+}
+
+template <typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::end() const
+{
+	return Map<Key_T, Mapped_T>::ConstIterator(tail);
+}
+
+template <typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::ReverseIterator Map<Key_T, Mapped_T>::rbegin()
+{
+	return Map<Key_T, Mapped_T>::ReverseIterator(tail -> prev, versions);
+}
+
+template <typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::ReverseIterator Map<Key_T, Mapped_T>::rend()
+{
+	return Map<Key_T, Mapped_T>::ReverseIterator(head, versions);
+}
+
+
+//Element Access
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::find(const Key_T &key)
+{
+	MAP_STAT(Map_StatScope scope(findCounters));
+	Map_Node<Key_T, Mapped_T> *node = head;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		MAP_STAT(Map_probe().steps++);
+		while(node -> ptrs()[x] != nullptr)
+		{
+			if(keyIs(node -> ptrs()[x], key))
+				return Map<Key_T, Mapped_T>::Iterator(node -> ptrs()[x], versions);
+			else if(keyBefore(node -> ptrs()[x], key))
+			{
+				MAP_STAT(Map_probe().steps++);
+				node = node -> ptrs()[x];
+			}
+			else	break;
+		}
+	}
+	return end();	
+}
+
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::find(const Key_T &key) const
+{
+	MAP_STAT(Map_StatScope scope(findCounters));
+	Map_Node<Key_T, Mapped_T> *node = head;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		MAP_STAT(Map_probe().steps++);
+		while(node -> ptrs()[x] != nullptr)
+		{
+			if(keyIs(node -> ptrs()[x], key))
+				return Map<Key_T, Mapped_T>::ConstIterator(node -> ptrs()[x]);
+			else if(keyBefore(node -> ptrs()[x], key))
+			{
+				MAP_STAT(Map_probe().steps++);
+				node = node -> ptrs()[x];
+			}
+			else	break;
+		}
+	}
+	return end();	
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename IT_T, typename OUT_T>
+void Map<Key_T, Mapped_T>::find_many(IT_T keys_beg, IT_T keys_end, OUT_T out)
+{
+	static_assert(std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<IT_T>::iterator_category>::value,
+		"find_many needs a forward iterator");
+	const Key_T *keys[FIND_GROUP];
+	Map_Node<Key_T, Mapped_T> *found[FIND_GROUP];
+	while(keys_beg != keys_end)
+	{
+		int n = 0;
+		for(; n < FIND_GROUP && keys_beg != keys_end; ++keys_beg)
+			keys[n++] = &*keys_beg;
+		findGroup(keys, n, found);
+		for(int x = 0; x < n; x++)
+			*out++ = Iterator(found[x], versions);
+	}
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename IT_T, typename OUT_T>
+void Map<Key_T, Mapped_T>::find_many(IT_T keys_beg, IT_T keys_end, OUT_T out) const
+{
+	static_assert(std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<IT_T>::iterator_category>::value,
+		"find_many needs a forward iterator");
+	const Key_T *keys[FIND_GROUP];
+	Map_Node<Key_T, Mapped_T> *found[FIND_GROUP];
+	while(keys_beg != keys_end)
+	{
+		int n = 0;
+		for(; n < FIND_GROUP && keys_beg != keys_end; ++keys_beg)
+			keys[n++] = &*keys_beg;
+		findGroup(keys, n, found);
+		for(int x = 0; x < n; x++)
+			*out++ = ConstIterator(found[x]);
+	}
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename IT_T, typename OUT_T>
+void Map<Key_T, Mapped_T>::find_sorted_batch(IT_T keys_beg, IT_T keys_end, OUT_T out)
+{
+	Map_Node<Key_T, Mapped_T> *path[MAP_MAX_HEIGHT];
+	bool first = true;
+	for(; keys_beg != keys_end; ++keys_beg)
+	{
+		const Key_T &key = *keys_beg;
+		Map_Node<Key_T, Mapped_T> *node = first ? descend(key, path) : fingerSearch(key, path, path);
+		first = false;
+		if(node != tail && node -> p.value().first == key) *out++ = Iterator(node, versions);
+		else	*out++ = end();
+	}
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename IT_T, typename OUT_T>
+void Map<Key_T, Mapped_T>::find_sorted_batch(IT_T keys_beg, IT_T keys_end, OUT_T out) const
+{
+	Map_Node<Key_T, Mapped_T> *path[MAP_MAX_HEIGHT];
+	bool first = true;
+	for(; keys_beg != keys_end; ++keys_beg)
+	{
+		const Key_T &key = *keys_beg;
+		Map_Node<Key_T, Mapped_T> *node = first ? descend(key, path) : fingerSearch(key, path, path);
+		first = false;
+		if(node != tail && node -> p.value().first == key) *out++ = ConstIterator(node);
+		else	*out++ = end();
+	}
+}
+
+//Runs n lookups side by side as small state machines. Each round moves
+//every unfinished lookup one hop, right or down, then prefetches the
+//node it will compare against next round. By the time a lookup comes
+//back around its node is usually in cache. found[x] is tail on a miss.
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::findGroup(const Key_T **keys, int n, Map_Node<Key_T, Mapped_T> **found) const
+{
+	Map_Node<Key_T, Mapped_T> *node[FIND_GROUP];
+	Map_Node<Key_T, Mapped_T> *next[FIND_GROUP];
+	int level[FIND_GROUP];
+	int active = n;
+	for(int x = 0; x < n; x++)
+	{
+		node[x] = head;
+		level[x] = levels - 1;
+		next[x] = head -> ptrs()[level[x]];
+		found[x] = nullptr;
+		if(next[x] != nullptr) __builtin_prefetch(next[x]);
+	}
+	
+	while(active > 0)
+		for(int x = 0; x < n; x++)
+		{
+			if(found[x] != nullptr) continue;
+			Map_Node<Key_T, Mapped_T> *cand = next[x];
+			if(cand != nullptr && cand -> p.value().first < *keys[x])
+			{
+				//Move right
+				node[x] = cand;
+				next[x] = cand -> ptrs()[level[x]];
+			}
+			else if(cand != nullptr && cand -> p.value().first == *keys[x])
+			{
+				found[x] = cand;
+				active--;
+				continue;
+			}
+			else if(level[x] == 0)
+			{
+				found[x] = tail;
+				active--;
+				continue;
+			}
+			else	next[x] = node[x] -> ptrs()[--level[x]];
+			if(next[x] != nullptr) __builtin_prefetch(next[x]);
+		}
+}
+
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::lower_bound(const Key_T &key)
+{
+	return Iterator(boundNode(key, false), versions);
+}
+
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::lower_bound(const Key_T &key) const
+{
+	return ConstIterator(boundNode(key, false));
+}
+
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::upper_bound(const Key_T &key)
+{
+	return Iterator(boundNode(key, true), versions);
+}
+
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::upper_bound(const Key_T &key) const
+{
+	return ConstIterator(boundNode(key, true));
+}
+
+template <typename Key_T, typename Mapped_T> 
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, typename Map<Key_T, Mapped_T>::Iterator> Map<Key_T, Mapped_T>::equal_range(const Key_T &key)
+{
+	Map_Node<Key_T, Mapped_T> *node = boundNode(key, false);
+	//Keys are unique so the range is at most one long
+	if(node != tail && !(key < node -> p.value().first))
+		return std::make_pair(Iterator(node, versions), Iterator(node -> next, versions));
+	return std::make_pair(Iterator(node, versions), Iterator(node, versions));
+}
+
+template <typename Key_T, typename Mapped_T> 
+std::pair<typename Map<Key_T, Mapped_T>::ConstIterator, typename Map<Key_T, Mapped_T>::ConstIterator> Map<Key_T, Mapped_T>::equal_range(const Key_T &key) const
+{
+	Map_Node<Key_T, Mapped_T> *node = boundNode(key, false);
+	if(node != tail && !(key < node -> p.value().first))
+		return std::make_pair(ConstIterator(node), ConstIterator(node -> next));
+	return std::make_pair(ConstIterator(node), ConstIterator(node));
+}
+
+//First node not less than key, or greater than key if upper is set.
+//Tail if there is none.
+template <typename Key_T, typename Mapped_T> 
+Map_Node<Key_T, Mapped_T> *Map<Key_T, Mapped_T>::boundNode(const Key_T &key, bool upper) const
+{
+	Map_Node<Key_T, Mapped_T> *node = head;
+	for(int x = levels - 1; x >= 0; x--)
+		while(node -> ptrs()[x] != nullptr && (upper ? !(key < node -> ptrs()[x] -> p.value().first) : node -> ptrs()[x] -> p.value().first < key))
+			node = node -> ptrs()[x];
+	return node -> next;
+}
+
+template <typename Key_T, typename Mapped_T> 
+Mapped_T &Map<Key_T, Mapped_T>::at(const Key_T &key)
+{
+	MAP_STAT(Map_StatScope scope(findCounters));
+	Map_Node<Key_T, Mapped_T> *node = head;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		MAP_STAT(Map_probe().steps++);
+		while(node -> ptrs()[x] != nullptr)
+		{
+			if(keyIs(node -> ptrs()[x], key))
+			{
+				recordValue(node -> ptrs()[x]);
+				return node -> ptrs()[x] -> p.value().second;
+			}
+			else if(keyBefore(node -> ptrs()[x], key))
+			{
+				MAP_STAT(Map_probe().steps++);
+				node = node -> ptrs()[x];
+			}
+			else	break;
+		}
+	}
+	throw std::out_of_range ("");
+}
+
+template <typename Key_T, typename Mapped_T> 
+const Mapped_T &Map<Key_T, Mapped_T>::at(const Key_T &key) const
+{
+	MAP_STAT(Map_StatScope scope(findCounters));
+	Map_Node<Key_T, Mapped_T> *node = head;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		MAP_STAT(Map_probe().steps++);
+		while(node -> ptrs()[x] != nullptr)
+		{
+			if(keyIs(node -> ptrs()[x], key))
+				return node -> ptrs()[x] -> p.value().second;
+			else if(keyBefore(node -> ptrs()[x], key))
+			{
+				MAP_STAT(Map_probe().steps++);
+				node = node -> ptrs()[x];
+			}
+			else	break;
+		}
+	}
+	throw std::out_of_range ("");
+}
+
+template <typename Key_T, typename Mapped_T>
+Mapped_T &Map<Key_T, Mapped_T>::operator[] (const Key_T &key)
+{
+	std::pair<Iterator, bool> rv = tryEmplace(key);
+	if(!rv.second) recordValue(rv.first.ptr);
+	return rv.first.ptr -> p.value().second;
+}
+
+template <typename Key_T, typename Mapped_T>
+Mapped_T &Map<Key_T, Mapped_T>::operator[] (Key_T &&key)
+{
+	std::pair<Iterator, bool> rv = tryEmplace(std::move(key));
+	if(!rv.second) recordValue(rv.first.ptr);
+	return rv.first.ptr -> p.value().second;
+}
+
+template <typename Key_T, typename Mapped_T>
+Mapped_T &Map<Key_T, Mapped_T>::get (int index)
+{
+	Map_Node<Key_T, Mapped_T> *node = nodeAt(index);
+	if(node == nullptr) throw std::out_of_range ("");
+	recordValue(node);
+	return node -> p.value().second;
+}
+
+//Order Statistics
+template <typename Key_T, typename Mapped_T>
+size_t Map<Key_T, Mapped_T>::rank(const Key_T &key) const
+{
+	const Map_Node<Key_T, Mapped_T> *node = head;
+	size_t z = 0;
+	for(int x = levels - 1; x >= 0; x--)
+		while(node -> ptrs()[x] != nullptr && node -> ptrs()[x] -> p.value().first < key)
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+	return z;
+}
+
+template <typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::select(int index)
+{
+	Map_Node<Key_T, Mapped_T> *node = nodeAt(index);
+	if(node == nullptr) throw std::out_of_range ("");
+	return Iterator(node, versions);
+}
+
+template <typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::select(int index) const
+{
+	Map_Node<Key_T, Mapped_T> *node = nodeAt(index);
+	if(node == nullptr) throw std::out_of_range ("");
+	return ConstIterator(node);
+}
+
+template <typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::ReverseIterator Map<Key_T, Mapped_T>::rselect(int index)
+{
+	if(index < 0 || (size_t)index >= length) throw std::out_of_range ("");
+	return ReverseIterator(nodeAt(length - 1 - index), versions);
+}
+
+template <typename Key_T, typename Mapped_T>
+size_t Map<Key_T, Mapped_T>::count_range(const Key_T &lo, const Key_T &hi) const
+{
+	if(!(lo < hi)) return 0;
+	return rank(hi) - rank(lo);
+}
+
+//Node at a 0 based index, nullptr if out of range
+template <typename Key_T, typename Mapped_T>
+Map_Node<Key_T, Mapped_T> *Map<Key_T, Mapped_T>::nodeAt(int index) const
+{
+	//Index starts from 1
+	index++;
+	if(index <= 0) return nullptr;
+	
+	Map_Node<Key_T, Mapped_T> *node = head;
+	int z = 0;	
+	for(int x = levels - 1; x >= 0; x--)
+		while(node -> ptrs()[x] != nullptr)
+		{
+			z += node -> indexer()[x];
+			if(z  == index)
+				return node -> ptrs()[x];
+			else if(z < index)
+				node = node -> ptrs()[x];
+			else	
+			{
+				z -= node -> indexer()[x];
+				break;
+			}
+		}
+	return nullptr;
+}
+
+//Modifiers
+template <typename Key_T, typename Mapped_T> 
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::insert(const std::pair<Key_T, Mapped_T> &in)
+{
+	return insertPair(in);
+}
+
+template <typename Key_T, typename Mapped_T> 
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::insert(std::pair<Key_T, Mapped_T> &&in)
+{
+	return insertPair(std::move(in));
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename P_T>
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::insertPair(P_T &&in)
+{
+	MAP_STAT(Map_StatScope scope(insertCounters));
+	ownSentinels();
+	//Determine which pointers need to be updated
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = descend(in.first, updater);
+
+	//Return false if duplicate
+	if(node != tail && keyIs(node, in.first))	
+	{
+		setFinger(updater);
+		return std::make_pair<Map<Key_T, Mapped_T>::Iterator, bool>(Map<Key_T, Mapped_T>::Iterator(node, versions), false);
+	}
+	
+	Map_Node<Key_T, Mapped_T> *ins = newNode(randomHeight(levels), std::forward<P_T>(in));
+	link(ins, updater);
+	return std::make_pair<Map<Key_T, Mapped_T>::Iterator, bool>(Map<Key_T, Mapped_T>::Iterator(ins, versions), true);
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename... Args>
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::emplace(Args&&... args)
+{
+	MAP_STAT(Map_StatScope scope(insertCounters));
+	ownSentinels();
+	Map_Node<Key_T, Mapped_T> *ins = newNode(randomHeight(levels), std::forward<Args>(args)...);
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = descend(ins -> p.value().first, updater);
+	
+	if(node != tail && keyIs(node, ins -> p.value().first))	
+	{
+		deleteNode(ins);
+		setFinger(updater);
+		return std::make_pair<Map<Key_T, Mapped_T>::Iterator, bool>(Map<Key_T, Mapped_T>::Iterator(node, versions), false);
+	}
+	link(ins, updater);
+	return std::make_pair<Map<Key_T, Mapped_T>::Iterator, bool>(Map<Key_T, Mapped_T>::Iterator(ins, versions), true);
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename... Args>
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::try_emplace(const Key_T &key, Args&&... args)
+{
+	return tryEmplace(key, std::forward<Args>(args)...);
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename... Args>
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::try_emplace(Key_T &&key, Args&&... args)
+{
+	return tryEmplace(std::move(key), std::forward<Args>(args)...);
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename K_T, typename... Args>
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::tryEmplace(K_T &&key, Args&&... args)
+{
+	MAP_STAT(Map_StatScope scope(insertCounters));
+	ownSentinels();
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = descend(key, updater);
+	
+	if(node != tail && keyIs(node, key))	
+	{
+		setFinger(updater);
+		return std::make_pair<Map<Key_T, Mapped_T>::Iterator, bool>(Map<Key_T, Mapped_T>::Iterator(node, versions), false);
+	}
+	
+	Map_Node<Key_T, Mapped_T> *ins = newNode(randomHeight(levels), std::piecewise_construct,
+		std::forward_as_tuple(std::forward<K_T>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+	link(ins, updater);
+	return std::make_pair<Map<Key_T, Mapped_T>::Iterator, bool>(Map<Key_T, Mapped_T>::Iterator(ins, versions), true);
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename M_T>
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::insert_or_assign(const Key_T &key, M_T &&obj)
+{
+	return insertOrAssign(key, std::forward<M_T>(obj));
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename M_T>
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::insert_or_assign(Key_T &&key, M_T &&obj)
+{
+	return insertOrAssign(std::move(key), std::forward<M_T>(obj));
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename K_T, typename M_T>
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::insertOrAssign(K_T &&key, M_T &&obj)
+{
+	MAP_STAT(Map_StatScope scope(insertCounters));
+	ownSentinels();
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = descend(key, updater);
+	
+	if(node != tail && keyIs(node, key))	
+	{
+		recordValue(node);
+		node -> p.value().second = std::forward<M_T>(obj);
+		setFinger(updater);
+		return std::make_pair<Map<Key_T, Mapped_T>::Iterator, bool>(Map<Key_T, Mapped_T>::Iterator(node, versions), false);
+	}
+	
+	Map_Node<Key_T, Mapped_T> *ins = newNode(randomHeight(levels), std::forward<K_T>(key), std::forward<M_T>(obj));
+	link(ins, updater);
+	return std::make_pair<Map<Key_T, Mapped_T>::Iterator, bool>(Map<Key_T, Mapped_T>::Iterator(ins, versions), true);
+}
+
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::insert(Iterator hint, const std::pair<Key_T, Mapped_T> &in)
+{
+	//The finger does the work, hint only tells us the caller expects
+	//	key to land near the previous one
+	(void)hint;
+	return insertHinted(in);
+}
+
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::insert(Iterator hint, std::pair<Key_T, Mapped_T> &&in)
+{
+	(void)hint;
+	return insertHinted(std::move(in));
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename P_T>
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::insertHinted(P_T &&in)
+{
+	MAP_STAT(Map_StatScope scope(insertCounters));
+	ownSentinels();
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = fingerValid ? fingerSearch(in.first, versions -> finger, updater) : descend(in.first, updater);
+
+	if(node != tail && keyIs(node, in.first))	
+	{
+		setFinger(updater);
+		return Iterator(node, versions);
+	}
+	
+	Map_Node<Key_T, Mapped_T> *ins = newNode(randomHeight(levels), std::forward<P_T>(in));
+	link(ins, updater);
+	return Iterator(ins, versions);
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename IT_T>
+void Map<Key_T, Mapped_T>::insert_sorted_batch(IT_T range_beg, IT_T range_end)
+{
+	//The finger is exactly the previous key's path
+	for(; range_beg != range_end; ++range_beg)
+		insertHinted(*range_beg);
+}
+
+template <typename Key_T, typename Mapped_T> 
+template <typename... Args>
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::emplace_hint(Iterator hint, Args&&... args)
+{
+	MAP_STAT(Map_StatScope scope(insertCounters));
+	(void)hint;
+	ownSentinels();
+	Map_Node<Key_T, Mapped_T> *ins = newNode(randomHeight(levels), std::forward<Args>(args)...);
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	const Key_T &key = ins -> p.value().first;
+	Map_Node<Key_T, Mapped_T> *node = fingerValid ? fingerSearch(key, versions -> finger, updater) : descend(key, updater);
+	
+	if(node != tail && keyIs(node, key))	
+	{
+		deleteNode(ins);
+		setFinger(updater);
+		return Iterator(node, versions);
+	}
+	link(ins, updater);
+	return Iterator(ins, versions);
+}
+
+template <typename Key_T, typename Mapped_T> 
+bool Map<Key_T, Mapped_T>::keyBefore(const Map_Node<Key_T, Mapped_T> *node, const Key_T &key)
+{
+	MAP_STAT(Map_probe().compares++);
+	return node -> p.value().first < key;
+}
+
+template <typename Key_T, typename Mapped_T> 
+bool Map<Key_T, Mapped_T>::keyIs(const Map_Node<Key_T, Mapped_T> *node, const Key_T &key)
+{
+	MAP_STAT(Map_probe().compares++);
+	return node -> p.value().first == key;
+}
+
+//Fills updater with the last node before key on every level and
+//returns the first node not before key (tail if none).
+template <typename Key_T, typename Mapped_T> 
+Map_Node<Key_T, Mapped_T> *Map<Key_T, Mapped_T>::descend(const Key_T &key, Map_Node<Key_T, Mapped_T> **updater) const
+{
+	Map_Node<Key_T, Mapped_T> *node = head;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		MAP_STAT(Map_probe().steps++);
+		while(node -> ptrs()[x] != nullptr && keyBefore(node -> ptrs()[x], key))
+		{
+			MAP_STAT(Map_probe().steps++);
+			node = node -> ptrs()[x];
+		}
+		updater[x] = node;
+	}
+	return node -> next;
+}
+
+//Same as descend, but starts from an earlier search path, e.g. the
+//finger left by the last insert or erase. Only climbs as high as the
+//distance to key requires, so keys close to the previous one cost
+//O(log distance) instead of O(log n). finger and updater may be the
+//same array.
+template <typename Key_T, typename Mapped_T> 
+Map_Node<Key_T, Mapped_T> *Map<Key_T, Mapped_T>::fingerSearch(const Key_T &key, Map_Node<Key_T, Mapped_T> * const *finger, Map_Node<Key_T, Mapped_T> **updater) const
+{
+	int h = levels;
+	int x = 0;
+	Map_Node<Key_T, Mapped_T> *node;
+	if(finger[0] == head || keyBefore(finger[0], key))
+	{
+		//Key is ahead. Levels whose next node is already past key keep
+		//	their finger node, and that only gets more likely going up.
+		while(x < h && finger[x] -> ptrs()[x] != nullptr && keyBefore(finger[x] -> ptrs()[x], key))
+		{
+			MAP_STAT(Map_probe().steps++);
+			x++;
+		}
+		for(int y = x; y < h; y++)
+			updater[y] = finger[y];
+		if(x == 0) return finger[0] -> next;
+		node = finger[x - 1];
+		for(int y = x - 1; y >= 0; y--)
+		{
+			//The finger may already be further along on lower levels
+			if(node != finger[y] && finger[y] != head
+				&& (node == head || node -> p.value().first < finger[y] -> p.value().first))
+				node = finger[y];
+			MAP_STAT(Map_probe().steps++);
+			while(node -> ptrs()[y] != nullptr && keyBefore(node -> ptrs()[y], key))
+			{
+				MAP_STAT(Map_probe().steps++);
+				node = node -> ptrs()[y];
+			}
+			updater[y] = node;
+		}
+		return node -> next;
+	}
+	
+	//Key is behind. Climb until the finger is before key.
+	while(x < h && finger[x] != head && !keyBefore(finger[x], key))
+	{
+		MAP_STAT(Map_probe().steps++);
+		x++;
+	}
+	if(x == h) return descend(key, updater);
+	for(int y = x; y < h; y++)
+		updater[y] = finger[y];
+	node = finger[x];
+	for(int y = x - 1; y >= 0; y--)
+	{
+		MAP_STAT(Map_probe().steps++);
+		while(node -> ptrs()[y] != nullptr && keyBefore(node -> ptrs()[y], key))
+		{
+			MAP_STAT(Map_probe().steps++);
+			node = node -> ptrs()[y];
+		}
+		updater[y] = node;
+	}
+	return node -> next;
+}
+
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::setFinger(Map_Node<Key_T, Mapped_T> **path)
+{
+	//A miss on a map that never had elements
+	if(versions == nullptr) return;
+	for(unsigned int x = 0; x < levels; x++)
+		versions -> finger[x] = path[x];
+	fingerValid = true;
+}
+
+//Links ins in after updater[0] and fixes up the spans on every level.
+//Leaves the finger on ins.
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::link(Map_Node<Key_T, Mapped_T> *ins, Map_Node<Key_T, Mapped_T> **updater)
+{
+	Map_Node<Key_T, Mapped_T> *node;
+	unsigned int h = levels;
+	unsigned int newHeight = ins -> height;
+	collectVersions();
+	length++;
+
+	//Update pointers
+	int z;
+	for(unsigned int x = 0; x <= newHeight - 1; x++)
+	{
+		if(x >= h) break;
+		//Pointers
+		ins -> ptrs()[x] = updater[x] -> ptrs()[x];
+		setPtr(updater[x], x, ins);
+		//Indexes
+		z = 0;
+		if(x > 0)
+		{
+			node = updater[x];
+			//Use previous level to determine distance.
+			//Should be lg(n) as previous level should have
+			//	about lg(n) nodes between updater[x] and ins.
+			while(node != ins)
+			{
+				z += node -> indexer()[x - 1];
+				node = node -> ptrs()[x - 1];
+			}
+		}
+		else z = 1;
+		ins -> indexer()[x] = updater[x] -> indexer()[x] + 1 - z;
+		setIndex(updater[x], x, z);
+	}
+	for(unsigned int x = newHeight; x < h; x++)
+		setIndex(updater[x], x, updater[x] -> indexer()[x] + 1);
+	
+	//Iterator pointers updated
+	ins -> next = updater[0] -> next;
+	if(updater[0] -> next != tail)
+		updater[0] -> next -> prev = ins;
+	updater[0] -> next = ins;
+	ins -> prev = updater[0];
+	if(ins -> next == tail) tail -> prev = ins;
+	
+	//Readjust height of head if necessary
+	if(newHeight > h)
+	{
+		levels++;
+		setPtr(head, h, ins);
+		ins -> ptrs()[h] = nullptr;
+		
+		//Write new indexes
+		node = head;
+		z = 0;
+		while(node != nullptr)
+		{
+			z += node -> indexer()[h - 1];
+			node = node -> ptrs()[h - 1];
+			if(node == ins)
+			{
+				setIndex(head, h, z);
+				z = 0;
+			}
+			else if(node == nullptr)
+				ins -> indexer()[h] = z;
+		}	
+	}
+	
+	//Leave the finger on the new node
+	for(unsigned int x = 0; x < levels; x++)
+		versions -> finger[x] = x < newHeight ? ins : updater[x];
+	fingerValid = true;
+}
+
+
+template <typename Key_T, typename Mapped_T>
+template <typename IT_T>
+void Map<Key_T, Mapped_T>::insert(IT_T range_beg, IT_T range_end)
+{
+	//Runs of ascending keys past the current end are appended in O(1)
+	//	each, anything else goes through the normal insert.
+	while(range_beg != range_end)
+	{
+		appendRun(range_beg, range_end, [this](const IT_T &, size_t) -> unsigned int {return randomHeight(levels);});
+		if(range_beg == range_end) break;
+		insert(*range_beg);
+		++range_beg;
+	}
+}
+
+template <typename Key_T, typename Mapped_T>
+template <typename IT_T>
+void Map<Key_T, Mapped_T>::assign_sorted(IT_T range_beg, IT_T range_end)
+{
+	clear();
+	//With p = 1/2, rank r gets height 1 + (trailing zeros of r), which is
+	//	a perfectly balanced skiplist when the whole range is in order.
+	auto balanced = [this](const IT_T &, size_t rank) -> unsigned int {return levelGen.balanced(rank);};
+	while(range_beg != range_end)
+	{
+		appendRun(range_beg, range_end, balanced);
+		if(range_beg == range_end) break;
+		insert(*range_beg);
+		++range_beg;
+	}
+}
+
+//Appends elements from range_beg for as long as each key is greater
+//than the current last key, leaving range_beg at the first one that
+//isn't. Costs one walk down the rightmost towers, then O(1) per element.
+//height(it, rank) gives the tower height for the element at it.
+template <typename Key_T, typename Mapped_T>
+template <typename IT_T, typename H_T>
+void Map<Key_T, Mapped_T>::appendRun(IT_T &range_beg, IT_T range_end, H_T height)
+{
+	if(range_beg == range_end) return;
+	if(tail -> prev != head && !(tail -> prev -> p.value().first < (*range_beg).first)) return;
+	ownSentinels();
+	collectVersions();
+	
+	//Last node on every level and its rank
+	Map_Node<Key_T, Mapped_T> *last[MAP_MAX_HEIGHT];
+	size_t lastRank[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = head;
+	size_t z = 0;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		while(node -> ptrs()[x] != nullptr)
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+		last[x] = node;
+		lastRank[x] = z;
+	}
+	for(int x = levels; x < MAP_MAX_HEIGHT; x++)
+	{
+		last[x] = head;
+		lastRank[x] = 0;
+	}
+	
+	//Nodes appended here are new to every snapshot, so only the ones
+	//	ranked up to start need their old spans kept
+	size_t start = length;
+	auto setSpan = [&](unsigned int x, int z)
+	{
+		if(lastRank[x] <= start) setIndex(last[x], x, z);
+		else	last[x] -> indexer()[x] = z;
+	};
+	
+	try
+	{
+		for(; range_beg != range_end; ++range_beg)
+		{
+			if(tail -> prev != head && !(tail -> prev -> p.value().first < (*range_beg).first)) break;
+			
+			unsigned int newHeight = height(range_beg, length + 1);
+			Map_Node<Key_T, Mapped_T> *ins = newNode(newHeight, *range_beg);
+			length++;
+			if(newHeight > levels) levels = newHeight;
+			
+			for(unsigned int x = 0; x < newHeight; x++)
+			{
+				if(lastRank[x] <= start) setPtr(last[x], x, ins);
+				else	last[x] -> ptrs()[x] = ins;
+				setSpan(x, length - lastRank[x]);
+				last[x] = ins;
+				lastRank[x] = length;
+			}
+			
+			//Iterator pointers updated
+			ins -> prev = tail -> prev;
+			tail -> prev -> next = ins;
+			ins -> next = tail;
+			tail -> prev = ins;
+		}
+	}
+	catch(...)
+	{
+		for(unsigned int x = 0; x < levels; x++)
+			setSpan(x, length + 1 - lastRank[x]);
+		throw;
+	}
+	
+	//The last node on each level spans to the end
+	for(unsigned int x = 0; x < levels; x++)
+		setSpan(x, length + 1 - lastRank[x]);
+	setFinger(last);
+}
+
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::erase(const Key_T &key)
+{
+	MAP_STAT(Map_StatScope scope(eraseCounters));
+	//Determine which pointers need to be updated
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = descend(key, updater);
+
+	if(node != tail && keyIs(node, key))
+		unlink(node, updater);
+	else	throw std::out_of_range ("");
+}
+
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::erase(Iterator first, Iterator last)
+{
+	if(first == last) return last;
+	MAP_STAT(Map_StatScope scope(eraseCounters));
+	collectVersions();
+	
+	//Predecessors of first on every level
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	descend(first.ptr -> p.value().first, updater);
+	
+	//Count what is going away
+	int k = 0;
+	for(Map_Node<Key_T, Mapped_T> *node = first.ptr; node != last.ptr; node = node -> next)
+		k++;
+	
+	//On each level skip over every node in the range, adding up their
+	//	spans, then write the predecessor's pointer and span once
+	for(unsigned int x = 0; x < levels; x++)
+	{
+		Map_Node<Key_T, Mapped_T> *node = updater[x] -> ptrs()[x];
+		int z = updater[x] -> indexer()[x];
+		while(node != nullptr && node != last.ptr
+			&& (last.ptr == tail || node -> p.value().first < last.ptr -> p.value().first))
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+		setPtr(updater[x], x, node);
+		setIndex(updater[x], x, z - k);
+	}
+	
+	//Update iterator pointers
+	Map_Node<Key_T, Mapped_T> *node = first.ptr;
+	updater[0] -> next = last.ptr;
+	last.ptr -> prev = updater[0];
+	length -= k;
+	while(node != last.ptr)
+	{
+		Map_Node<Key_T, Mapped_T> *del = node;
+		node = node -> next;
+		retireNode(del);
+	}
+	
+	//Reduce height if needed
+	while(levels > 2 && head -> ptrs()[levels - 1] == nullptr)
+	{
+		levels--;
+		setIndex(head, levels, 1);
+	}
+	setFinger(updater);
+	return last;
+}
+
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::erase_at(int index)
+{
+	if(index < 0 || (size_t)index >= length) throw std::out_of_range ("");
+	
+	//Same as descend, but by rank
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = head;
+	int z = 0;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		while(node -> ptrs()[x] != nullptr && z + node -> indexer()[x] <= index)
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+		updater[x] = node;
+	}
+	unlink(node -> next, updater);
+}
+
+//Removes node, whose predecessor on every level is in updater, and
+//frees it. Leaves the finger on updater.
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::unlink(Map_Node<Key_T, Mapped_T> *node, Map_Node<Key_T, Mapped_T> **updater)
+{
+	detach(node, updater);
+	retireNode(node);
+}
+
+//Unlink without freeing the node
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::detach(Map_Node<Key_T, Mapped_T> *node, Map_Node<Key_T, Mapped_T> **updater)
+{
+	unsigned int h = levels;
+	collectVersions();
+	length--;
+	//Update pointers
+	for(unsigned int x = 0; x < h; x++)
+	{
+		int z = updater[x] -> indexer()[x] - 1;
+		if(updater[x] -> ptrs()[x] == node)
+		{
+			z += node -> indexer()[x];
+			setPtr(updater[x], x, node -> ptrs()[x]);
+		}
+		setIndex(updater[x], x, z);
+	}
+	//Update iterator pointers
+	updater[0] -> next = node -> next;
+	if(node -> next != tail)
+		node -> next -> prev = node -> prev;
+	
+	//Reduce height if needed
+	if(h - 1 > 1 && head -> ptrs()[h - 1] == nullptr)
+	{
+		levels--;
+		setIndex(head, h - 1, 1);
+	}
+
+	if(node -> next == tail) tail -> prev = node -> prev;
+	
+	setFinger(updater);
+}
+
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::erase(Iterator pos)
+{
+	MAP_STAT(Map_StatScope scope(eraseCounters));
+	Map_Node<Key_T, Mapped_T> *node = pos.ptr;
+	Map_Node<Key_T, Mapped_T> *next = node -> next;
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	pathTo(node, updater);
+	unlink(node, updater);
+	return Iterator(next, versions);
+}
+
+//Fills updater with node's predecessor on every level
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::pathTo(Map_Node<Key_T, Mapped_T> *node, Map_Node<Key_T, Mapped_T> **updater)
+{
+	//The finger is a search path, so if its bottom node is right before
+	//	node, every level of it is node's predecessor on that level
+	if(fingerValid && versions -> finger[0] -> next == node)
+		for(unsigned int x = 0; x < levels; x++)
+			updater[x] = versions -> finger[x];
+	else if(fingerValid) fingerSearch(node -> p.value().first, versions -> finger, updater);
+	else descend(node -> p.value().first, updater);
+}
+
 template <typename Key_T, typename Mapped_T> 
-Map<Key_T, Mapped_T>::Map()
+void Map<Key_T, Mapped_T>::clear()
 {
-	head = new Map_Node<Key_T, Mapped_T>();
-	tail = new Map_Node<Key_T, Mapped_T>();
+	//Already as empty as it gets, and head is not ours to write to
+	if(length == 0 && head == sharedHead()) return;
+	collectVersions();
+	//Open snapshots still need the nodes
+	if(snapshotsOpen())
+		for(Map_Node<Key_T, Mapped_T> *node = head -> next; node != tail; node = node -> next)
+			retireNode(node);
+	else	destroyNodes();
+	fingerValid = false;
+
+	for(unsigned int x = 0; x < levels; x++)
+	{
+		setPtr(head, x, nullptr);
+		setIndex(head, x, 1);
+	}
 	head -> next = tail;
 	tail -> prev = head;
 	length = 0;
 }
 
 template <typename Key_T, typename Mapped_T> 
-Map<Key_T, Mapped_T>::Map(const Map &m)
+void Map<Key_T, Mapped_T>::swap(Map &m) noexcept
 {
-	head = new Map_Node<Key_T, Mapped_T>(m.head -> getHeight());
-	tail = new Map_Node<Key_T, Mapped_T>();
-	head -> next = tail;
-	tail -> prev = head;
+	std::swap(head, m.head);
+	std::swap(tail, m.tail);
+	std::swap(length, m.length);
+	std::swap(levels, m.levels);
+	std::swap(fingerValid, m.fingerValid);
+	std::swap(levelGen, m.levelGen);
+	std::swap(versions, m.versions);
+}
+
+//Splitting and joining
+template <typename Key_T, typename Mapped_T> 
+Map<Key_T, Mapped_T> Map<Key_T, Mapped_T>::split_at_rank(size_t i)
+{
+	Map<Key_T, Mapped_T> rv(levelGen.policy());
+	if(i >= length) return rv;
+	collectVersions();
+	if(snapshotsOpen())
+	{
+		Iterator first = select((int)i);
+		rv.insert(first, end());
+		erase(first, end());
+		return rv;
+	}
+	if(i == 0)
+	{
+		//Everything goes, so trade places and keep our own level generator
+		rv.swap(*this);
+		std::swap(levelGen, rv.levelGen);
+		return rv;
+	}
 	
-	Map_Node<Key_T, Mapped_T> *mNode = m.head -> next;
-	while(mNode != m.tail)
+	//Last node ranked i or less on every level, and its rank
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	size_t pos[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = head;
+	size_t z = 0;
+	for(int x = levels - 1; x >= 0; x--)
 	{
-		insert(mNode -> p.value());
-		mNode = mNode -> next;
+		while(node -> ptrs()[x] != nullptr && z + node -> indexer()[x] <= i)
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+		updater[x] = node;
+		pos[x] = z;
 	}
 	
-	length = m.length;
+	//rv's head takes over every link that crosses the cut
+	rv.ownSentinels();
+	rv.levels = levels;
+	for(unsigned int x = 0; x < levels; x++)
+	{
+		rv.head -> ptrs()[x] = updater[x] -> ptrs()[x];
+		rv.head -> indexer()[x] = (int)(pos[x] + updater[x] -> indexer()[x] - i);
+		setPtr(updater[x], x, nullptr);
+		setIndex(updater[x], x, (int)(i + 1 - pos[x]));
+	}
+	Map_Node<Key_T, Mapped_T> *first = updater[0] -> next;
+	Map_Node<Key_T, Mapped_T> *last = tail -> prev;
+	updater[0] -> next = tail;
+	tail -> prev = updater[0];
+	rv.head -> next = first;
+	first -> prev = rv.head;
+	last -> next = rv.tail;
+	rv.tail -> prev = last;
+	rv.length = length - i;
+	length = i;
+	dropEmptyLevels();
+	rv.dropEmptyLevels();
+	fingerValid = false;
+	rv.versions -> arena.share(versions -> arena);
+	return rv;
 }
 
 template <typename Key_T, typename Mapped_T> 
-Map<Key_T, Mapped_T> &Map<Key_T, Mapped_T>::operator=(const Map &m)
+Map<Key_T, Mapped_T> Map<Key_T, Mapped_T>::split_at_key(const Key_T &key)
 {
-	clear();
-	delete head;
-	delete tail;
-	head = new Map_Node<Key_T, Mapped_T>(m.head -> getHeight());
-	tail = new Map_Node<Key_T, Mapped_T>();
-	head -> next = tail;
-	tail -> prev = head;
-	
-	Map_Node<Key_T, Mapped_T> *mNode = m.head -> next;
-	while(mNode != m.tail)
+	return split_at_rank(rank(key));
+}
+
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::join(Map &m)
+{
+	if(&m == this || m.length == 0) return;
+	bool after = length == 0 || tail -> prev -> p.value().first < m.head -> next -> p.value().first;
+	if(!after && !(m.tail -> prev -> p.value().first < head -> next -> p.value().first))
+		throw std::invalid_argument ("joined maps overlap");
+	collectVersions();
+	m.collectVersions();
+	if(snapshotsOpen() || m.snapshotsOpen())
 	{
-		insert(mNode -> p.value());
-		mNode = mNode -> next;
+		insert(m.begin(), m.end());
+		m.clear();
+		return;
 	}
-	
-	length = m.length;	
-	return *this;
+	if(after)
+	{
+		ownSentinels();
+		append(m);
+		return;
+	}
+	//m goes in front: append ourselves to m and trade places, keeping
+	//	our own level generator and versions, which then take over the
+	//	slabs
+	m.append(*this);
+	swap(m);
+	std::swap(levelGen, m.levelGen);
+	std::swap(versions, m.versions);
+	versions -> arena.swap(m.versions -> arena);
 }
 
-template <typename Key_T, typename Mapped_T>
-Map<Key_T, Mapped_T>::Map(std::initializer_list<std::pair<const Key_T, Mapped_T>> list)
+//Links every node of m in after our last one and leaves m empty. m's
+//keys must all be greater, and neither map may have open snapshots.
+template <typename Key_T, typename Mapped_T> 
+void Map<Key_T, Mapped_T>::append(Map &m)
 {
-	head = new Map_Node<Key_T, Mapped_T>();
-	tail = new Map_Node<Key_T, Mapped_T>();
-	head -> next = tail;
-	tail -> prev = head;
-	length = 0;
-	for(auto it = list.begin(); it != list.end(); ++it)
-		insert(*it);
+	unsigned int h = levels > m.levels ? levels : m.levels;
+	for(unsigned int x = levels; x < h; x++)
+	{
+		setPtr(head, x, nullptr);
+		setIndex(head, x, (int)length + 1);
+	}
+	levels = h;
+	
+	//The last node on every level now reaches m's first node on that
+	//	level, or the end. Changing level x does not disturb the walk
+	//	down level x - 1.
+	Map_Node<Key_T, Mapped_T> *node = head;
+	size_t z = 0;
+	for(int x = h - 1; x >= 0; x--)
+	{
+		while(node -> ptrs()[x] != nullptr)
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+		bool into = (unsigned int)x < m.levels;
+		setPtr(node, x, into ? m.head -> ptrs()[x] : nullptr);
+		setIndex(node, x, (int)(length + (into ? (size_t)m.head -> indexer()[x] : m.length + 1) - z));
+	}
+	
+	Map_Node<Key_T, Mapped_T> *first = m.head -> next;
+	Map_Node<Key_T, Mapped_T> *last = m.tail -> prev;
+	tail -> prev -> next = first;
+	first -> prev = tail -> prev;
+	last -> next = tail;
+	tail -> prev = last;
+	length += m.length;
+	fingerValid = false;
+	versions -> arena.share(m.versions -> arena);
+	m.versions -> arena.release();
+	
+	for(unsigned int x = 0; x < m.levels; x++)
+	{
+		m.setPtr(m.head, x, nullptr);
+		m.setIndex(m.head, x, 1);
+	}
+	m.head -> next = m.tail;
+	m.tail -> prev = m.head;
+	m.length = 0;
+	m.fingerValid = false;
 }
 
+//Lowers levels past top levels head no longer has a node on, keeping
+//the two levels erase() never goes below
 template <typename Key_T, typename Mapped_T> 
-Map<Key_T, Mapped_T>::~Map()
+void Map<Key_T, Mapped_T>::dropEmptyLevels()
 {
-	Map_Node<Key_T, Mapped_T> *del, *node = head;
-	while(node != nullptr)
+	while(levels > 2 && head -> ptrs()[levels - 1] == nullptr)
 	{
-		del = node;
-		node = node -> next;
-		delete del;
-		del = 0;
+		levels--;
+		setIndex(head, levels, 1);
 	}
 }
 
-//Size
-template <typename Key_T, typename Mapped_T>
-size_t Map<Key_T, Mapped_T>::size() const {return length;}
-
+//Node Handles
 template <typename Key_T, typename Mapped_T>
-bool Map<Key_T, Mapped_T>::empty () const
+typename Map<Key_T, Mapped_T>::NodeHandle Map<Key_T, Mapped_T>::extract(const Key_T &key)
 {
-	if(length <= 0) return true;
-	return false;
+	MAP_STAT(Map_StatScope scope(eraseCounters));
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = descend(key, updater);
+	if(node == tail || !keyIs(node, key))
+	{
+		setFinger(updater);
+		return NodeHandle();
+	}
+	return extractNode(node, updater);
 }
 
-//Iterators
 template <typename Key_T, typename Mapped_T>
-typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::begin()
+typename Map<Key_T, Mapped_T>::NodeHandle Map<Key_T, Mapped_T>::extract(Iterator pos)
 {
-	return Map<Key_T, Mapped_T>::Iterator(head -> next);
+	MAP_STAT(Map_StatScope scope(eraseCounters));
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	pathTo(pos.ptr, updater);
+	return extractNode(pos.ptr, updater);
 }
 
+//Unlinks node, whose predecessor on every level is in updater, into a
+//handle. Open snapshots get to keep node and the handle gets a copy.
 template <typename Key_T, typename Mapped_T>
-typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::end()
+typename Map<Key_T, Mapped_T>::NodeHandle Map<Key_T, Mapped_T>::extractNode(Map_Node<Key_T, Mapped_T> *node, Map_Node<Key_T, Mapped_T> **updater)
 {
-	return Map<Key_T, Mapped_T>::Iterator(tail);
+	collectVersions();
+	if(snapshotsOpen())
+	{
+		//Allocated first: it may start a pool the hold has to cover
+		Map_Node<Key_T, Mapped_T> *copy = newNode(node -> height, node -> p.value());
+		Map_Arena::Keep *k;
+		try
+		{
+			k = versions -> arena.hold();
+		}
+		catch(...)
+		{
+			deleteNode(copy);
+			throw;
+		}
+		unlink(node, updater);
+		return NodeHandle(copy, k);
+	}
+	Map_Arena::Keep *k = versions -> arena.hold();
+	detach(node, updater);
+	if(node -> hist.load(std::memory_order_relaxed) != nullptr) versions -> freeHistory(node);
+	return NodeHandle(node, k);
 }
 
+//Adds empty levels up to h, so a node from another map can be linked
+//in even when its tower is taller than link() grows the map by
 template <typename Key_T, typename Mapped_T>
-typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::begin() const
+void Map<Key_T, Mapped_T>::raiseLevels(unsigned int h)
 {
-	return Map<Key_T, Mapped_T>::ConstIterator(head -> next);
+	for(unsigned int x = levels; x < h; x++)
+	{
+		setPtr(head, x, nullptr);
+		setIndex(head, x, (int)length + 1);
+		versions -> finger[x] = head;
+	}
+	if(h > levels) levels = h;
 }
 
+//Links in ins, a node from another map or from nowhere, unless its key
+//is already here. Returns the node holding the key in that case, and
+//nullptr once ins is linked. Searches from the finger when there is one.
 template <typename Key_T, typename Mapped_T>
-typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::end() const
+Map_Node<Key_T, Mapped_T> *Map<Key_T, Mapped_T>::linkNode(Map_Node<Key_T, Mapped_T> *ins)
 {
-	return Map<Key_T, Mapped_T>::ConstIterator(tail);
+	const Key_T &key = ins -> p.value().first;
+	ownSentinels();
+	raiseLevels(ins -> height);
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	Map_Node<Key_T, Mapped_T> *node = fingerValid ? fingerSearch(key, versions -> finger, updater) : descend(key, updater);
+	if(node != tail && keyIs(node, key))
+	{
+		setFinger(updater);
+		dropEmptyLevels();
+		return node;
+	}
+	link(ins, updater);
+	return nullptr;
 }
 
 template <typename Key_T, typename Mapped_T>
-typename Map<Key_T, Mapped_T>::ReverseIterator Map<Key_T, Mapped_T>::rbegin()
+std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::insert(NodeHandle &&nh)
 {
-	return Map<Key_T, Mapped_T>::ReverseIterator(tail -> prev);
+	if(nh.empty()) return std::make_pair(end(), false);
+	MAP_STAT(Map_StatScope scope(insertCounters));
+	//Before linking, so a failure leaves nothing half done
+	ownSentinels();
+	versions -> arena.adopt(nh.keep);
+	Map_Node<Key_T, Mapped_T> *node = linkNode(nh.node);
+	if(node != nullptr) return std::make_pair(Iterator(node, versions), false);
+	node = nh.node;
+	nh.node = nullptr;
+	Map_Arena::drop(nh.keep);
+	nh.keep = nullptr;
+	return std::make_pair(Iterator(node, versions), true);
 }
 
+//Every node is detached from m and linked in here; a duplicate goes
+//straight back where it came from. m's finger then sits right before
+//the next node, so the walk over m searches nothing.
 template <typename Key_T, typename Mapped_T>
-typename Map<Key_T, Mapped_T>::ReverseIterator Map<Key_T, Mapped_T>::rend()
+void Map<Key_T, Mapped_T>::merge(Map &m)
 {
-	return Map<Key_T, Mapped_T>::ReverseIterator(head);
+	if(&m == this || m.length == 0) return;
+	MAP_STAT(Map_StatScope scope(insertCounters));
+	m.collectVersions();
+	if(m.snapshotsOpen())
+	{
+		for(Iterator it = m.begin(); it != m.end(); )
+		{
+			if(insert(*it).second) it = m.erase(it);
+			else	++it;
+		}
+		return;
+	}
+	ownSentinels();
+	versions -> arena.share(m.versions -> arena);
+	Map_Node<Key_T, Mapped_T> *updater[MAP_MAX_HEIGHT];
+	for(Map_Node<Key_T, Mapped_T> *node = m.head -> next; node != m.tail; )
+	{
+		Map_Node<Key_T, Mapped_T> *next = node -> next;
+		m.pathTo(node, updater);
+		m.detach(node, updater);
+		if(node -> hist.load(std::memory_order_relaxed) != nullptr) m.versions -> freeHistory(node);
+		if(linkNode(node) != nullptr) m.linkNode(node);
+		node = next;
+	}
 }
 
-
-//Element Access
+//Snapshots
 template <typename Key_T, typename Mapped_T> 
-typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::find(const Key_T &key)
+void Map<Key_T, Mapped_T>::save(const char *path) const
 {
-	Map_Node<Key_T, Mapped_T> *node = head;
-	for(int x = node -> getHeight() - 1; x >= 0; x--)
-		while(node -> ptrs[x] != nullptr)
-		{
-			if(node -> ptrs[x] -> p.value().first == key)
-				return Map<Key_T, Mapped_T>::Iterator(node -> ptrs[x]);
-			else if(node -> ptrs[x] -> p.value().first < key)
-				node = node -> ptrs[x];
-			else	break;
-		}
-	return end();	
+	static_assert(std::is_trivially_copyable<Key_T>::value && std::is_trivially_copyable<Mapped_T>::value,
+		"Map snapshots need trivially copyable keys and values");
+	Map_FileHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MAP_FILE_MAGIC, 8);
+	h.version = MAP_FILE_VERSION;
+	h.byteOrder = 1;
+	h.keySize = sizeof(Key_T);
+	h.mappedSize = sizeof(Mapped_T);
+	h.count = length;
+	h.keysOffset = (sizeof(h) + 63) & ~(uint64_t)63;
+	h.mappedOffset = (h.keysOffset + length * sizeof(Key_T) + 63) & ~(uint64_t)63;
+	
+	FILE *f = fopen(path, "wb");
+	if(f == nullptr) throw std::runtime_error (std::string("cannot open ") + path);
+	static const char pad[64] = {0};
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+		&& fwrite(pad, 1, h.keysOffset - sizeof(h), f) == h.keysOffset - sizeof(h);
+	for(Map_Node<Key_T, Mapped_T> *node = head -> next; ok && node != tail; node = node -> next)
+		ok = fwrite(&node -> p.value().first, sizeof(Key_T), 1, f) == 1;
+	size_t gap = h.mappedOffset - h.keysOffset - length * sizeof(Key_T);
+	ok = ok && fwrite(pad, 1, gap, f) == gap;
+	for(Map_Node<Key_T, Mapped_T> *node = head -> next; ok && node != tail; node = node -> next)
+		ok = fwrite(&node -> p.value().second, sizeof(Mapped_T), 1, f) == 1;
+	if(fclose(f) != 0) ok = false;
+	if(!ok) throw std::runtime_error (std::string("cannot write ") + path);
 }
 
 template <typename Key_T, typename Mapped_T> 
-typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::find(const Key_T &key) const
+void Map<Key_T, Mapped_T>::load(const char *path)
 {
-	Map_Node<Key_T, Mapped_T> *node = head;
-	for(int x = node -> getHeight() - 1; x >= 0; x--)
-		while(node -> ptrs[x] != nullptr)
-		{
-			if(node -> ptrs[x] -> p.value().first == key)
-				return Map<Key_T, Mapped_T>::ConstIterator(node -> ptrs[x]);
-			else if(node -> ptrs[x] -> p.value().first < key)
-				node = node -> ptrs[x];
-			else	break;
-		}
-	return end();	
+	Map_Image<Key_T, Mapped_T> img(path);
+	assign_sorted(img.begin(), img.end());
 }
 
+//Versioned snapshots
 template <typename Key_T, typename Mapped_T> 
-Mapped_T &Map<Key_T, Mapped_T>::at(const Key_T &key)
+typename Map<Key_T, Mapped_T>::Snapshot Map<Key_T, Mapped_T>::snapshot() const
 {
-	Map_Node<Key_T, Mapped_T> *node = head;
-	for(int x = node -> getHeight() - 1; x >= 0; x--)
-		while(node -> ptrs[x] != nullptr)
-		{
-			if(node -> ptrs[x] -> p.value().first == key)
-				return node -> ptrs[x] -> p.value().second;
-			else if(node -> ptrs[x] -> p.value().first < key)
-				node = node -> ptrs[x];
-			else	break;
-		}
-	throw std::out_of_range ("");
+	static_assert(std::is_copy_constructible<Mapped_T>::value, "Map snapshots need copyable values");
+	if(versions == nullptr) versions = new Map_Versions<Key_T, Mapped_T>();
+	uint64_t v = versions -> open();
+	return Snapshot(versions, head, v, length, levels);
 }
 
 template <typename Key_T, typename Mapped_T> 
-const Mapped_T &Map<Key_T, Mapped_T>::at(const Key_T &key) const
+Map<Key_T, Mapped_T>::Snapshot::Snapshot(const Snapshot &s) : ver(s.ver), head(s.head), v(s.v), length(s.length), levels(s.levels)
 {
-	Map_Node<Key_T, Mapped_T> *node = head;
-	for(int x = node -> getHeight() - 1; x >= 0; x--)
-		while(node -> ptrs[x] != nullptr)
-		{
-			if(node -> ptrs[x] -> p.value().first == key)
-				return node -> ptrs[x] -> p.value().second;
-			else if(node -> ptrs[x] -> p.value().first < key)
-				node = node -> ptrs[x];
-			else	break;
-		}
-	throw std::out_of_range ("");
+	ver -> hold(v);
 }
 
-template <typename Key_T, typename Mapped_T>
-Mapped_T &Map<Key_T, Mapped_T>::operator[] (const Key_T &key)
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::Snapshot &Map<Key_T, Mapped_T>::Snapshot::operator=(const Snapshot &s)
 {
-	try
-	{
-		return at(key);
-	}
-	catch(std::out_of_range e)
-	{
-		insert(std::make_pair(key, Mapped_T{}));
-		return at(key);
-	}
+	if(this == &s) return *this;
+	s.ver -> hold(s.v);
+	ver -> drop(v);
+	ver = s.ver;
+	head = s.head;
+	v = s.v;
+	length = s.length;
+	levels = s.levels;
+	return *this;
 }
 
-template <typename Key_T, typename Mapped_T>
-Mapped_T &Map<Key_T, Mapped_T>::get (int index)
+template <typename Key_T, typename Mapped_T> 
+Map<Key_T, Mapped_T>::Snapshot::~Snapshot()
 {
-	//Index starts from 1
-	index++;
-	if(index <= 0) throw std::out_of_range ("");
-	
-	Map_Node<Key_T, Mapped_T> *node = head;
-	int z = 0;	
-	for(int x = node -> getHeight() - 1; x >= 0; x--)
-		while(node -> ptrs[x] != nullptr)
-		{
-			z += node -> indexer[x];
-			if(z  == index)
-				return node -> ptrs[x] -> p.value().second;
-			else if(z < index)
-				node = node -> ptrs[x];
-			else	
-			{
-				z -= node -> indexer[x];
-				break;
-			}
-		}
-	throw std::out_of_range ("");
+	ver -> drop(v);
 }
 
-//Modifiers
 template <typename Key_T, typename Mapped_T> 
-std::pair<typename Map<Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::insert(const std::pair<Key_T, Mapped_T> &in)
+Map_Node<Key_T, Mapped_T> *Map<Key_T, Mapped_T>::Snapshot::before(const Key_T &key) const
 {
 	Map_Node<Key_T, Mapped_T> *node = head;
-	unsigned int h = node -> getHeight();
-	//assert(h > 0); //Very bad
-
-	//Determine which pointers need to be updated
-	std::vector<Map_Node<Key_T, Mapped_T> *> updater(h);
-	for(int x = h - 1; x >= 0; x--)
-	{
-		while(node -> ptrs[x] != nullptr && node -> ptrs[x] -> p.value().first < in.first)
-			node = node -> ptrs[x];
-		updater[x] = node;
-	}
-
-	//Return false if duplicate
-	if(node -> next != tail && node -> next -> p.value().first == in.first)	
-		return std::make_pair<Map<Key_T, Mapped_T>::Iterator, bool>(Map<Key_T, Mapped_T>::Iterator(node -> next), false);
-	
-	//Determine random height
-	unsigned int newHeight = 1;
-	while(true)
-	{
-		if(newHeight > h) break; //newHeight = h + 1
-		if(rand() % 2 == 1) newHeight++;
-		else	break;
-	}
-	
-	//Create new node
-	Map_Node<Key_T, Mapped_T> *ins = new Map_Node<Key_T, Mapped_T>(in, newHeight);
-	length++;
-
-	//Update pointers
-	int z;
-	for(unsigned int x = 0; x <= newHeight - 1; x++)
-	{
-		if(x >= updater.size()) break;
-		//Pointers
-		ins -> ptrs[x] = updater[x] -> ptrs[x];
-		updater[x] -> ptrs[x] = ins;
-		//Indexes
-		z = 0;
-		if(x > 0)
-		{
-			node = updater[x];
-			//Use previous level to determine distance.
-			//Should be lg(n) as previous level should have
-			//	about lg(n) nodes between updater[x] and ins.
-			while(node != ins)
-			{
-				z += node -> indexer[x - 1];
-				node = node -> ptrs[x - 1];
-			}
-		}
-		else z = 1;
-		ins -> indexer[x] = updater[x] -> indexer[x] + 1 - z;
-		updater[x] -> indexer[x] = z;
-	}
-	for(unsigned int x = newHeight; x < h; x++)
-		updater[x] -> indexer[x]++;
-	
-	//Iterator pointers updated
-	ins -> next = updater[0] -> next;
-	if(updater[0] -> next != tail)
-		updater[0] -> next -> prev = ins;
-	updater[0] -> next = ins;
-	ins -> prev = updater[0];
-	if(ins -> next == tail) tail -> prev = ins;
-	
-	//Readjust height of head if necessary
-	if(newHeight > h)
+	for(int x = levels - 1; x >= 0; x--)
 	{
-		head -> ptrs.push_back(ins);
-		ins -> ptrs[h] = nullptr;
-		
-		//Write new indexes
-		node = head;
-		z = 0;
-		while(node != nullptr)
-		{
-			z += node -> indexer[h - 1];
-			node = node -> ptrs[h - 1];
-			if(node == ins)
-			{
-				head -> indexer.push_back(z);
-				z = 0;
-			}
-			else if(node == nullptr)
-				ins -> indexer[h] = z;
-		}	
+		Map_Node<Key_T, Mapped_T> *n;
+		while((n = next(node, x)) != nullptr && n -> p.value().first < key)
+			node = n;
 	}
-
-	return std::make_pair<Map<Key_T, Mapped_T>::Iterator, bool>(ins, true);
+	return node;
 }
 
-template <typename Key_T, typename Mapped_T>
-template <typename IT_T>
-void Map<Key_T, Mapped_T>::insert(IT_T range_beg, IT_T range_end)
+template <typename Key_T, typename Mapped_T> 
+typename Map<Key_T, Mapped_T>::Snapshot::Iterator Map<Key_T, Mapped_T>::Snapshot::find(const Key_T &key) const
 {
-	for(range_beg; range_beg != range_end; range_beg++)
-		insert(*range_beg);
+	Map_Node<Key_T, Mapped_T> *node = next(before(key), 0);
+	if(node != nullptr && node -> p.value().first == key) return Iterator(this, node);
+	return end();
 }
 
 template <typename Key_T, typename Mapped_T> 
-void Map<Key_T, Mapped_T>::erase(const Key_T &key)
-{	
-	Map_Node<Key_T, Mapped_T> *node = head;
-	unsigned int h = node -> getHeight();
-	//assert(h > 0); //Very bad
-
-	//Determine which pointers need to be updated
-	std::vector<Map_Node<Key_T, Mapped_T> *> updater(h);
-	for(int x = h - 1; x >= 0; x--)
-	{
-		while(node -> ptrs[x] != nullptr && node -> ptrs[x] -> p.value().first < key)
-			node = node -> ptrs[x];
-		updater[x] = node;
-	}
-
-	//printf("%d	%d\n", node -> next -> p.value().first, key);
-	if(node -> next != tail && node -> next -> p.value().first == key)
-	{
-		length--;
-		node = node -> next;
-		//Update pointers
-		for(int x = 0; x < h; x++)
-		{
-			updater[x] -> indexer[x]--;
-			if(updater[x] -> ptrs[x] != node)
-				continue;
-			updater[x] -> indexer[x] += node -> indexer[x];
-			updater[x] -> ptrs[x] = node -> ptrs[x];
-		}
-		//Update iterator pointers
-		updater[0] -> next = node -> next;
-		if(node -> next != tail)
-			node -> next -> prev = node -> prev;
-		
-		//Reduce height if needed
-		if(h - 1 > 1 && head -> ptrs[h - 1] == nullptr)
-		{
-			head -> ptrs.pop_back();
-			head -> indexer.pop_back();
-		}
-	
-		if(node -> next == tail) tail -> prev = node -> prev;
-		
-		delete node;
-		node = 0;
-	}
-	else	throw std::out_of_range ("");
+Mapped_T Map<Key_T, Mapped_T>::Snapshot::at(const Key_T &key) const
+{
+	Iterator it = find(key);
+	if(it == end()) throw std::out_of_range ("");
+	return it.value();
 }
 
 template <typename Key_T, typename Mapped_T> 
-void Map<Key_T, Mapped_T>::erase(Iterator pos)
+Mapped_T Map<Key_T, Mapped_T>::Snapshot::get(int index) const
 {
-	erase((*pos).first);
+	if(index < 0 || (size_t)index >= length) throw std::out_of_range ("");
+	//Same walk as nodeAt
+	index++;
+	Map_Node<Key_T, Mapped_T> *node = head;
+	int z = 0;
+	for(int x = levels - 1; x >= 0; x--)
+		for(Map_Node<Key_T, Mapped_T> *n = next(node, x); n != nullptr && z + span(node, x) <= index; n = next(node, x))
+		{
+			z += span(node, x);
+			node = n;
+			if(z == index) return ver -> readValue(node, v);
+		}
+	throw std::out_of_range ("");
 }
 
 template <typename Key_T, typename Mapped_T> 
-void Map<Key_T, Mapped_T>::clear()
+size_t Map<Key_T, Mapped_T>::Snapshot::rank(const Key_T &key) const
 {
-	Map_Node<Key_T, Mapped_T> *del, *node = head -> next;
-	if(node != tail)
+	const Map_Node<Key_T, Mapped_T> *node = head;
+	size_t z = 0;
+	for(int x = levels - 1; x >= 0; x--)
 	{
-		do
+		Map_Node<Key_T, Mapped_T> *n;
+		while((n = next(node, x)) != nullptr && n -> p.value().first < key)
 		{
-			del = node;
-			if(node -> next != tail)
-				node = node -> next;
-			delete del;
-		} while(del != node && node != tail);
+			z += span(node, x);
+			node = n;
+		}
 	}
+	return z;
+}
 
-	for(unsigned int x = 0; x < head -> getHeight(); x++)
-	{
-		head -> ptrs[x] = nullptr;
-		head -> indexer[x] = 1;
-	}
-	head -> next = tail;
-	tail -> prev = head;
-	length = 0;
+//At most one level above the current head
+template <typename Key_T, typename Mapped_T> 
+unsigned int Map<Key_T, Mapped_T>::randomHeight(unsigned int h)
+{
+	return levelGen.next(h + 1);
 }
 
 //Comparison
@@ -0,0 +1,394 @@
+//Benchmarks cs540::Map against std::map and std::unordered_map.
+//
+//	g++ -std=c++14 -O2 MapBench.cpp -o MapBench
+//	./MapBench [sizes=1e3,1e4,1e5,1e6] [keys=int,u64,string]
+//		[patterns=seq,nearly,uniform,zipf] [containers=map,std_map,unordered_map]
+//		[ops=insert,hint,find,index,get,iterate,copy,erase] [reps=3] [format=json|csv]
+//
+//Every argument is optional and lists take any subset. Sizes may be
+//written as 1e8 etc. One result is printed per line, either a JSON
+//object or a CSV row, with the median of reps runs in nanoseconds per
+//operation. Every run builds its container from scratch.
+//
+//insert and erase touch every key once, in ascending order for seq,
+//ascending with 1% of the keys moved up to 64 places for nearly, and
+//shuffled otherwise. hint inserts in the same order into a second
+//container, passing the position after the previous insert as the hint.
+//find, index (operator[] on present keys) and get make size accesses
+//drawn from the pattern, which for nearly are in insertion order like
+//seq. zipf is scrambled Zipfian with theta 0.99, so the hot keys are
+//spread over the key range. get(int) only exists on cs540::Map.
+//iterate walks the whole container and copy copy-constructs it, both
+//counted per element.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <random>
+#include "Map.hpp"
+
+//Keeps the optimizer from dropping lookups whose results go unused
+static volatile uint64_t sink;
+
+//Key i of n. Keys ascend with i, and odd numbers (or the digits
+//between) are never present.
+static void makeKey(size_t i, int &k) {k = (int)(2 * i);}
+static void makeKey(size_t i, uint64_t &k) {k = 2 * (uint64_t)i * 0x10001;}
+static void makeKey(size_t i, std::string &k)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "key:%012zu", 2 * i);
+	k = buf;
+}
+
+//Scrambled Zipfian ranks in [0, n), after Gray et al.'s generator as
+//used by YCSB. Setting up costs O(n) for the zeta sum.
+class Zipf
+{
+	public:
+		Zipf(uint64_t count, double th = 0.99) : n(count), theta(th)
+		{
+			zetan = zeta(n);
+			alpha = 1 / (1 - theta);
+			eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta(2) / zetan);
+		}
+
+		template <typename R_T>
+		uint64_t operator()(R_T &rng)
+		{
+			double u = std::uniform_real_distribution<double>(0, 1)(rng);
+			double uz = u * zetan;
+			uint64_t rank;
+			if(uz < 1) rank = 0;
+			else if(uz < 1 + std::pow(0.5, theta)) rank = 1;
+			else rank = (uint64_t)(n * std::pow(eta * u - eta + 1, alpha));
+			if(rank >= n) rank = n - 1;
+			return (rank * 0x9E3779B97F4A7C15ull) % n;
+		}
+
+	private:
+		uint64_t n;
+		double theta, zetan, alpha, eta;
+
+		double zeta(uint64_t m) const
+		{
+			double sum = 0;
+			for(uint64_t x = 1; x <= m; x++)
+				sum += 1 / std::pow((double)x, theta);
+			return sum;
+		}
+};
+
+//Index orders for one size and pattern, made before any timing
+struct Workload
+{
+	//Every index once, for insert and erase
+	std::vector<uint32_t> each;
+	//size draws, for find, index and get
+	std::vector<uint32_t> draws;
+};
+
+static Workload makeWorkload(size_t n, const std::string &pattern, unsigned int seed)
+{
+	Workload w;
+	std::mt19937_64 rng(seed);
+	w.each.resize(n);
+	for(size_t x = 0; x < n; x++)
+		w.each[x] = (uint32_t)x;
+	if(pattern == "nearly")
+	{
+		std::uniform_int_distribution<size_t> pick(0, n - 1), by(1, 64);
+		for(size_t x = 0; x < n / 100; x++)
+		{
+			size_t from = pick(rng);
+			size_t to = std::min(from + by(rng), n - 1);
+			std::swap(w.each[from], w.each[to]);
+		}
+	}
+	else if(pattern != "seq")
+		std::shuffle(w.each.begin(), w.each.end(), rng);
+
+	w.draws.resize(n);
+	if(pattern == "seq" || pattern == "nearly")
+		w.draws = w.each;
+	else if(pattern == "uniform")
+	{
+		std::uniform_int_distribution<uint32_t> pick(0, (uint32_t)(n - 1));
+		for(size_t x = 0; x < n; x++)
+			w.draws[x] = pick(rng);
+	}
+	else
+	{
+		Zipf pick(n);
+		for(size_t x = 0; x < n; x++)
+			w.draws[x] = (uint32_t)pick(rng);
+	}
+	return w;
+}
+
+//get(int) is cs540::Map only
+template <typename M_T>
+static bool hasGet(const M_T &) {return false;}
+template <typename K_T>
+static bool hasGet(const cs540::Map<K_T, uint64_t> &) {return true;}
+
+template <typename M_T>
+static uint64_t getAll(M_T &, const std::vector<uint32_t> &) {return 0;}
+template <typename K_T>
+static uint64_t getAll(cs540::Map<K_T, uint64_t> &m, const std::vector<uint32_t> &at)
+{
+	uint64_t sum = 0;
+	for(size_t x = 0; x < at.size(); x++)
+		sum += m.get((int)at[x]);
+	return sum;
+}
+
+//Nanoseconds per op of one run of every requested operation
+struct Timings
+{
+	std::map<std::string, double> ns;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double nsPer(Clock::time_point start, size_t ops)
+{
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (ops == 0 ? 1 : ops);
+}
+
+template <typename M_T, typename K_T>
+static Timings runOnce(const std::vector<K_T> &keys, const Workload &w, const std::vector<std::string> &ops)
+{
+	auto wants = [&ops](const char *op) {return std::find(ops.begin(), ops.end(), op) != ops.end();};
+	Timings t;
+	size_t n = keys.size();
+	uint64_t sum = 0;
+	M_T m;
+
+	//Always needed to have something to measure the rest on
+	Clock::time_point start = Clock::now();
+	for(size_t x = 0; x < n; x++)
+		m.insert(std::make_pair(keys[w.each[x]], (uint64_t)x));
+	if(wants("insert")) t.ns["insert"] = nsPer(start, n);
+
+	if(wants("hint"))
+	{
+		start = Clock::now();
+		M_T h;
+		auto it = h.end();
+		for(size_t x = 0; x < n; x++)
+		{
+			it = h.insert(it, std::make_pair(keys[w.each[x]], (uint64_t)x));
+			++it;
+		}
+		t.ns["hint"] = nsPer(start, n);
+	}
+
+	if(wants("find"))
+	{
+		start = Clock::now();
+		for(size_t x = 0; x < n; x++)
+		{
+			auto it = m.find(keys[w.draws[x]]);
+			if(it != m.end()) sum += it -> second;
+		}
+		t.ns["find"] = nsPer(start, n);
+	}
+	if(wants("index"))
+	{
+		start = Clock::now();
+		for(size_t x = 0; x < n; x++)
+			m[keys[w.draws[x]]] += x;
+		t.ns["index"] = nsPer(start, n);
+	}
+	if(wants("get") && hasGet(m))
+	{
+		start = Clock::now();
+		sum += getAll(m, w.draws);
+		t.ns["get"] = nsPer(start, n);
+	}
+	if(wants("iterate"))
+	{
+		start = Clock::now();
+		for(auto it = m.begin(); it != m.end(); ++it)
+			sum += it -> second;
+		t.ns["iterate"] = nsPer(start, n);
+	}
+	if(wants("copy") || wants("erase"))
+	{
+		start = Clock::now();
+		M_T c(m);
+		if(wants("copy")) t.ns["copy"] = nsPer(start, n);
+		if(wants("erase"))
+		{
+			start = Clock::now();
+			for(size_t x = 0; x < n; x++)
+				c.erase(keys[w.each[x]]);
+			t.ns["erase"] = nsPer(start, n);
+		}
+	}
+	sink = sink + sum;
+	return t;
+}
+
+struct Options
+{
+	std::vector<size_t> sizes;
+	std::vector<std::string> keys, patterns, containers, ops;
+	int reps;
+	bool csv;
+};
+
+static void report(const Options &opt, const char *container, const char *key, size_t n, const std::string &pattern, std::vector<Timings> &runs)
+{
+	for(size_t o = 0; o < opt.ops.size(); o++)
+	{
+		const std::string &op = opt.ops[o];
+		std::vector<double> v;
+		for(size_t r = 0; r < runs.size(); r++)
+			if(runs[r].ns.count(op)) v.push_back(runs[r].ns[op]);
+		if(v.empty()) continue;
+		std::sort(v.begin(), v.end());
+		double median = v[v.size() / 2];
+		if(opt.csv)
+			printf("%s,%s,%zu,%s,%s,%zu,%.3f,%.3f\n", container, key, n, pattern.c_str(), op.c_str(), v.size(), median, v[0]);
+		else
+			printf("{\"container\":\"%s\",\"key\":\"%s\",\"size\":%zu,\"pattern\":\"%s\",\"op\":\"%s\",\"reps\":%zu,\"ns_per_op\":%.3f,\"ns_per_op_min\":%.3f}\n",
+				container, key, n, pattern.c_str(), op.c_str(), v.size(), median, v[0]);
+	}
+	fflush(stdout);
+}
+
+template <typename M_T, typename K_T>
+static void runContainer(const Options &opt, const char *container, const char *key, const std::vector<K_T> &keys, const std::string &pattern, const Workload &w)
+{
+	std::vector<Timings> runs;
+	for(int r = 0; r < opt.reps; r++)
+		runs.push_back(runOnce<M_T>(keys, w, opt.ops));
+	report(opt, container, key, keys.size(), pattern, runs);
+}
+
+template <typename K_T>
+static void runKey(const Options &opt, const char *key)
+{
+	for(size_t s = 0; s < opt.sizes.size(); s++)
+	{
+		size_t n = opt.sizes[s];
+		std::vector<K_T> keys(n);
+		for(size_t x = 0; x < n; x++)
+			makeKey(x, keys[x]);
+		for(size_t p = 0; p < opt.patterns.size(); p++)
+		{
+			const std::string &pattern = opt.patterns[p];
+			Workload w = makeWorkload(n, pattern, 12345 + (unsigned int)s);
+			for(size_t c = 0; c < opt.containers.size(); c++)
+			{
+				const std::string &name = opt.containers[c];
+				if(name == "map")
+					runContainer<cs540::Map<K_T, uint64_t>>(opt, "cs540::Map", key, keys, pattern, w);
+				else if(name == "std_map")
+					runContainer<std::map<K_T, uint64_t>>(opt, "std::map", key, keys, pattern, w);
+				else if(name == "unordered_map")
+					runContainer<std::unordered_map<K_T, uint64_t>>(opt, "std::unordered_map", key, keys, pattern, w);
+			}
+		}
+	}
+}
+
+static std::vector<std::string> split(const char *list)
+{
+	std::vector<std::string> rv;
+	std::string cur;
+	for(const char *c = list; ; c++)
+	{
+		if(*c == ',' || *c == '\0')
+		{
+			if(!cur.empty()) rv.push_back(cur);
+			cur.clear();
+			if(*c == '\0') break;
+		}
+		else cur += *c;
+	}
+	return rv;
+}
+
+static bool checkList(const char *what, const std::vector<std::string> &got, const std::vector<std::string> &known)
+{
+	for(size_t x = 0; x < got.size(); x++)
+		if(std::find(known.begin(), known.end(), got[x]) == known.end())
+		{
+			fprintf(stderr, "unknown %s: %s\n", what, got[x].c_str());
+			return false;
+		}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	opt.sizes = {1000, 10000, 100000, 1000000};
+	opt.keys = {"int", "u64", "string"};
+	opt.patterns = {"seq", "nearly", "uniform", "zipf"};
+	opt.containers = {"map", "std_map", "unordered_map"};
+	opt.ops = {"insert", "hint", "find", "index", "get", "iterate", "copy", "erase"};
+	opt.reps = 3;
+	opt.csv = false;
+	std::vector<std::string> allKeys = opt.keys, allPatterns = opt.patterns, allContainers = opt.containers, allOps = opt.ops;
+
+	for(int a = 1; a < argc; a++)
+	{
+		const char *eq = strchr(argv[a], '=');
+		if(eq == nullptr)
+		{
+			fprintf(stderr, "expected name=value, got %s\n", argv[a]);
+			return 2;
+		}
+		std::string name(argv[a], eq - argv[a]);
+		const char *value = eq + 1;
+		if(name == "sizes")
+		{
+			opt.sizes.clear();
+			std::vector<std::string> list = split(value);
+			for(size_t x = 0; x < list.size(); x++)
+			{
+				double d = strtod(list[x].c_str(), nullptr);
+				if(d < 1 || d > 1e9)
+				{
+					fprintf(stderr, "bad size: %s\n", list[x].c_str());
+					return 2;
+				}
+				opt.sizes.push_back((size_t)d);
+			}
+		}
+		else if(name == "keys") opt.keys = split(value);
+		else if(name == "patterns") opt.patterns = split(value);
+		else if(name == "containers") opt.containers = split(value);
+		else if(name == "ops") opt.ops = split(value);
+		else if(name == "reps") opt.reps = atoi(value) < 1 ? 1 : atoi(value);
+		else if(name == "format") opt.csv = strcmp(value, "csv") == 0;
+		else
+		{
+			fprintf(stderr, "unknown option: %s\n", name.c_str());
+			return 2;
+		}
+	}
+	if(!checkList("key", opt.keys, allKeys) || !checkList("pattern", opt.patterns, allPatterns)
+		|| !checkList("container", opt.containers, allContainers) || !checkList("op", opt.ops, allOps))
+		return 2;
+
+	if(opt.csv) printf("container,key,size,pattern,op,reps,ns_per_op,ns_per_op_min\n");
+	for(size_t k = 0; k < opt.keys.size(); k++)
+	{
+		if(opt.keys[k] == "int") runKey<int>(opt, "int");
+		else if(opt.keys[k] == "u64") runKey<uint64_t>(opt, "u64");
+		else runKey<std::string>(opt, "string");
+	}
+	return 0;
+}
@@ -0,0 +1,176 @@
+//Benchmarks the Map_LevelPolicy trade-off: memory against search
+//length as the level probability p changes.
+//
+//	g++ -std=c++14 -O2 MapLevelBench.cpp -o MapLevelBench
+//	./MapLevelBench [sizes=1e5,1e6] [ps=0.5,0.3679,0.25,0.125] [seed=1] [format=json|csv]
+//
+//Every argument is optional and lists take any subset. For each size
+//and p, a Map gets size keys inserted in shuffled order, then looks up
+//size keys drawn uniformly from those present. One result is printed
+//per line.
+//
+//Memory comes from arenaStats(): bytes in use and reserved per node.
+//Search length is counted by the key type itself, whose comparison
+//operators count every call find makes, one or two per node looked at
+//on the way down, averaged and at worst. ns_per_find is timed over the
+//same counting keys, so it is only good for comparing the values of p
+//with each other.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include "Map.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+//Comparisons made since the last reset
+static uint64_t compares;
+
+//A uint64_t whose comparisons are counted
+struct Key
+{
+	uint64_t v;
+
+	bool operator<(const Key &k) const
+	{
+		compares++;
+		return v < k.v;
+	}
+	bool operator==(const Key &k) const
+	{
+		compares++;
+		return v == k.v;
+	}
+};
+
+typedef cs540::Map<Key, uint64_t> Map_T;
+
+//Keeps the optimizer from dropping lookups whose results go unused
+static volatile uint64_t sink;
+
+struct Options
+{
+	std::vector<size_t> sizes;
+	std::vector<double> ps;
+	uint64_t seed;
+	bool csv;
+};
+
+static void run(const Options &opt, size_t n, double p)
+{
+	std::mt19937_64 rng(opt.seed);
+	std::vector<Key> keys(n);
+	for(size_t x = 0; x < n; x++)
+		keys[x].v = 2 * (uint64_t)x * 0x10001;
+	std::vector<Key> order(keys);
+	std::shuffle(order.begin(), order.end(), rng);
+	std::vector<Key> draws(n);
+	std::uniform_int_distribution<size_t> pick(0, n - 1);
+	for(size_t x = 0; x < n; x++)
+		draws[x] = keys[pick(rng)];
+
+	Map_T m(cs540::Map_LevelPolicy(p, cs540::MAP_MAX_HEIGHT, opt.seed));
+	for(size_t x = 0; x < n; x++)
+		m.insert(std::make_pair(order[x], (uint64_t)x));
+
+	uint64_t sum = 0, total = 0, most = 0;
+	Clock::time_point start = Clock::now();
+	for(size_t x = 0; x < n; x++)
+	{
+		compares = 0;
+		Map_T::Iterator it = m.find(draws[x]);
+		if(it != m.end()) sum += (*it).second;
+		total += compares;
+		if(compares > most) most = compares;
+	}
+	double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / n;
+	sink = sink + sum;
+
+	cs540::Map_ArenaStats s = m.arenaStats();
+	double inUse = (double)s.bytesInUse / n;
+	double reserved = (double)s.bytesReserved / n;
+	double avg = (double)total / n;
+	if(opt.csv)
+		printf("%zu,%.4f,%.1f,%.1f,%.2f,%llu,%.1f\n", n, p, inUse, reserved, avg, (unsigned long long)most, ns);
+	else
+		printf("{\"size\":%zu,\"p\":%.4f,\"bytes_in_use_per_node\":%.1f,\"bytes_reserved_per_node\":%.1f,"
+			"\"avg_compares\":%.2f,\"max_compares\":%llu,\"ns_per_find\":%.1f}\n",
+			n, p, inUse, reserved, avg, (unsigned long long)most, ns);
+	fflush(stdout);
+}
+
+//Comma separated numbers in [lo, hi], empty if any is not
+static std::vector<double> numbers(const char *list, double lo, double hi)
+{
+	std::vector<double> rv;
+	const char *c = list;
+	while(*c != '\0')
+	{
+		char *end;
+		double d = strtod(c, &end);
+		if(end == c || d < lo || d > hi) return std::vector<double>();
+		rv.push_back(d);
+		c = *end == ',' ? end + 1 : end;
+	}
+	return rv;
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	opt.sizes = {100000, 1000000};
+	opt.ps = {0.5, 0.3679, 0.25, 0.125};
+	opt.seed = 1;
+	opt.csv = false;
+
+	for(int a = 1; a < argc; a++)
+	{
+		const char *eq = strchr(argv[a], '=');
+		if(eq == nullptr)
+		{
+			fprintf(stderr, "expected name=value, got %s\n", argv[a]);
+			return 2;
+		}
+		std::string name(argv[a], eq - argv[a]);
+		const char *value = eq + 1;
+		if(name == "sizes")
+		{
+			std::vector<double> list = numbers(value, 1, 1e9);
+			if(list.empty())
+			{
+				fprintf(stderr, "bad sizes: %s\n", value);
+				return 2;
+			}
+			opt.sizes.assign(list.begin(), list.end());
+		}
+		else if(name == "ps")
+		{
+			opt.ps = numbers(value, 0, 1);
+			for(size_t x = 0; x < opt.ps.size(); x++)
+				if(opt.ps[x] <= 0 || opt.ps[x] >= 1) opt.ps.clear();
+			if(opt.ps.empty())
+			{
+				fprintf(stderr, "bad ps, each must be in (0, 1): %s\n", value);
+				return 2;
+			}
+		}
+		else if(name == "seed") opt.seed = strtoull(value, nullptr, 0);
+		else if(name == "format") opt.csv = strcmp(value, "csv") == 0;
+		else
+		{
+			fprintf(stderr, "unknown option: %s\n", name.c_str());
+			return 2;
+		}
+	}
+
+	if(opt.csv) printf("size,p,bytes_in_use_per_node,bytes_reserved_per_node,avg_compares,max_compares,ns_per_find\n");
+	for(size_t s = 0; s < opt.sizes.size(); s++)
+		for(size_t x = 0; x < opt.ps.size(); x++)
+			run(opt, opt.sizes[s], opt.ps[x]);
+	return 0;
+}
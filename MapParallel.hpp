@@ -0,0 +1,197 @@
+//Parallel ordered algorithms over Map: for_each, reduce and set operations.
+
+#ifndef MAP_PARALLEL_H
+#define MAP_PARALLEL_H
+
+#include <utility>
+#include <vector>
+#include <thread>
+#include <exception>
+#include <system_error>
+#include "Map.hpp"
+
+namespace cs540
+{
+
+//Fewest elements worth handing to a thread of their own
+const size_t MAP_PARALLEL_GRAIN = 4096;
+
+//Runs f(0) to f(chunks - 1) on one thread each, chunk 0 on the caller.
+//If a thread cannot be started, the caller runs the chunks that were
+//left without one. The first exception thrown by any chunk is rethrown
+//once all are done.
+class Map_Workers
+{
+	public:
+		//Chunks to cut n elements into, at most threads (0 for one per
+		//	core) and no smaller than MAP_PARALLEL_GRAIN
+		static unsigned int chunks(size_t n, unsigned int threads)
+		{
+			if(threads == 0) threads = std::thread::hardware_concurrency();
+			if(threads == 0) threads = 1;
+			size_t most = n / MAP_PARALLEL_GRAIN;
+			if(most < 1) most = 1;
+			return threads < most ? threads : (unsigned int)most;
+		}
+
+		template <typename F>
+		static void run(unsigned int chunks, F f)
+		{
+			std::vector<std::exception_ptr> errors(chunks);
+			auto one = [&errors, &f](unsigned int x)
+			{
+				try {f(x);}
+				catch(...) {errors[x] = std::current_exception();}
+			};
+			std::vector<std::thread> pool;
+			pool.reserve(chunks);
+			unsigned int started = 1;
+			try
+			{
+				for(; started < chunks; started++)
+					pool.emplace_back(one, started);
+			}
+			//Out of threads. The ones running still use errors and f, so
+			//	carry on here rather than unwinding past them.
+			catch(const std::system_error &) {}
+			one(0);
+			for(unsigned int x = started; x < chunks; x++)
+				one(x);
+			for(size_t x = 0; x < pool.size(); x++)
+				pool[x].join();
+			for(unsigned int x = 0; x < chunks; x++)
+				if(errors[x]) std::rethrow_exception(errors[x]);
+		}
+};
+
+//Cuts m into chunks of equal rank. Chunk x is [at[x], at[x + 1]), and
+//each cut costs one O(log n) descent along the indexer spans.
+template <typename Key_T, typename Mapped_T>
+std::vector<typename Map<Key_T, Mapped_T>::ConstIterator> Map_rankCuts(const Map<Key_T, Mapped_T> &m, unsigned int chunks)
+{
+	std::vector<typename Map<Key_T, Mapped_T>::ConstIterator> at;
+	for(unsigned int x = 0; x < chunks; x++)
+		at.push_back(x == 0 ? m.begin() : m.select(m.size() * x / chunks));
+	at.push_back(m.end());
+	return at;
+}
+
+//Calls f on every pair, chunks of the map running on their own threads.
+//Within a chunk pairs come in key order. threads = 0 means one per core.
+template <typename Key_T, typename Mapped_T, typename F>
+void parallel_for_each(const Map<Key_T, Mapped_T> &m, F f, unsigned int threads = 0)
+{
+	unsigned int chunks = Map_Workers::chunks(m.size(), threads);
+	auto at = Map_rankCuts(m, chunks);
+	Map_Workers::run(chunks, [&](unsigned int x)
+	{
+		for(auto it = at[x]; it != at[x + 1]; ++it)
+			f(*it);
+	});
+}
+
+//Folds every chunk with acc(T, pair) starting from identity, then joins
+//the chunk results left to right with join(T, T). join needs to be
+//associative but not commutative.
+template <typename Key_T, typename Mapped_T, typename T, typename Acc, typename Join>
+T parallel_reduce(const Map<Key_T, Mapped_T> &m, T identity, Acc acc, Join join, unsigned int threads = 0)
+{
+	unsigned int chunks = Map_Workers::chunks(m.size(), threads);
+	auto at = Map_rankCuts(m, chunks);
+	std::vector<T> part(chunks, identity);
+	Map_Workers::run(chunks, [&](unsigned int x)
+	{
+		for(auto it = at[x]; it != at[x + 1]; ++it)
+			part[x] = acc(std::move(part[x]), *it);
+	});
+	T rv = std::move(part[0]);
+	for(unsigned int x = 1; x < chunks; x++)
+		rv = join(std::move(rv), std::move(part[x]));
+	return rv;
+}
+
+//Shared by the set operations. The larger map is cut by rank and the
+//other one at the same keys, every chunk pair is merged on its own
+//thread into a sorted run, and the runs are appended to the result in
+//order, which is Map's linear bulk build. keepA, keepB and keepBoth
+//say which elements that are only in a, only in b, or in both (taken
+//from a) make it into the result.
+template <typename Key_T, typename Mapped_T>
+Map<Key_T, Mapped_T> Map_merge(const Map<Key_T, Mapped_T> &a, const Map<Key_T, Mapped_T> &b, bool keepA, bool keepB, bool keepBoth, unsigned int threads)
+{
+	typedef typename Map<Key_T, Mapped_T>::ConstIterator It;
+	const Map<Key_T, Mapped_T> &big = a.size() >= b.size() ? a : b;
+	const Map<Key_T, Mapped_T> &small = a.size() >= b.size() ? b : a;
+	unsigned int chunks = Map_Workers::chunks(a.size() + b.size(), threads);
+	std::vector<It> bigAt = Map_rankCuts(big, chunks);
+	std::vector<It> smallAt;
+	smallAt.push_back(small.begin());
+	for(unsigned int x = 1; x < chunks; x++)
+		smallAt.push_back(small.lower_bound(bigAt[x] -> first));
+	smallAt.push_back(small.end());
+	const std::vector<It> &aAt = &big == &a ? bigAt : smallAt;
+	const std::vector<It> &bAt = &big == &a ? smallAt : bigAt;
+
+	std::vector<std::vector<std::pair<Key_T, Mapped_T>>> runs(chunks);
+	Map_Workers::run(chunks, [&](unsigned int x)
+	{
+		It i = aAt[x], j = bAt[x];
+		std::vector<std::pair<Key_T, Mapped_T>> &out = runs[x];
+		while(i != aAt[x + 1] && j != bAt[x + 1])
+		{
+			if(i -> first < j -> first)
+			{
+				if(keepA) out.push_back(*i);
+				++i;
+			}
+			else if(j -> first < i -> first)
+			{
+				if(keepB) out.push_back(*j);
+				++j;
+			}
+			else
+			{
+				if(keepBoth) out.push_back(*i);
+				++i;
+				++j;
+			}
+		}
+		for(; keepA && i != aAt[x + 1]; ++i)
+			out.push_back(*i);
+		for(; keepB && j != bAt[x + 1]; ++j)
+			out.push_back(*j);
+	});
+
+	Map<Key_T, Mapped_T> rv(a.levelPolicy());
+	for(unsigned int x = 0; x < chunks; x++)
+	{
+		rv.insert(runs[x].begin(), runs[x].end());
+		std::vector<std::pair<Key_T, Mapped_T>>().swap(runs[x]);
+	}
+	return rv;
+}
+
+//Every key in a or b. Keys in both keep a's value.
+template <typename Key_T, typename Mapped_T>
+Map<Key_T, Mapped_T> merge_union(const Map<Key_T, Mapped_T> &a, const Map<Key_T, Mapped_T> &b, unsigned int threads = 0)
+{
+	return Map_merge(a, b, true, true, true, threads);
+}
+
+//Keys in both a and b, with a's values
+template <typename Key_T, typename Mapped_T>
+Map<Key_T, Mapped_T> intersection(const Map<Key_T, Mapped_T> &a, const Map<Key_T, Mapped_T> &b, unsigned int threads = 0)
+{
+	return Map_merge(a, b, false, false, true, threads);
+}
+
+//Keys in a but not in b
+template <typename Key_T, typename Mapped_T>
+Map<Key_T, Mapped_T> difference(const Map<Key_T, Mapped_T> &a, const Map<Key_T, Mapped_T> &b, unsigned int threads = 0)
+{
+	return Map_merge(a, b, true, false, false, threads);
+}
+
+}
+
+#endif
@@ -0,0 +1,458 @@
+//A Map split into key range shards, each behind its own reader-writer lock.
+
+#ifndef SHARDED_MAP_H
+#define SHARDED_MAP_H
+
+#include <utility>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+#include <experimental/optional>
+#include "Map.hpp"
+#include "ConcurrentMap.hpp"
+
+namespace cs540
+{
+
+//Threads working on different shards never touch the same lock, so
+//writes scale with the number of shards instead of queueing on one
+//mutex. Shard i holds the keys in [splits[i - 1], splits[i]).
+//
+//Lookups find their shard through a routing table of the split keys
+//that is replaced, never changed in place, when the boundaries move,
+//and old tables are reclaimed through Epoch_Domain. Each shard also
+//keeps its own bounds under its lock, so an operation that routed
+//with an old table notices and routes again.
+//
+//Anything locking more than one shard locks them in ascending order.
+//Keys and values are copied out, as in ConcurrentMap.
+template <typename Key_T, typename Mapped_T>
+class ShardedMap
+{
+	public:
+		//splits are the first keys of shards 1 to n - 1, ascending,
+		//	so there are splits.size() + 1 shards
+		explicit ShardedMap(const std::vector<Key_T> &splits);
+		ShardedMap(const ShardedMap &) = delete;
+		ShardedMap &operator=(const ShardedMap &) = delete;
+		//Not thread safe, no other thread may be using the map
+		~ShardedMap();
+
+		//Approximate while other threads are writing
+		size_t size() const;
+		bool empty() const {return size() == 0;}
+		size_t shardCount() const {return shards.size();}
+		//Elements per shard, approximate like size()
+		std::vector<size_t> shardSizes() const;
+		bool contains(const Key_T &) const;
+		//Copies the mapped value into out if key is present
+		bool find(const Key_T &, Mapped_T &out) const;
+		//False if key was already present
+		bool insert(const std::pair<Key_T, Mapped_T> &);
+		//True if key was inserted, false if it was overwritten
+		bool insert_or_assign(const Key_T &, const Mapped_T &);
+		//False if key was not present
+		bool erase(const Key_T &);
+		//Mapped value at a 0 based index over all shards. Shares every
+		//	shard up to the one holding index, so the answer is exact.
+		Mapped_T get(int) const;
+		//Number of keys less than key, exact like get()
+		size_t rank(const Key_T &) const;
+		//Calls f on every pair in key order, one shard at a time under
+		//	that shard's shared lock. Weakly consistent like
+		//	ConcurrentMap::for_each, but every key present for the whole
+		//	walk is seen exactly once, even across a rebalance.
+		//	f must not write to this map.
+		template <typename F>
+		void for_each(F f) const;
+		//Moves boundaries so every shard holds about size() / n keys.
+		//	One sweep over neighbouring pairs; a shard that cannot give
+		//	enough leaves the rest to the next call. Runs alongside
+		//	other operations, locking two shards at a time. Keys change
+		//	shards by Map::split_at_rank and Map::join, so each
+		//	boundary costs O(log n) however many keys cross it.
+		//Inserts start a sweep of their own once a shard holds SKEW
+		//	times its share, but then each insert moves at most one
+		//	boundary, so no caller pays for the whole sweep.
+		void rebalance();
+
+	private:
+		struct Shard
+		{
+			Map<Key_T, Mapped_T> map;
+			mutable std::shared_timed_mutex lock;
+			//Written under the exclusive lock, read without it by size()
+			std::atomic<size_t> count;
+			//Bounds of this shard, written under the exclusive lock.
+			//	Shard 0 has no lo and the last shard has no hi.
+			std::experimental::optional<Key_T> lo;
+			std::experimental::optional<Key_T> hi;
+			//Inserts since this shard last checked for skew
+			unsigned int sinceCheck;
+
+			Shard() : count(0), sinceCheck(0) {}
+			bool covers(const Key_T &key) const {return (!lo || !(key < *lo)) && (!hi || key < *hi);}
+		};
+
+		//Immutable routing table
+		struct Layout
+		{
+			std::vector<Key_T> splits;
+			size_t route(const Key_T &key) const {return std::upper_bound(splits.begin(), splits.end(), key) - splits.begin();}
+		};
+
+		//A shard is skewed when it holds this many times its share
+		static const size_t SKEW = 2;
+		//Shards this small are never worth moving
+		static const size_t REBALANCE_MIN = 1024;
+		//Inserts into a shard between skew checks
+		static const unsigned int CHECK_EVERY = 1024;
+
+		std::vector<Shard *> shards;
+		std::atomic<Layout *> layout;
+		//Only one rebalance at a time
+		std::mutex rebalancing;
+		//Set while inserts are working through a sweep, and the
+		//	boundary the next one moves. sweepAt is guarded by
+		//	rebalancing.
+		std::atomic<bool> sweeping;
+		size_t sweepAt;
+
+		size_t lockShard(const Key_T &, bool exclusive) const;
+		void unlockShard(size_t, bool exclusive) const;
+		void maybeRebalance(size_t);
+		size_t balance(size_t, size_t, size_t);
+		void moveUp(Shard &, Shard &, size_t);
+		void moveDown(Shard &, Shard &, size_t);
+		void setSplit(size_t, const Key_T &);
+		static void deleteLayout(void *p) {delete (Layout *)p;}
+};
+
+//Constructors
+template <typename Key_T, typename Mapped_T>
+ShardedMap<Key_T, Mapped_T>::ShardedMap(const std::vector<Key_T> &splits) : sweeping(false), sweepAt(0)
+{
+	for(size_t x = 1; x < splits.size(); x++)
+		if(!(splits[x - 1] < splits[x])) throw std::invalid_argument ("shard splits must be ascending");
+	Layout *l = new Layout();
+	l -> splits = splits;
+	layout.store(l);
+	for(size_t x = 0; x <= splits.size(); x++)
+	{
+		//Separate allocations keep the locks off each other's cache lines
+		Shard *s = new Shard();
+		if(x > 0) s -> lo = splits[x - 1];
+		if(x < splits.size()) s -> hi = splits[x];
+		shards.push_back(s);
+	}
+}
+
+template <typename Key_T, typename Mapped_T>
+ShardedMap<Key_T, Mapped_T>::~ShardedMap()
+{
+	for(size_t x = 0; x < shards.size(); x++)
+		delete shards[x];
+	delete layout.load();
+}
+
+//Size
+template <typename Key_T, typename Mapped_T>
+size_t ShardedMap<Key_T, Mapped_T>::size() const
+{
+	size_t z = 0;
+	for(size_t x = 0; x < shards.size(); x++)
+		z += shards[x] -> count.load(std::memory_order_relaxed);
+	return z;
+}
+
+template <typename Key_T, typename Mapped_T>
+std::vector<size_t> ShardedMap<Key_T, Mapped_T>::shardSizes() const
+{
+	std::vector<size_t> rv;
+	for(size_t x = 0; x < shards.size(); x++)
+		rv.push_back(shards[x] -> count.load(std::memory_order_relaxed));
+	return rv;
+}
+
+//Locks the shard holding key and returns its index
+template <typename Key_T, typename Mapped_T>
+size_t ShardedMap<Key_T, Mapped_T>::lockShard(const Key_T &key, bool exclusive) const
+{
+	for(;;)
+	{
+		size_t x;
+		{
+			//Only the table read needs to be pinned
+			Epoch_Guard guard;
+			x = layout.load(std::memory_order_acquire) -> route(key);
+		}
+		Shard *s = shards[x];
+		if(exclusive) s -> lock.lock();
+		else	s -> lock.lock_shared();
+		if(s -> covers(key)) return x;
+		//A rebalance moved the boundary since the table was read
+		unlockShard(x, exclusive);
+	}
+}
+
+template <typename Key_T, typename Mapped_T>
+void ShardedMap<Key_T, Mapped_T>::unlockShard(size_t x, bool exclusive) const
+{
+	if(exclusive) shards[x] -> lock.unlock();
+	else	shards[x] -> lock.unlock_shared();
+}
+
+//Element Access
+template <typename Key_T, typename Mapped_T>
+bool ShardedMap<Key_T, Mapped_T>::contains(const Key_T &key) const
+{
+	size_t x = lockShard(key, false);
+	const Map<Key_T, Mapped_T> &m = shards[x] -> map;
+	bool rv = m.find(key) != m.end();
+	unlockShard(x, false);
+	return rv;
+}
+
+template <typename Key_T, typename Mapped_T>
+bool ShardedMap<Key_T, Mapped_T>::find(const Key_T &key, Mapped_T &out) const
+{
+	size_t x = lockShard(key, false);
+	const Map<Key_T, Mapped_T> &m = shards[x] -> map;
+	auto it = m.find(key);
+	bool rv = it != m.end();
+	if(rv) out = it -> second;
+	unlockShard(x, false);
+	return rv;
+}
+
+template <typename Key_T, typename Mapped_T>
+Mapped_T ShardedMap<Key_T, Mapped_T>::get(int index) const
+{
+	if(index < 0) throw std::out_of_range ("");
+	//Holding every shard up to the answer keeps their boundaries and
+	//	lengths still
+	size_t z = 0, x = 0;
+	for(; x < shards.size(); x++)
+	{
+		shards[x] -> lock.lock_shared();
+		size_t n = shards[x] -> map.size();
+		if((size_t)index < z + n) break;
+		z += n;
+	}
+	if(x == shards.size())
+	{
+		for(size_t y = 0; y < shards.size(); y++)
+			shards[y] -> lock.unlock_shared();
+		throw std::out_of_range ("");
+	}
+	Mapped_T rv = shards[x] -> map.select(index - z) -> second;
+	for(size_t y = 0; y <= x; y++)
+		shards[y] -> lock.unlock_shared();
+	return rv;
+}
+
+template <typename Key_T, typename Mapped_T>
+size_t ShardedMap<Key_T, Mapped_T>::rank(const Key_T &key) const
+{
+	size_t z = 0, x = 0;
+	for(; x < shards.size(); x++)
+	{
+		shards[x] -> lock.lock_shared();
+		if(shards[x] -> covers(key))
+		{
+			z += shards[x] -> map.rank(key);
+			break;
+		}
+		z += shards[x] -> map.size();
+	}
+	for(size_t y = 0; y <= x && y < shards.size(); y++)
+		shards[y] -> lock.unlock_shared();
+	return z;
+}
+
+template <typename Key_T, typename Mapped_T>
+template <typename F>
+void ShardedMap<Key_T, Mapped_T>::for_each(F f) const
+{
+	//Each step covers [from, hi of the shard holding from) completely,
+	//	then carries on from that hi in whichever shard holds it by then
+	std::experimental::optional<Key_T> from;
+	for(;;)
+	{
+		size_t x;
+		if(from) x = lockShard(*from, false);
+		else
+		{
+			//Shard 0 always holds the smallest keys
+			x = 0;
+			shards[0] -> lock.lock_shared();
+		}
+		const Shard *s = shards[x];
+		auto it = from ? s -> map.lower_bound(*from) : s -> map.begin();
+		for(; it != s -> map.end(); ++it)
+			f(*it);
+		from = s -> hi;
+		unlockShard(x, false);
+		if(!from) return;
+	}
+}
+
+//Modifiers
+template <typename Key_T, typename Mapped_T>
+bool ShardedMap<Key_T, Mapped_T>::insert(const std::pair<Key_T, Mapped_T> &in)
+{
+	size_t x = lockShard(in.first, true);
+	Shard *s = shards[x];
+	bool rv = s -> map.insert(in).second;
+	if(rv) s -> count.store(s -> map.size(), std::memory_order_relaxed);
+	bool check = rv && ++s -> sinceCheck >= CHECK_EVERY;
+	if(check) s -> sinceCheck = 0;
+	unlockShard(x, true);
+	if(check || (rv && sweeping.load(std::memory_order_relaxed))) maybeRebalance(x);
+	return rv;
+}
+
+template <typename Key_T, typename Mapped_T>
+bool ShardedMap<Key_T, Mapped_T>::insert_or_assign(const Key_T &key, const Mapped_T &obj)
+{
+	size_t x = lockShard(key, true);
+	Shard *s = shards[x];
+	bool rv = s -> map.insert_or_assign(key, obj).second;
+	if(rv) s -> count.store(s -> map.size(), std::memory_order_relaxed);
+	bool check = rv && ++s -> sinceCheck >= CHECK_EVERY;
+	if(check) s -> sinceCheck = 0;
+	unlockShard(x, true);
+	if(check || (rv && sweeping.load(std::memory_order_relaxed))) maybeRebalance(x);
+	return rv;
+}
+
+template <typename Key_T, typename Mapped_T>
+bool ShardedMap<Key_T, Mapped_T>::erase(const Key_T &key)
+{
+	size_t x = lockShard(key, true);
+	Shard *s = shards[x];
+	auto it = s -> map.find(key);
+	bool rv = it != s -> map.end();
+	if(rv)
+	{
+		s -> map.erase(it);
+		s -> count.store(s -> map.size(), std::memory_order_relaxed);
+	}
+	unlockShard(x, true);
+	return rv;
+}
+
+//Rebalancing
+//Moves one boundary of the sweep under way, starting one if shard x is
+//skewed. The boundary is balanced against the shard counts as they are
+//now, as other inserts may have run since the last step.
+template <typename Key_T, typename Mapped_T>
+void ShardedMap<Key_T, Mapped_T>::maybeRebalance(size_t x)
+{
+	if(shards.size() < 2) return;
+	if(!sweeping.load(std::memory_order_relaxed))
+	{
+		size_t n = shards[x] -> count.load(std::memory_order_relaxed);
+		if(n < REBALANCE_MIN || n <= SKEW * (size() / shards.size())) return;
+	}
+	//Someone else is already on it
+	if(!rebalancing.try_lock()) return;
+	if(!sweeping.load(std::memory_order_relaxed))
+	{
+		sweepAt = 0;
+		sweeping.store(true, std::memory_order_relaxed);
+	}
+	size_t prefix = 0;
+	for(size_t y = 0; y < sweepAt; y++)
+		prefix += shards[y] -> count.load(std::memory_order_relaxed);
+	balance(sweepAt, size(), prefix);
+	if(++sweepAt + 1 >= shards.size()) sweeping.store(false, std::memory_order_relaxed);
+	rebalancing.unlock();
+}
+
+//Walks the boundaries left to right in one go. A sweep that inserts had
+//under way is then done.
+template <typename Key_T, typename Mapped_T>
+void ShardedMap<Key_T, Mapped_T>::rebalance()
+{
+	std::lock_guard<std::mutex> lk(rebalancing);
+	size_t total = size();
+	size_t prefix = 0;
+	for(size_t x = 0; x + 1 < shards.size(); x++)
+		prefix = balance(x, total, prefix);
+	sweeping.store(false, std::memory_order_relaxed);
+}
+
+//Everything left of boundary x should add up to (x + 1) / n of total,
+//given that the shards before x hold prefix keys; the shards either
+//side trade keys to get as close to that as they can. Returns prefix
+//with shard x added.
+template <typename Key_T, typename Mapped_T>
+size_t ShardedMap<Key_T, Mapped_T>::balance(size_t x, size_t total, size_t prefix)
+{
+	size_t n = shards.size();
+	//Not worth moving less than an eighth of a share
+	size_t slack = total / n / 8 + 1;
+	Shard *left = shards[x];
+	Shard *right = shards[x + 1];
+	left -> lock.lock();
+	right -> lock.lock();
+	size_t want = total * (x + 1) / n;
+	size_t have = prefix + left -> map.size();
+	if(have > want + slack)
+		moveUp(*left, *right, std::min(have - want, left -> map.size()));
+	else if(have + slack < want && right -> map.size() > 1)
+		//The first key left in right becomes the boundary, so keep one
+		moveDown(*left, *right, std::min(want - have, right -> map.size() - 1));
+	if(left -> hi && !(*left -> hi == layout.load(std::memory_order_relaxed) -> splits[x]))
+		setSplit(x, *left -> hi);
+	prefix += left -> map.size();
+	left -> count.store(left -> map.size(), std::memory_order_relaxed);
+	right -> count.store(right -> map.size(), std::memory_order_relaxed);
+	right -> lock.unlock();
+	left -> lock.unlock();
+	return prefix;
+}
+
+//Moves the k largest keys of left to the front of right. The nodes are
+//relinked, not copied.
+template <typename Key_T, typename Mapped_T>
+void ShardedMap<Key_T, Mapped_T>::moveUp(Shard &left, Shard &right, size_t k)
+{
+	if(k == 0) return;
+	Map<Key_T, Mapped_T> moved = left.map.split_at_rank(left.map.size() - k);
+	right.map.join(moved);
+	left.hi = right.map.begin() -> first;
+	right.lo = right.map.begin() -> first;
+}
+
+//Moves the k smallest keys of right to the end of left
+template <typename Key_T, typename Mapped_T>
+void ShardedMap<Key_T, Mapped_T>::moveDown(Shard &left, Shard &right, size_t k)
+{
+	if(k == 0) return;
+	Map<Key_T, Mapped_T> rest = right.map.split_at_rank(k);
+	left.map.join(right.map);
+	right.map.swap(rest);
+	left.hi = right.map.begin() -> first;
+	right.lo = right.map.begin() -> first;
+}
+
+//Publishes a routing table with split x replaced
+template <typename Key_T, typename Mapped_T>
+void ShardedMap<Key_T, Mapped_T>::setSplit(size_t x, const Key_T &key)
+{
+	Layout *old = layout.load(std::memory_order_relaxed);
+	Layout *l = new Layout(*old);
+	l -> splits[x] = key;
+	layout.store(l, std::memory_order_release);
+	Epoch_Domain::instance().retire(old, deleteLayout);
+}
+
+}
+
+#endif
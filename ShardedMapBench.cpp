@@ -0,0 +1,194 @@
+//Benchmarks cs540::ShardedMap under mixed reads and writes as the
+//number of shards and threads varies.
+//
+//	g++ -std=c++14 -O2 -pthread ShardedMapBench.cpp -o ShardedMapBench
+//	./ShardedMapBench [size=1e6] [shards=1,4,16,64] [threads=1,2,4,...,cores]
+//		[reads=50,90,100] [ops=2e5] [reps=3] [format=json|csv]
+//
+//Every argument is optional and lists take any subset. Every run starts
+//from a map holding size keys, the even numbers below 2 * size, split
+//into shards of equal key ranges, so half of the key range is present.
+//Each thread then makes ops operations on uniformly drawn keys of that
+//range: reads percent of them are finds, and the rest are inserts and
+//erases in equal parts, so the shards stay about the same size. Threads
+//start together and the run ends when the last one is done. One shard
+//is a Map behind a single reader-writer lock, the baseline.
+//
+//One result is printed per line with the median of reps runs in
+//operations per second over all threads, and the speedup over the first
+//thread count listed for the same shard count and mix.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include "ShardedMap.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+//Keeps the optimizer from dropping lookups whose results go unused
+static std::atomic<uint64_t> sink(0);
+
+//xorshift64, cheap enough not to show up next to the map
+struct Rng
+{
+	uint64_t state;
+	explicit Rng(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull | 1) {}
+	uint64_t operator()()
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	}
+};
+
+//Operations per second of one run
+static double runOnce(size_t n, size_t shards, int threads, int reads, size_t ops, unsigned int seed)
+{
+	std::vector<uint64_t> splits;
+	for(size_t x = 1; x < shards; x++)
+		splits.push_back(2 * n * x / shards);
+	cs540::ShardedMap<uint64_t, uint64_t> m(splits);
+	for(size_t x = 0; x < n; x++)
+		m.insert(std::make_pair(2 * x, (uint64_t)x));
+
+	std::atomic<int> ready(0);
+	std::atomic<bool> go(false);
+	std::vector<std::thread> pool;
+	for(int t = 0; t < threads; t++)
+		pool.emplace_back([&, t]()
+		{
+			Rng rng(seed * 1000 + t + 1);
+			uint64_t sum = 0;
+			ready.fetch_add(1);
+			while(!go.load(std::memory_order_acquire)) std::this_thread::yield();
+			for(size_t x = 0; x < ops; x++)
+			{
+				uint64_t r = rng();
+				uint64_t k = (r >> 8) % (2 * n);
+				int roll = (int)(r & 0xFF) * 100 / 256;
+				uint64_t v;
+				if(roll < reads)
+				{
+					if(m.find(k, v)) sum += v;
+				}
+				else if(roll & 1) m.insert(std::make_pair(k, (uint64_t)x));
+				else m.erase(k);
+			}
+			sink.fetch_add(sum, std::memory_order_relaxed);
+		});
+	while(ready.load() < threads) std::this_thread::yield();
+	Clock::time_point start = Clock::now();
+	go.store(true, std::memory_order_release);
+	for(size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+	double s = std::chrono::duration<double>(Clock::now() - start).count();
+	return threads * ops / s;
+}
+
+struct Options
+{
+	size_t size, ops;
+	std::vector<size_t> shards, threads, reads;
+	int reps;
+	bool csv;
+};
+
+static std::vector<size_t> numbers(const char *list, double lo, double hi)
+{
+	std::vector<size_t> rv;
+	const char *c = list;
+	while(*c != '\0')
+	{
+		char *end;
+		double d = strtod(c, &end);
+		if(end == c || d < lo || d > hi) return std::vector<size_t>();
+		rv.push_back((size_t)d);
+		c = *end == ',' ? end + 1 : end;
+	}
+	return rv;
+}
+
+static void run(const Options &opt)
+{
+	for(size_t sh = 0; sh < opt.shards.size(); sh++)
+		for(size_t r = 0; r < opt.reads.size(); r++)
+		{
+			double base = 0;
+			for(size_t t = 0; t < opt.threads.size(); t++)
+			{
+				std::vector<double> v;
+				for(int rep = 0; rep < opt.reps; rep++)
+					v.push_back(runOnce(opt.size, opt.shards[sh], (int)opt.threads[t], (int)opt.reads[r], opt.ops, 12345 + rep));
+				std::sort(v.begin(), v.end());
+				double median = v[v.size() / 2];
+				if(t == 0) base = median;
+				if(opt.csv)
+					printf("%zu,%zu,%zu,%zu,%zu,%d,%.0f,%.0f,%.2f\n", opt.size, opt.shards[sh], opt.threads[t], opt.reads[r], opt.ops, opt.reps,
+						median, v.back(), median / base);
+				else
+					printf("{\"size\":%zu,\"shards\":%zu,\"threads\":%zu,\"read_pct\":%zu,\"ops_per_thread\":%zu,\"reps\":%d,\"ops_per_s\":%.0f,\"ops_per_s_max\":%.0f,\"speedup\":%.2f}\n",
+						opt.size, opt.shards[sh], opt.threads[t], opt.reads[r], opt.ops, opt.reps, median, v.back(), median / base);
+				fflush(stdout);
+			}
+		}
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	opt.size = 1000000;
+	opt.ops = 200000;
+	unsigned int cores = std::thread::hardware_concurrency();
+	if(cores == 0) cores = 1;
+	for(size_t t = 1; t < cores; t *= 2)
+		opt.threads.push_back(t);
+	opt.threads.push_back(cores);
+	opt.shards = {1, 4, 16, 64};
+	opt.reads = {50, 90, 100};
+	opt.reps = 3;
+	opt.csv = false;
+
+	for(int a = 1; a < argc; a++)
+	{
+		const char *eq = strchr(argv[a], '=');
+		if(eq == nullptr)
+		{
+			fprintf(stderr, "expected name=value, got %s\n", argv[a]);
+			return 2;
+		}
+		std::string name(argv[a], eq - argv[a]);
+		const char *value = eq + 1;
+		if(name == "size" || name == "ops" || name == "shards" || name == "threads" || name == "reads")
+		{
+			std::vector<size_t> list = name == "reads" ? numbers(value, 0, 100) : numbers(value, 1, 1e9);
+			if(list.empty())
+			{
+				fprintf(stderr, "bad %s: %s\n", name.c_str(), value);
+				return 2;
+			}
+			if(name == "size") opt.size = list[0];
+			else if(name == "ops") opt.ops = list[0];
+			else if(name == "shards") opt.shards = list;
+			else if(name == "threads") opt.threads = list;
+			else opt.reads = list;
+		}
+		else if(name == "reps") opt.reps = atoi(value) < 1 ? 1 : atoi(value);
+		else if(name == "format") opt.csv = strcmp(value, "csv") == 0;
+		else
+		{
+			fprintf(stderr, "unknown option: %s\n", name.c_str());
+			return 2;
+		}
+	}
+
+	if(opt.csv) printf("size,shards,threads,read_pct,ops_per_thread,reps,ops_per_s,ops_per_s_max,speedup\n");
+	run(opt);
+	return 0;
+}
@@ -0,0 +1,422 @@
+//A Map that keeps up to N elements in an inline sorted array.
+
+#ifndef SMALL_MAP_H
+#define SMALL_MAP_H
+
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <new>
+#include <type_traits>
+#include "Map.hpp"
+
+namespace cs540
+{
+
+//Up to N elements sit in a sorted array inside the object and are
+//searched by a linear scan, so a small map allocates nothing and costs
+//about N pairs plus two words; a Map's first insert already allocates a
+//full height head, a tail and its versions. The insert that would make N + 1 elements moves the
+//array into a Map in one O(N) bulk build and from then on every call is
+//forwarded to it. The map stays large until clear(), like a vector
+//keeping its capacity, so sizes around N do not keep rebuilding.
+//
+//Iterators dereference to the same std::pair<Key_T, Mapped_T> as Map's
+//in both modes. While small, inserts and erases shift the array and
+//invalidate iterators at or after the position they touch, and the
+//switch to a Map invalidates them all.
+template <typename Key_T, typename Mapped_T, int N = 16>
+class SmallMap
+{
+	private:
+		typedef std::pair<Key_T, Mapped_T> Pair_T;
+		typedef Map<Key_T, Mapped_T> Big_T;
+
+	public:
+
+	class Iterator
+	{
+		public:
+			friend class SmallMap;
+			Iterator() = delete;
+			Iterator &operator++()
+			{
+				if(p != nullptr) ++p;
+				else ++it;
+				return *this;
+			}
+			Iterator operator++(int)
+			{
+				Iterator rv(*this);
+				++*this;
+				return rv;
+			}
+			Iterator &operator--()
+			{
+				if(p != nullptr) --p;
+				else --it;
+				return *this;
+			}
+			Iterator operator--(int)
+			{
+				Iterator rv(*this);
+				--*this;
+				return rv;
+			}
+			Pair_T &operator*() const {return p != nullptr ? *p : *it;}
+			Pair_T *operator->() const {return p != nullptr ? p : &*it;}
+
+			bool operator==(const Iterator &i) const{return p == i.p && it == i.it;}
+			bool operator!=(const Iterator &i) const{return !(*this == i);}
+
+		private:
+			Iterator(Pair_T *q) : p(q), it(nullptr) {};
+			Iterator(const typename Big_T::Iterator &i) : p(nullptr), it(i) {};
+			//Array slot while the map is small, nullptr once it is a Map
+			Pair_T *p;
+			//Points nowhere while the map is small
+			typename Big_T::Iterator it;
+	};
+
+	class ConstIterator
+	{
+		public:
+			friend class SmallMap;
+			ConstIterator() = delete;
+			ConstIterator &operator++()
+			{
+				if(p != nullptr) ++p;
+				else ++it;
+				return *this;
+			}
+			ConstIterator operator++(int)
+			{
+				ConstIterator rv(*this);
+				++*this;
+				return rv;
+			}
+			ConstIterator &operator--()
+			{
+				if(p != nullptr) --p;
+				else --it;
+				return *this;
+			}
+			ConstIterator operator--(int)
+			{
+				ConstIterator rv(*this);
+				--*this;
+				return rv;
+			}
+			const Pair_T &operator*() const {return p != nullptr ? *p : *it;}
+			const Pair_T *operator->() const {return p != nullptr ? p : &*it;}
+
+			bool operator==(const ConstIterator &i) const{return p == i.p && it == i.it;}
+			bool operator!=(const ConstIterator &i) const{return !(*this == i);}
+
+		private:
+			ConstIterator(const Pair_T *q) : p(q), it(nullptr) {};
+			ConstIterator(const typename Big_T::ConstIterator &i) : p(nullptr), it(i) {};
+			const Pair_T *p;
+			typename Big_T::ConstIterator it;
+	};
+
+		SmallMap() : count(0), big(nullptr) {}
+		SmallMap(const SmallMap &);
+		SmallMap &operator=(const SmallMap &);
+		//Steal the other map's Map or elements, leaving it empty. Only
+		//	the inline pairs are moved, so these throw only if that can.
+		SmallMap(SmallMap &&) noexcept(std::is_nothrow_move_constructible<std::pair<Key_T, Mapped_T>>::value);
+		SmallMap &operator=(SmallMap &&) noexcept(std::is_nothrow_move_constructible<std::pair<Key_T, Mapped_T>>::value);
+		~SmallMap();
+		size_t size() const {return big != nullptr ? big -> size() : count;}
+		bool empty() const {return size() == 0;}
+		//True while the elements are in the inline array
+		bool isInline() const {return big == nullptr;}
+		Iterator begin() {return big != nullptr ? Iterator(big -> begin()) : Iterator(pairs());}
+		Iterator end() {return big != nullptr ? Iterator(big -> end()) : Iterator(pairs() + count);}
+		ConstIterator begin() const {return big != nullptr ? ConstIterator(((const Big_T *)big) -> begin()) : ConstIterator(pairs());}
+		ConstIterator end() const {return big != nullptr ? ConstIterator(((const Big_T *)big) -> end()) : ConstIterator(pairs() + count);}
+		Iterator find(const Key_T &);
+		ConstIterator find(const Key_T &) const;
+		//First element not less than key
+		Iterator lower_bound(const Key_T &);
+		ConstIterator lower_bound(const Key_T &) const;
+		Mapped_T &at(const Key_T &);
+		const Mapped_T &at(const Key_T &) const;
+		Mapped_T &operator[](const Key_T &);
+		//0 based like Map::get
+		Mapped_T &get(int);
+		std::pair<Iterator, bool> insert(const std::pair<Key_T, Mapped_T> &);
+		std::pair<Iterator, bool> insert(std::pair<Key_T, Mapped_T> &&);
+		void erase(const Key_T &);
+		//Returns the element after pos
+		Iterator erase(Iterator pos);
+		//Destroys every element and goes back to the inline array
+		void clear();
+
+	private:
+		//Elements in the array, 0 once big is set
+		int count;
+		Big_T *big;
+		alignas(Pair_T) unsigned char pairBytes[N * sizeof(Pair_T)];
+
+		Pair_T *pairs() {return (Pair_T *)pairBytes;}
+		const Pair_T *pairs() const {return (const Pair_T *)pairBytes;}
+		//Number of array keys less than key
+		int countLess(const Key_T &) const;
+		bool hasAt(int, const Key_T &) const;
+		void destroyPairs();
+		void toMap();
+		template<typename P_T>
+		std::pair<Iterator, bool> insertPair(P_T &&);
+};
+
+//Constructors
+template <typename Key_T, typename Mapped_T, int N>
+SmallMap<Key_T, Mapped_T, N>::SmallMap(const SmallMap &m) : count(0), big(nullptr)
+{
+	if(m.big != nullptr)
+	{
+		big = new Big_T(*m.big);
+		return;
+	}
+	try
+	{
+		for(; count < m.count; count++)
+			new(pairs() + count) Pair_T(m.pairs()[count]);
+	}
+	catch(...)
+	{
+		destroyPairs();
+		throw;
+	}
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+SmallMap<Key_T, Mapped_T, N> &SmallMap<Key_T, Mapped_T, N>::operator=(const SmallMap &m)
+{
+	if(this != &m)
+	{
+		SmallMap copy(m);
+		*this = std::move(copy);
+	}
+	return *this;
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+SmallMap<Key_T, Mapped_T, N>::SmallMap(SmallMap &&m) noexcept(std::is_nothrow_move_constructible<std::pair<Key_T, Mapped_T>>::value)
+	: count(0), big(m.big)
+{
+	m.big = nullptr;
+	for(; count < m.count; count++)
+		new(pairs() + count) Pair_T(std::move(m.pairs()[count]));
+	m.destroyPairs();
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+SmallMap<Key_T, Mapped_T, N> &SmallMap<Key_T, Mapped_T, N>::operator=(SmallMap &&m) noexcept(std::is_nothrow_move_constructible<std::pair<Key_T, Mapped_T>>::value)
+{
+	if(this != &m)
+	{
+		clear();
+		big = m.big;
+		m.big = nullptr;
+		for(; count < m.count; count++)
+			new(pairs() + count) Pair_T(std::move(m.pairs()[count]));
+		m.destroyPairs();
+	}
+	return *this;
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+SmallMap<Key_T, Mapped_T, N>::~SmallMap()
+{
+	clear();
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+void SmallMap<Key_T, Mapped_T, N>::destroyPairs()
+{
+	while(count > 0)
+		pairs()[--count].~Pair_T();
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+void SmallMap<Key_T, Mapped_T, N>::clear()
+{
+	destroyPairs();
+	delete big;
+	big = nullptr;
+}
+
+//Array Search
+template <typename Key_T, typename Mapped_T, int N>
+int SmallMap<Key_T, Mapped_T, N>::countLess(const Key_T &key) const
+{
+	int x = 0;
+	while(x < count && pairs()[x].first < key)
+		x++;
+	return x;
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+bool SmallMap<Key_T, Mapped_T, N>::hasAt(int x, const Key_T &key) const
+{
+	return x < count && pairs()[x].first == key;
+}
+
+//Element Access
+template <typename Key_T, typename Mapped_T, int N>
+typename SmallMap<Key_T, Mapped_T, N>::Iterator SmallMap<Key_T, Mapped_T, N>::find(const Key_T &key)
+{
+	if(big != nullptr) return Iterator(big -> find(key));
+	int x = countLess(key);
+	return hasAt(x, key) ? Iterator(pairs() + x) : end();
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+typename SmallMap<Key_T, Mapped_T, N>::ConstIterator SmallMap<Key_T, Mapped_T, N>::find(const Key_T &key) const
+{
+	if(big != nullptr) return ConstIterator(((const Big_T *)big) -> find(key));
+	int x = countLess(key);
+	return hasAt(x, key) ? ConstIterator(pairs() + x) : end();
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+typename SmallMap<Key_T, Mapped_T, N>::Iterator SmallMap<Key_T, Mapped_T, N>::lower_bound(const Key_T &key)
+{
+	if(big != nullptr) return Iterator(big -> lower_bound(key));
+	return Iterator(pairs() + countLess(key));
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+typename SmallMap<Key_T, Mapped_T, N>::ConstIterator SmallMap<Key_T, Mapped_T, N>::lower_bound(const Key_T &key) const
+{
+	if(big != nullptr) return ConstIterator(((const Big_T *)big) -> lower_bound(key));
+	return ConstIterator(pairs() + countLess(key));
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+Mapped_T &SmallMap<Key_T, Mapped_T, N>::at(const Key_T &key)
+{
+	if(big != nullptr) return big -> at(key);
+	int x = countLess(key);
+	if(!hasAt(x, key)) throw std::out_of_range ("");
+	return pairs()[x].second;
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+const Mapped_T &SmallMap<Key_T, Mapped_T, N>::at(const Key_T &key) const
+{
+	if(big != nullptr) return ((const Big_T *)big) -> at(key);
+	int x = countLess(key);
+	if(!hasAt(x, key)) throw std::out_of_range ("");
+	return pairs()[x].second;
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+Mapped_T &SmallMap<Key_T, Mapped_T, N>::operator[](const Key_T &key)
+{
+	if(big != nullptr) return (*big)[key];
+	int x = countLess(key);
+	if(hasAt(x, key)) return pairs()[x].second;
+	return insertPair(Pair_T(key, Mapped_T())).first -> second;
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+Mapped_T &SmallMap<Key_T, Mapped_T, N>::get(int index)
+{
+	if(big != nullptr) return big -> get(index);
+	if(index < 0 || index >= count) throw std::out_of_range ("");
+	return pairs()[index].second;
+}
+
+//Modifiers
+template <typename Key_T, typename Mapped_T, int N>
+std::pair<typename SmallMap<Key_T, Mapped_T, N>::Iterator, bool> SmallMap<Key_T, Mapped_T, N>::insert(const std::pair<Key_T, Mapped_T> &in)
+{
+	return insertPair(in);
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+std::pair<typename SmallMap<Key_T, Mapped_T, N>::Iterator, bool> SmallMap<Key_T, Mapped_T, N>::insert(std::pair<Key_T, Mapped_T> &&in)
+{
+	return insertPair(std::move(in));
+}
+
+//Moves the array into a new Map. The array is already sorted, so this
+//is Map's linear bulk build with balanced towers.
+template <typename Key_T, typename Mapped_T, int N>
+void SmallMap<Key_T, Mapped_T, N>::toMap()
+{
+	Big_T *m = new Big_T();
+	try
+	{
+		m -> assign_sorted(std::make_move_iterator(pairs()), std::make_move_iterator(pairs() + count));
+	}
+	catch(...)
+	{
+		delete m;
+		throw;
+	}
+	destroyPairs();
+	big = m;
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+template <typename P_T>
+std::pair<typename SmallMap<Key_T, Mapped_T, N>::Iterator, bool> SmallMap<Key_T, Mapped_T, N>::insertPair(P_T &&in)
+{
+	if(big == nullptr)
+	{
+		int x = countLess(in.first);
+		if(hasAt(x, in.first)) return std::make_pair(Iterator(pairs() + x), false);
+		if(count < N)
+		{
+			if(x < count)
+			{
+				//Open a slot at x by shifting the tail up one
+				new(pairs() + count) Pair_T(std::move(pairs()[count - 1]));
+				count++;
+				std::move_backward(pairs() + x, pairs() + count - 2, pairs() + count - 1);
+				pairs()[x] = std::forward<P_T>(in);
+			}
+			else
+			{
+				new(pairs() + count) Pair_T(std::forward<P_T>(in));
+				count++;
+			}
+			return std::make_pair(Iterator(pairs() + x), true);
+		}
+		toMap();
+	}
+	std::pair<typename Big_T::Iterator, bool> rv = big -> insert(std::forward<P_T>(in));
+	return std::make_pair(Iterator(rv.first), rv.second);
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+void SmallMap<Key_T, Mapped_T, N>::erase(const Key_T &key)
+{
+	if(big != nullptr)
+	{
+		big -> erase(key);
+		return;
+	}
+	int x = countLess(key);
+	if(!hasAt(x, key)) throw std::out_of_range ("");
+	erase(Iterator(pairs() + x));
+}
+
+template <typename Key_T, typename Mapped_T, int N>
+typename SmallMap<Key_T, Mapped_T, N>::Iterator SmallMap<Key_T, Mapped_T, N>::erase(Iterator pos)
+{
+	if(big != nullptr) return Iterator(big -> erase(pos.it));
+	std::move(pos.p + 1, pairs() + count, pos.p);
+	pairs()[--count].~Pair_T();
+	return pos;
+}
+
+}
+
+#endif
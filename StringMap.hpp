@@ -0,0 +1,555 @@
+//An indexable skiplist keyed by strings, with the key bytes stored inline.
+
+#ifndef STRING_MAP_H
+#define STRING_MAP_H
+
+#include <utility>
+#include <stdexcept>
+#include <new>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include "Map.hpp"
+
+namespace cs540
+{
+
+//Length of the common prefix of a and b, which are known to agree on
+//their first from bytes and are both at least n long. Eight bytes at a
+//time, then byte by byte inside the word that differs.
+inline size_t StringMap_lcp(const char *a, const char *b, size_t from, size_t n)
+{
+	size_t x = from;
+	for(; x + 8 <= n; x += 8)
+	{
+		uint64_t u, v;
+		memcpy(&u, a + x, 8);
+		memcpy(&v, b + x, 8);
+		if(u != v) break;
+	}
+	while(x < n && a[x] == b[x])
+		x++;
+	return x;
+}
+
+//The bytes of a StringMap key, not owned. Keys are taken and handed out
+//as these; a std::string or a C string converts to one implicitly, and
+//one converts back to a std::string explicitly. Compares bytes as
+//unsigned, like the map orders them.
+class StringMap_Key
+{
+	public:
+		StringMap_Key() : ptr(nullptr), len(0) {}
+		StringMap_Key(const char *s, size_t n) : ptr(s), len(n) {}
+		StringMap_Key(const char *s) : ptr(s), len(strlen(s)) {}
+		StringMap_Key(const std::string &s) : ptr(s.data()), len(s.size()) {}
+		explicit operator std::string() const {return std::string(ptr, len);}
+
+		const char *data() const {return ptr;}
+		size_t size() const {return len;}
+		bool empty() const {return len == 0;}
+		char operator[](size_t x) const {return ptr[x];}
+
+		bool operator==(const StringMap_Key &k) const {return len == k.len && (len == 0 || memcmp(ptr, k.ptr, len) == 0);}
+		bool operator!=(const StringMap_Key &k) const {return !(*this == k);}
+		bool operator<(const StringMap_Key &k) const
+		{
+			size_t n = len < k.len ? len : k.len;
+			int c = n == 0 ? 0 : memcmp(ptr, k.ptr, n);
+			return c < 0 || (c == 0 && len < k.len);
+		}
+
+	private:
+		const char *ptr;
+		size_t len;
+};
+
+//Node of a StringMap. The tower follows the node inline like in
+//Map_Node: ptrs(), then indexer() with the same spans as Map, then
+//lcps(), where lcps()[x] is how many leading bytes this node's key
+//shares with the key of ptrs()[x]. The key bytes come last, with no
+//terminator. Head has the empty key. Aligned so ptrs() can start right
+//after it.
+template <typename Mapped_T>
+class alignas(void *) StringMap_Node
+{
+	public:
+		int height;
+		uint32_t keyLength;
+		alignas(Mapped_T) unsigned char valueBytes[sizeof(Mapped_T)];
+
+		StringMap_Node(int h, uint32_t n) : height(h), keyLength(n)
+		{
+			for(int x = 0; x < height; x++)
+			{
+				ptrs()[x] = nullptr;
+				indexer()[x] = 0;
+				lcps()[x] = 0;
+			}
+		}
+		StringMap_Node(const StringMap_Node &) = delete;
+		StringMap_Node &operator=(const StringMap_Node &) = delete;
+
+		Mapped_T &value() {return *(Mapped_T *)valueBytes;}
+		const Mapped_T &value() const {return *(const Mapped_T *)valueBytes;}
+		StringMap_Node **ptrs() {return (StringMap_Node **)(this + 1);}
+		StringMap_Node * const *ptrs() const {return (StringMap_Node * const *)(this + 1);}
+		int *indexer() {return (int *)(ptrs() + height);}
+		const int *indexer() const {return (const int *)(ptrs() + height);}
+		uint32_t *lcps() {return (uint32_t *)(indexer() + height);}
+		const uint32_t *lcps() const {return (const uint32_t *)(indexer() + height);}
+		char *key() {return (char *)(lcps() + height);}
+		const char *key() const {return (const char *)(lcps() + height);}
+
+		//Bytes needed for a node, its tower and a key of n bytes
+		static size_t bytes(int h, size_t n) {return sizeof(StringMap_Node) + h * (sizeof(StringMap_Node *) + sizeof(int) + sizeof(uint32_t)) + n;}
+};
+
+//Map's skiplist specialised for string keys. Each node carries its key
+//bytes after the tower instead of a std::string, so an entry costs no
+//string header and no second heap block, and nodes come from the arena
+//in 16 byte size classes. Keys over about 500 bytes make nodes too big
+//for the largest class and those nodes are allocated on their own.
+//
+//Every tower level also records the common prefix of the two keys it
+//links. The descent tracks how much of the search key the current node
+//matches, and a hop whose recorded prefix differs from that is decided
+//without reading either key; otherwise the compare resumes past the
+//bytes already matched. A search reads each byte of the key about once
+//instead of once per comparison, which pays off on keys like URLs and
+//paths that share long prefixes.
+//
+//Keys are taken and handed out as StringMap_Keys; a std::string
+//converts to one implicitly. Keys longer than 4 GiB are rejected.
+template <typename Mapped_T>
+class StringMap
+{
+	public:
+		typedef StringMap_Key Key_T;
+
+	private:
+		typedef StringMap_Node<Mapped_T> Node;
+
+	public:
+
+	class Iterator
+	{
+		public:
+			friend class StringMap;
+			Iterator() = delete;
+			Iterator &operator++()
+			{
+				node = node -> ptrs()[0];
+				return *this;
+			}
+			Iterator operator++(int)
+			{
+				Iterator rv(*this);
+				node = node -> ptrs()[0];
+				return rv;
+			}
+			Key_T key() const {return Key_T(node -> key(), node -> keyLength);}
+			Mapped_T &value() const {return node -> value();}
+			std::pair<Key_T, Mapped_T &> operator*() const {return std::pair<Key_T, Mapped_T &>(key(), value());}
+
+			bool operator==(const Iterator &it) const{return node == it.node;}
+			bool operator!=(const Iterator &it) const{return node != it.node;}
+
+		private:
+			Iterator(Node *n) : node(n) {};
+			//nullptr at the end
+			Node *node;
+	};
+
+	class ConstIterator
+	{
+		public:
+			friend class StringMap;
+			ConstIterator() = delete;
+			ConstIterator(const Iterator &it) : node(it.node) {};
+			ConstIterator &operator++()
+			{
+				node = node -> ptrs()[0];
+				return *this;
+			}
+			ConstIterator operator++(int)
+			{
+				ConstIterator rv(*this);
+				node = node -> ptrs()[0];
+				return rv;
+			}
+			Key_T key() const {return Key_T(node -> key(), node -> keyLength);}
+			const Mapped_T &value() const {return node -> value();}
+			std::pair<Key_T, const Mapped_T &> operator*() const {return std::pair<Key_T, const Mapped_T &>(key(), value());}
+
+			bool operator==(const ConstIterator &it) const{return node == it.node;}
+			bool operator!=(const ConstIterator &it) const{return node != it.node;}
+
+		private:
+			ConstIterator(const Node *n) : node(n) {};
+			//nullptr at the end
+			const Node *node;
+	};
+
+		explicit StringMap(const Map_LevelPolicy &pol = Map_LevelPolicy());
+		StringMap(const StringMap &) = delete;
+		StringMap &operator=(const StringMap &) = delete;
+		~StringMap();
+		size_t size() const {return length;}
+		bool empty() const {return length == 0;}
+		Iterator begin() {return Iterator(head -> ptrs()[0]);}
+		Iterator end() {return Iterator(nullptr);}
+		ConstIterator begin() const {return ConstIterator(head -> ptrs()[0]);}
+		ConstIterator end() const {return ConstIterator(nullptr);}
+		Iterator find(Key_T);
+		ConstIterator find(Key_T) const;
+		Mapped_T &at(Key_T);
+		const Mapped_T &at(Key_T) const;
+		Mapped_T &operator[](Key_T);
+		//0 based like Map::get
+		Mapped_T &get(int);
+		const Mapped_T &get(int) const;
+		//Number of keys less than key
+		size_t rank(Key_T) const;
+		std::pair<Iterator, bool> insert(Key_T, const Mapped_T &);
+		std::pair<Iterator, bool> insert(const std::pair<Key_T, Mapped_T> &in) {return insert(in.first, in.second);}
+		void erase(Key_T);
+		void clear();
+
+		//Nodes and bytes held, as for Map::arenaStats. Nodes too big for
+		//	the arena count as one slab each.
+		Map_ArenaStats arenaStats() const;
+
+	private:
+		//Size class step; class c holds nodes of up to (c + 1) * STEP bytes
+		static const size_t STEP = 16;
+
+		//Where the search for a key left each level: the last node
+		//before it, that node's rank, and how many leading bytes the key
+		//shares with that node and with the node after it
+		struct Path
+		{
+			Node *updater[MAP_MAX_HEIGHT];
+			size_t pos[MAP_MAX_HEIGHT];
+			uint32_t predLcp[MAP_MAX_HEIGHT];
+			uint32_t nextLcp[MAP_MAX_HEIGHT];
+		};
+
+		Node *head;
+		size_t length;
+		unsigned int levels;
+		Map_Arena arena;
+		Map_LevelGen levelGen;
+		//Nodes past the largest size class and their bytes
+		size_t bigNodes;
+		size_t bigBytes;
+
+		Node *newNode(int, Key_T);
+		void deleteNode(Node *);
+		void destroyNodes();
+		void initHead();
+		Node *descend(Key_T, Path &) const;
+		Node *findNode(Key_T) const;
+		Node *nodeAt(size_t) const;
+		void link(Node *, Path &);
+};
+
+//Constructors
+template <typename Mapped_T>
+StringMap<Mapped_T>::StringMap(const Map_LevelPolicy &pol) : levelGen(pol), bigNodes(0), bigBytes(0)
+{
+	initHead();
+}
+
+template <typename Mapped_T>
+StringMap<Mapped_T>::~StringMap()
+{
+	destroyNodes();
+}
+
+//Node Allocation
+//Copies key into a new node; the value is left for the caller
+template <typename Mapped_T>
+typename StringMap<Mapped_T>::Node *StringMap<Mapped_T>::newNode(int h, Key_T key)
+{
+	if(key.size() > UINT32_MAX) throw std::invalid_argument ("");
+	size_t bytes = Node::bytes(h, key.size());
+	size_t c = (bytes + STEP - 1) / STEP - 1;
+	void *mem;
+	if(c <= MAP_MAX_HEIGHT) mem = arena.allocate((c + 1) * STEP, alignof(Node), (int)c);
+	else
+	{
+		mem = ::operator new(bytes);
+		bigNodes++;
+		bigBytes += bytes;
+	}
+	Node *node = new(mem) Node(h, (uint32_t)key.size());
+	if(!key.empty()) memcpy(node -> key(), key.data(), key.size());
+	return node;
+}
+
+//Frees the node; the value must already be gone
+template <typename Mapped_T>
+void StringMap<Mapped_T>::deleteNode(Node *node)
+{
+	size_t bytes = Node::bytes(node -> height, node -> keyLength);
+	size_t c = (bytes + STEP - 1) / STEP - 1;
+	node -> ~Node();
+	if(c <= MAP_MAX_HEIGHT) arena.deallocate(node, (c + 1) * STEP, (int)c);
+	else
+	{
+		::operator delete(node);
+		bigNodes--;
+		bigBytes -= bytes;
+	}
+}
+
+template <typename Mapped_T>
+void StringMap<Mapped_T>::destroyNodes()
+{
+	Node *node = head -> ptrs()[0];
+	while(node != nullptr)
+	{
+		Node *next = node -> ptrs()[0];
+		node -> value().~Mapped_T();
+		deleteNode(node);
+		node = next;
+	}
+	deleteNode(head);
+	arena.release();
+}
+
+template <typename Mapped_T>
+void StringMap<Mapped_T>::initHead()
+{
+	head = newNode(MAP_MAX_HEIGHT, Key_T());
+	length = 0;
+	levels = 1;
+	head -> indexer()[0] = 1;
+}
+
+template <typename Mapped_T>
+void StringMap<Mapped_T>::clear()
+{
+	destroyNodes();
+	initHead();
+}
+
+template <typename Mapped_T>
+Map_ArenaStats StringMap<Mapped_T>::arenaStats() const
+{
+	Map_ArenaStats rv = arena.stats();
+	rv.nodes += bigNodes;
+	rv.slabs += bigNodes;
+	rv.bytesReserved += bigBytes;
+	rv.bytesInUse += bigBytes;
+	return rv;
+}
+
+//Fills path for key and returns the first node not before it, or
+//nullptr. l is how much of key the current node matches, and node is
+//always before key. A next node that shares more than l bytes with
+//node differs from key where node does, so it is before key too; one
+//that shares fewer differs from node where key still matches, so it is
+//after key. Only when it shares exactly l bytes are the keys compared,
+//starting at byte l.
+template <typename Mapped_T>
+typename StringMap<Mapped_T>::Node *StringMap<Mapped_T>::descend(Key_T key, Path &path) const
+{
+	Node *node = head;
+	size_t z = 0;
+	uint32_t l = 0;
+	for(int x = levels - 1; x >= 0; x--)
+	{
+		uint32_t m = 0;
+		while(node -> ptrs()[x] != nullptr)
+		{
+			Node *next = node -> ptrs()[x];
+			m = node -> lcps()[x];
+			if(m < l) break;
+			if(m == l)
+			{
+				size_t n = key.size() < next -> keyLength ? key.size() : next -> keyLength;
+				m = (uint32_t)StringMap_lcp(key.data(), next -> key(), l, n);
+				if(m == key.size() || (m < next -> keyLength && (unsigned char)key[m] < (unsigned char)next -> key()[m])) break;
+				l = m;
+			}
+			z += node -> indexer()[x];
+			node = next;
+			m = 0;
+		}
+		path.updater[x] = node;
+		path.pos[x] = z;
+		path.predLcp[x] = l;
+		path.nextLcp[x] = m;
+	}
+	return node -> ptrs()[0];
+}
+
+//Node holding key, nullptr if none
+template <typename Mapped_T>
+typename StringMap<Mapped_T>::Node *StringMap<Mapped_T>::findNode(Key_T key) const
+{
+	Path path;
+	Node *node = descend(key, path);
+	if(node != nullptr && path.nextLcp[0] == key.size() && node -> keyLength == key.size()) return node;
+	return nullptr;
+}
+
+//Node with 1 based rank r, head for 0
+template <typename Mapped_T>
+typename StringMap<Mapped_T>::Node *StringMap<Mapped_T>::nodeAt(size_t r) const
+{
+	Node *node = head;
+	size_t z = 0;
+	for(int x = levels - 1; x >= 0; x--)
+		while(node -> ptrs()[x] != nullptr && z + node -> indexer()[x] <= r)
+		{
+			z += node -> indexer()[x];
+			node = node -> ptrs()[x];
+		}
+	return node;
+}
+
+//Element Access
+template <typename Mapped_T>
+typename StringMap<Mapped_T>::Iterator StringMap<Mapped_T>::find(Key_T key)
+{
+	return Iterator(findNode(key));
+}
+
+template <typename Mapped_T>
+typename StringMap<Mapped_T>::ConstIterator StringMap<Mapped_T>::find(Key_T key) const
+{
+	return ConstIterator(findNode(key));
+}
+
+template <typename Mapped_T>
+Mapped_T &StringMap<Mapped_T>::at(Key_T key)
+{
+	Node *node = findNode(key);
+	if(node == nullptr) throw std::out_of_range ("");
+	return node -> value();
+}
+
+template <typename Mapped_T>
+const Mapped_T &StringMap<Mapped_T>::at(Key_T key) const
+{
+	Node *node = findNode(key);
+	if(node == nullptr) throw std::out_of_range ("");
+	return node -> value();
+}
+
+template <typename Mapped_T>
+Mapped_T &StringMap<Mapped_T>::operator[](Key_T key)
+{
+	return insert(key, Mapped_T()).first.value();
+}
+
+template <typename Mapped_T>
+Mapped_T &StringMap<Mapped_T>::get(int index)
+{
+	if(index < 0 || (size_t)index >= length) throw std::out_of_range ("");
+	return nodeAt(index + 1) -> value();
+}
+
+template <typename Mapped_T>
+const Mapped_T &StringMap<Mapped_T>::get(int index) const
+{
+	if(index < 0 || (size_t)index >= length) throw std::out_of_range ("");
+	return nodeAt(index + 1) -> value();
+}
+
+template <typename Mapped_T>
+size_t StringMap<Mapped_T>::rank(Key_T key) const
+{
+	Path path;
+	descend(key, path);
+	return path.pos[0];
+}
+
+//Modifiers
+template <typename Mapped_T>
+std::pair<typename StringMap<Mapped_T>::Iterator, bool> StringMap<Mapped_T>::insert(Key_T key, const Mapped_T &obj)
+{
+	Path path;
+	Node *node = descend(key, path);
+	if(node != nullptr && path.nextLcp[0] == key.size() && node -> keyLength == key.size()) return std::make_pair(Iterator(node), false);
+
+	Node *ins = newNode(levelGen.next(levels + 1), key);
+	try
+	{
+		new(&ins -> value()) Mapped_T(obj);
+	}
+	catch(...)
+	{
+		deleteNode(ins);
+		throw;
+	}
+	link(ins, path);
+	return std::make_pair(Iterator(ins), true);
+}
+
+//Links ins in after path.updater[0]. The prefixes the search measured
+//become the lcps() on both sides of ins.
+template <typename Mapped_T>
+void StringMap<Mapped_T>::link(Node *ins, Path &path)
+{
+	unsigned int h = ins -> height;
+	//New levels start out as head spanning the whole map
+	for(unsigned int x = levels; x < h; x++)
+	{
+		head -> ptrs()[x] = nullptr;
+		head -> indexer()[x] = length + 1;
+		path.updater[x] = head;
+		path.pos[x] = 0;
+		path.predLcp[x] = 0;
+		path.nextLcp[x] = 0;
+	}
+	if(h > levels) levels = h;
+
+	size_t r = path.pos[0] + 1;
+	for(unsigned int x = 0; x < h; x++)
+	{
+		Node *pred = path.updater[x];
+		size_t end = path.pos[x] + pred -> indexer()[x];
+		ins -> ptrs()[x] = pred -> ptrs()[x];
+		ins -> indexer()[x] = end + 1 - r;
+		ins -> lcps()[x] = path.nextLcp[x];
+		pred -> ptrs()[x] = ins;
+		pred -> indexer()[x] = r - path.pos[x];
+		pred -> lcps()[x] = path.predLcp[x];
+	}
+	for(unsigned int x = h; x < levels; x++)
+		path.updater[x] -> indexer()[x]++;
+	length++;
+}
+
+//For sorted a < b < c, lcp(a, c) is the smaller of lcp(a, b) and
+//lcp(b, c), so unlinking a node needs no key compares.
+template <typename Mapped_T>
+void StringMap<Mapped_T>::erase(Key_T key)
+{
+	Path path;
+	Node *node = descend(key, path);
+	if(node == nullptr || path.nextLcp[0] != key.size() || node -> keyLength != key.size()) throw std::out_of_range ("");
+
+	for(int x = 0; x < node -> height; x++)
+	{
+		Node *pred = path.updater[x];
+		pred -> ptrs()[x] = node -> ptrs()[x];
+		pred -> indexer()[x] += node -> indexer()[x] - 1;
+		if(node -> lcps()[x] < pred -> lcps()[x]) pred -> lcps()[x] = node -> lcps()[x];
+	}
+	for(unsigned int x = node -> height; x < levels; x++)
+		path.updater[x] -> indexer()[x]--;
+	length--;
+	node -> value().~Mapped_T();
+	deleteNode(node);
+	while(levels > 1 && head -> ptrs()[levels - 1] == nullptr)
+		levels--;
+}
+
+}
+
+#endif